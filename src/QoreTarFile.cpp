@@ -29,11 +29,26 @@
 #include "TarOutputStream.h"
 #include "QC_TarInputStream.h"
 #include "QC_TarOutputStream.h"
+#include "TarHeaderScanner.h"
+#include "TarMetadataCache.h"
+#include "TarEntryQuery.h"
+#include "TarEntryIterator.h"
+#include "QC_TarEntryIterator.h"
+#include "TarParallelExtractor.h"
+#include "TarParallelReader.h"
+#include "TarParallelSink.h"
+#include "TarSpeculativeGzipReader.h"
+#include "TarTreeWalker.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #include <cstring>
 #include <algorithm>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 
 #ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
@@ -112,6 +127,32 @@ private:
     struct archive_entry* entry;
 };
 
+// RAII wrapper for libarchive read handles
+class ArchiveReadGuard {
+public:
+    explicit ArchiveReadGuard(struct archive* a = nullptr) : a(a) {}
+    ~ArchiveReadGuard() { if (a) { archive_read_close(a); archive_read_free(a); } }
+    ArchiveReadGuard(const ArchiveReadGuard&) = delete;
+    ArchiveReadGuard& operator=(const ArchiveReadGuard&) = delete;
+    struct archive* get() const { return a; }
+    struct archive* release() { auto rv = a; a = nullptr; return rv; }
+    explicit operator bool() const { return a != nullptr; }
+private:
+    struct archive* a;
+};
+
+// Returns the libarchive filter name of a compression method, or nullptr for TAR_CM_NONE and invalid methods
+static const char* get_compression_name(int compression_method) {
+    switch (compression_method) {
+        case TAR_CM_GZIP:  return "gzip";
+        case TAR_CM_BZIP2: return "bzip2";
+        case TAR_CM_XZ:    return "xz";
+        case TAR_CM_ZSTD:  return "zstd";
+        case TAR_CM_LZ4:   return "lz4";
+        default: return nullptr;
+    }
+}
+
 // Helper function to check for path traversal attacks
 // Returns true if path is safe, false if it contains dangerous components
 static bool isPathSafe(const char* path) {
@@ -148,74 +189,168 @@ static bool isPathSafe(const char* path) {
     return true;
 }
 
-// Buffer size for reading/writing
-#define TAR_BUFFER_SIZE 65536
+int TarWriteBuffer::append(const void* data, size_t n) {
+    if (n > capacity - len) {
+        size_t new_capacity = capacity ? capacity : TAR_WRITE_BUFFER_INITIAL_CAPACITY;
+        while (new_capacity - len < n) {
+            new_capacity *= 2;
+        }
+        char* p = static_cast<char*>(realloc(buf, new_capacity));
+        if (!p) {
+            return -1;
+        }
+        buf = p;
+        capacity = new_capacity;
+    }
+    memcpy(buf + len, data, n);
+    len += n;
+    return 0;
+}
+
+BinaryNode* TarWriteBuffer::release() {
+    if (!len) {
+        return new BinaryNode();
+    }
+    // return unused capacity; shrinking is done in place
+    char* p = static_cast<char*>(realloc(buf, len));
+    BinaryNode* rv = new BinaryNode(p ? p : buf, len);
+    buf = nullptr;
+    len = capacity = 0;
+    return rv;
+}
 
 // Constructor for file-based archive
-QoreTarFile::QoreTarFile(const char* path, TarMode mode, int compression_method, int format, ExceptionSink* xsink)
+QoreTarFile::QoreTarFile(const char* path, TarMode mode, int compression_method, int format,
+                         const QoreHashNode* opts, ExceptionSink* xsink)
     : filepath(path), mode(mode), read_archive(nullptr), write_archive(nullptr),
       compression_method(compression_method), compression_level(-1), format(format), in_memory(false), closed(false),
-      memory_pos(0), input_stream(nullptr), output_stream(nullptr) {
+      memory_data(nullptr), memory_size(0), memory_pos(0), input_stream(nullptr), output_stream(nullptr),
+      use_mmap(false), scan_pos(-1), seek_checked(false), seek_flags(0), native_scan(true),
+      use_index_file(true), write_index_file(false), use_metadata_cache(true), have_open_fp(false),
+      gzip_checkpoints(false), checkpoint_interval(TAR_GZIP_DEFAULT_CHECKPOINT_INTERVAL), seekable(false),
+      frame_size(TAR_DEFAULT_FRAME_SIZE) {
 
     // Auto-detect compression from filename if not specified
     if (compression_method < 0) {
         this->compression_method = detect_compression_from_filename(path);
     }
 
+    parseCreateOptions(opts, xsink);
+    if (*xsink) {
+        return;
+    }
+
     if (mode == TAR_MODE_READ) {
+        // the fingerprint is taken before the archive is opened, so that an index built from it is only
+        // cached if the archive has not been changed in the meantime
+        have_open_fp = use_metadata_cache && !open_fp.get(path);
         openRead(xsink);
-    } else if (mode == TAR_MODE_APPEND) {
-        openAppend(xsink);
+        if (!*xsink) {
+            if (use_index_file) {
+                loadIndexFile();
+            }
+            if (have_open_fp && !entry_index.isComplete()) {
+                loadCachedIndex();
+            }
+        }
     } else {
-        openWrite(xsink);
+        tar_metadata_cache.invalidate(filepath);
+        if (mode == TAR_MODE_APPEND) {
+            openAppend(xsink);
+        } else {
+            openWrite(xsink);
+        }
     }
 }
 
 // Constructor for in-memory archive (from binary data)
-QoreTarFile::QoreTarFile(const BinaryNode* data, ExceptionSink* xsink)
+QoreTarFile::QoreTarFile(const BinaryNode* data, const QoreHashNode* opts, ExceptionSink* xsink)
     : mode(TAR_MODE_READ), read_archive(nullptr), write_archive(nullptr),
       compression_method(TAR_CM_NONE), compression_level(-1), format(TAR_FORMAT_PAX), in_memory(true), closed(false),
-      memory_pos(0), input_stream(nullptr), output_stream(nullptr) {
+      memory_data(nullptr), memory_size(0), memory_pos(0), input_stream(nullptr), output_stream(nullptr),
+      use_mmap(false), scan_pos(-1), seek_checked(false), seek_flags(0), native_scan(true),
+      use_index_file(false), write_index_file(false), use_metadata_cache(false), have_open_fp(false),
+      gzip_checkpoints(false), checkpoint_interval(TAR_GZIP_DEFAULT_CHECKPOINT_INTERVAL), seekable(false),
+      frame_size(TAR_DEFAULT_FRAME_SIZE) {
+
+    QoreValue v = opts ? opts->getKeyValue("threads") : QoreValue();
+    if (!v.isNothing() && parseThreads(v, threads, xsink)) {
+        return;
+    }
+    v = opts ? opts->getKeyValue("speculative_gzip") : QoreValue();
+    if (!v.isNothing()) {
+        speculative_gzip = v.getAsBool();
+    }
+    v = opts ? opts->getKeyValue("concurrent_reads") : QoreValue();
+    if (!v.isNothing()) {
+        concurrent_reads = v.getAsBool();
+    }
 
     if (data && data->size() > 0) {
-        memory_buffer.resize(data->size());
-        memcpy(memory_buffer.data(), data->getPtr(), data->size());
+        memory_binary = data->refSelf();
+        memory_data = static_cast<const char*>(data->getPtr());
+        memory_size = data->size();
     }
     openRead(xsink);
 }
 
 // Constructor for new in-memory archive
-QoreTarFile::QoreTarFile(int compression_method, int format, ExceptionSink* xsink)
+QoreTarFile::QoreTarFile(int compression_method, int format, const QoreHashNode* opts, ExceptionSink* xsink)
     : mode(TAR_MODE_WRITE), read_archive(nullptr), write_archive(nullptr),
       compression_method(compression_method >= 0 ? compression_method : TAR_CM_NONE),
       compression_level(-1), format(format >= 0 ? format : TAR_FORMAT_PAX), in_memory(true), closed(false),
-      memory_pos(0), input_stream(nullptr), output_stream(nullptr) {
+      memory_data(nullptr), memory_size(0), memory_pos(0), input_stream(nullptr), output_stream(nullptr),
+      use_mmap(false), scan_pos(-1), seek_checked(false), seek_flags(0), native_scan(true),
+      use_index_file(false), write_index_file(false), use_metadata_cache(false), have_open_fp(false),
+      gzip_checkpoints(false), checkpoint_interval(TAR_GZIP_DEFAULT_CHECKPOINT_INTERVAL), seekable(false),
+      frame_size(TAR_DEFAULT_FRAME_SIZE) {
 
+    parseCreateOptions(opts, xsink);
+    if (*xsink) {
+        return;
+    }
     openWrite(xsink);
 }
 
 // Constructor for stream-based reading
-QoreTarFile::QoreTarFile(InputStream* input, ExceptionSink* xsink)
+QoreTarFile::QoreTarFile(InputStream* input, const QoreHashNode* opts, ExceptionSink* xsink)
     : mode(TAR_MODE_READ), read_archive(nullptr), write_archive(nullptr),
       compression_method(TAR_CM_NONE), compression_level(-1), format(TAR_FORMAT_PAX), in_memory(false), closed(false),
-      memory_pos(0), input_stream(input), output_stream(nullptr) {
+      memory_data(nullptr), memory_size(0), memory_pos(0), input_stream(input), output_stream(nullptr),
+      use_mmap(false), scan_pos(-1), seek_checked(false), seek_flags(0), native_scan(true),
+      use_index_file(false), write_index_file(false), use_metadata_cache(false), have_open_fp(false),
+      gzip_checkpoints(false), checkpoint_interval(TAR_GZIP_DEFAULT_CHECKPOINT_INTERVAL), seekable(false),
+      frame_size(TAR_DEFAULT_FRAME_SIZE) {
 
     if (input) {
         input->ref();
     }
+    parseCreateOptions(opts, xsink);
+    if (*xsink) {
+        return;
+    }
     openRead(xsink);
 }
 
 // Constructor for stream-based writing
-QoreTarFile::QoreTarFile(OutputStream* output, int compression_method, int format, ExceptionSink* xsink)
+QoreTarFile::QoreTarFile(OutputStream* output, int compression_method, int format, const QoreHashNode* opts,
+                         ExceptionSink* xsink)
     : mode(TAR_MODE_WRITE), read_archive(nullptr), write_archive(nullptr),
       compression_method(compression_method >= 0 ? compression_method : TAR_CM_NONE),
       compression_level(-1), format(format >= 0 ? format : TAR_FORMAT_PAX), in_memory(false), closed(false),
-      memory_pos(0), input_stream(nullptr), output_stream(output) {
+      memory_data(nullptr), memory_size(0), memory_pos(0), input_stream(nullptr), output_stream(output),
+      use_mmap(false), scan_pos(-1), seek_checked(false), seek_flags(0), native_scan(true),
+      use_index_file(false), write_index_file(false), use_metadata_cache(false), have_open_fp(false),
+      gzip_checkpoints(false), checkpoint_interval(TAR_GZIP_DEFAULT_CHECKPOINT_INTERVAL), seekable(false),
+      frame_size(TAR_DEFAULT_FRAME_SIZE) {
 
     if (output) {
         output->ref();
     }
+    parseCreateOptions(opts, xsink);
+    if (*xsink) {
+        return;
+    }
     openWrite(xsink);
 }
 
@@ -235,9 +370,15 @@ QoreTarFile::~QoreTarFile() {
 
 // Close the archive
 void QoreTarFile::close(ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (closed) {
         return;
     }
+    if (stream_entry) {
+        xsink->raiseException("TAR-ERROR", "cannot close the archive while an entry is being written with a "
+            "TarOutputStream; close the stream first");
+        return;
+    }
 
     if (read_archive) {
         archive_read_close(read_archive);
@@ -246,40 +387,97 @@ void QoreTarFile::close(ExceptionSink* xsink) {
     }
 
     if (write_archive) {
-        archive_write_close(write_archive);
+        // errors are reported for archives written to files and streams and for compression sinks; as the data
+        // is written by the write-behind thread, errors writing it may only be known now
+        bool own_output = sink || write_behind;
+        // the compression sink may end the current member before the end-of-archive blocks
+        if (sink && sink->startTrailer(write_archive)) {
+            xsink->raiseException("TAR-ERROR", "failed to close archive: %s", get_archive_error(write_archive));
+        } else if (archive_write_close(write_archive) != ARCHIVE_OK && own_output) {
+            xsink->raiseException("TAR-ERROR", "failed to close archive: %s", get_archive_error(write_archive));
+        }
         archive_write_free(write_archive);
         write_archive = nullptr;
     }
+    sink.reset();
+    discardOutput();
+    // indexes cached by readers while the archive was being written are discarded
+    if (mode != TAR_MODE_READ && !filepath.empty()) {
+        tar_metadata_cache.invalidate(filepath);
+    }
 
     closed = true;
 }
 
+// Write the data queued for the archive file or output stream
+void QoreTarFile::flush(ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, true)) {
+        return;
+    }
+    std::string err;
+    if (write_behind && write_behind->flush(err)) {
+        xsink->raiseException("TAR-ERROR", "failed to write archive: %s", err.c_str());
+    }
+}
+
 // Get archive as binary data
 BinaryNode* QoreTarFile::toData(ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!in_memory) {
         xsink->raiseException("TAR-ERROR", "cannot get binary data from file-based archive");
         return nullptr;
     }
 
+    if (stream_entry) {
+        xsink->raiseException("TAR-ERROR", "cannot complete the archive while an entry is being written with a "
+            "TarOutputStream; close the stream first");
+        return nullptr;
+    }
+
     if (mode == TAR_MODE_WRITE && write_archive) {
         // Close write archive to finalize data
-        archive_write_close(write_archive);
+        int r = sink && sink->startTrailer(write_archive) ? ARCHIVE_FATAL : archive_write_close(write_archive);
+        if (r != ARCHIVE_OK && sink) {
+            xsink->raiseException("TAR-ERROR", "failed to close archive: %s", get_archive_error(write_archive));
+        }
         archive_write_free(write_archive);
         write_archive = nullptr;
+        sink.reset();
+        if (*xsink) {
+            return nullptr;
+        }
     }
 
-    if (memory_buffer.empty()) {
-        return new BinaryNode();
+    // the written archive is complete now, so its buffer is handed over without copying; later calls
+    // return the same data
+    if (mode == TAR_MODE_WRITE && !memory_binary) {
+        memory_binary = memory_buffer.release();
+        memory_data = static_cast<const char*>(memory_binary->getPtr());
+        memory_size = memory_binary->size();
     }
 
-    // Create a copy of the data - BinaryNode takes ownership of passed memory
-    BinaryNode* result = new BinaryNode();
-    result->append(memory_buffer.data(), memory_buffer.size());
-    return result;
+    return memory_binary ? memory_binary->refSelf() : new BinaryNode();
 }
 
 // Open for reading
 void QoreTarFile::openRead(ExceptionSink* xsink) {
+    parallel_filter = -1;
+    speculative_read = false;
+    if (threads > 1 && !input_stream && openParallelRead(xsink)) {
+        return;
+    }
+    if (input_stream) {
+        // the stream is read ahead by a background thread while libarchive parses and decompresses the data
+        std::unique_ptr<TarStreamReader> reader(new TarStreamReader(input_stream, read_ahead, read_ahead_size));
+        if (reader->start()) {
+            xsink->raiseException("TAR-ERROR", "failed to start the read-ahead thread");
+            return;
+        }
+        read_archive = tar_open_seek_reader(reader.release(), xsink, true);
+        return;
+    }
+
     read_archive = archive_read_new();
     if (!read_archive) {
         xsink->raiseException("TAR-ERROR", "failed to create archive reader");
@@ -292,13 +490,25 @@ void QoreTarFile::openRead(ExceptionSink* xsink) {
 
     int r;
     if (in_memory) {
-        if (memory_buffer.empty()) {
+        if (!memory_size) {
             // Empty archive, nothing to read
             return;
         }
-        r = archive_read_open_memory(read_archive, memory_buffer.data(), memory_buffer.size());
-    } else if (input_stream) {
-        r = archive_read_open(read_archive, this, nullptr, stream_read_callback, stream_close_callback);
+        // the data is read in place from the binary the archive was created from
+        r = archive_read_open_memory(read_archive, memory_data, memory_size);
+    } else if (use_mmap) {
+        // the file is mapped once; later scans read the same mapping
+        if (!file_map) {
+            file_map.reset(TarFileMapping::map(filepath.c_str()));
+            if (!file_map) {
+                xsink->raiseException("TAR-ERROR", "failed to map archive file: %s", strerror(errno));
+                archive_read_free(read_archive);
+                read_archive = nullptr;
+                return;
+            }
+        }
+        file_map->adviseSequential(true);
+        r = archive_read_open_memory(read_archive, file_map->data(), file_map->size());
     } else {
         r = archive_read_open_filename(read_archive, filepath.c_str(), TAR_BUFFER_SIZE);
     }
@@ -311,6 +521,55 @@ void QoreTarFile::openRead(ExceptionSink* xsink) {
     }
 }
 
+// Open for reading with a pool of decompression threads
+bool QoreTarFile::openParallelRead(ExceptionSink* xsink) {
+    const char* data;
+    size_t len;
+    if (in_memory) {
+        data = memory_data;
+        len = memory_size;
+    } else {
+        // the threads read the compressed data from a mapping of the file, which later scans share
+        if (!file_map) {
+            file_map.reset(TarFileMapping::map(filepath.c_str()));
+            if (!file_map) {
+                return false;
+            }
+        }
+        file_map->adviseSequential(true);
+        data = file_map->data();
+        len = file_map->size();
+    }
+
+    TarSeekReader* reader = nullptr;
+#ifdef HAVE_ZLIB
+    if (speculative_gzip) {
+        if (!speculative_stats) {
+            speculative_stats = std::make_shared<TarSpeculativeGzipStats>();
+        }
+        reader = TarSpeculativeGzipReader::create(data, len, threads, speculative_stats);
+        if (reader) {
+            parallel_filter = ARCHIVE_FILTER_GZIP;
+            speculative_read = true;
+        }
+    }
+#endif
+    if (!reader) {
+        TarParallelReader* parallel_reader = TarParallelReader::create(data, len, threads);
+        if (!parallel_reader) {
+            // without the mmap option, archives that cannot be read in parallel are read from the file as usual
+            if (!use_mmap) {
+                file_map.reset();
+            }
+            return false;
+        }
+        parallel_filter = parallel_reader->getFilter();
+        reader = parallel_reader;
+    }
+    read_archive = tar_open_seek_reader(reader, xsink, true);
+    return true;
+}
+
 // Open for writing
 void QoreTarFile::openWrite(ExceptionSink* xsink) {
     write_archive = archive_write_new();
@@ -330,20 +589,29 @@ void QoreTarFile::openWrite(ExceptionSink* xsink) {
     }
 
     // Setup compression filter
-    setupCompressionFilter(xsink);
+    if (seekable || append_members || useParallelSink()) {
+        setupCompressionSink(xsink);
+    } else {
+        setupCompressionFilter(xsink);
+    }
+    if (!*xsink && !in_memory) {
+        setupOutput(xsink);
+    }
     if (*xsink) {
         archive_write_free(write_archive);
         write_archive = nullptr;
+        sink.reset();
+        discardOutput();
         return;
     }
 
     int r;
-    if (in_memory) {
+    if (sink) {
+        r = archive_write_open(write_archive, this, nullptr, sink_write_callback, sink_close_callback);
+    } else if (in_memory) {
         r = archive_write_open(write_archive, this, nullptr, memory_write_callback, memory_close_callback);
-    } else if (output_stream) {
-        r = archive_write_open(write_archive, this, nullptr, stream_write_callback, stream_close_callback);
     } else {
-        r = archive_write_open_filename(write_archive, filepath.c_str());
+        r = archive_write_open(write_archive, this, nullptr, output_write_callback, output_close_callback);
     }
 
     if (r != ARCHIVE_OK) {
@@ -351,6 +619,8 @@ void QoreTarFile::openWrite(ExceptionSink* xsink) {
                               get_archive_error(write_archive));
         archive_write_free(write_archive);
         write_archive = nullptr;
+        sink.reset();
+        discardOutput();
     }
 }
 
@@ -362,6 +632,9 @@ void QoreTarFile::openAppend(ExceptionSink* xsink) {
     // 3. Copy all existing entries
     // 4. Then allow new entries to be added
 
+    // gzip and zstd archives are written as members that later appends can add to
+    append_members = !seekable && TarMemberSink::supported(compression_method);
+
     // Check if file exists
     struct stat st;
     if (stat(filepath.c_str(), &st) != 0) {
@@ -371,6 +644,12 @@ void QoreTarFile::openAppend(ExceptionSink* xsink) {
         return;
     }
 
+    // uncompressed archives and gzip and zstd archives ending with a separate member for the end-of-archive
+    // blocks are appended to in place; others are rewritten with the new entries
+    if ((compression_method == TAR_CM_NONE || append_members) && !seekable && openAppendInPlace(xsink)) {
+        return;
+    }
+
     // Read existing archive into memory
     std::vector<char> existing_data;
     FileHandle fp(fopen(filepath.c_str(), "rb"));
@@ -422,6 +701,40 @@ void QoreTarFile::openAppend(ExceptionSink* xsink) {
     // Mode stays as APPEND so we know we're in append mode
 }
 
+// Open an archive file for appending in place
+bool QoreTarFile::openAppendInPlace(ExceptionSink* xsink) {
+    int64 end;
+    if (append_members) {
+        // the existing compressed data is kept up to the member holding the end-of-archive blocks
+        if (tar_find_trailer_member(filepath.c_str(), compression_method, end)) {
+            return false;
+        }
+    } else {
+        // the end of the archive is found by reading its headers; archives that the header scanner cannot read
+        // completely are rewritten
+        std::unique_ptr<TarFileSeekSource> src(TarFileSeekSource::open(filepath.c_str()));
+        std::vector<TarIndexEntry> entries;
+        if (!src || tar_scan_headers(*src, entries, &end)) {
+            return false;
+        }
+    }
+
+    append_fd = ::open(filepath.c_str(), O_WRONLY | O_CLOEXEC);
+    if (append_fd < 0) {
+        xsink->raiseException("TAR-ERROR", "failed to open archive for appending: %s", strerror(errno));
+        return true;
+    }
+    // new entries overwrite the end-of-archive blocks; the new trailer is written when the archive is closed
+    append_start = append_pos = end;
+
+    openWrite(xsink);
+    if (*xsink && append_fd >= 0) {
+        ::close(append_fd);
+        append_fd = -1;
+    }
+    return true;
+}
+
 // Copy entries from read archive to write archive
 void QoreTarFile::copyEntries(ExceptionSink* xsink) {
     if (!read_archive || !write_archive) {
@@ -433,7 +746,7 @@ void QoreTarFile::copyEntries(ExceptionSink* xsink) {
 
     while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
         // Write header to new archive
-        int r = archive_write_header(write_archive, entry);
+        int r = tar_write_header(write_archive, sink.get(), entry);
         if (r != ARCHIVE_OK) {
             xsink->raiseException("TAR-ERROR", "failed to copy entry header: %s",
                                   get_archive_error(write_archive));
@@ -496,15 +809,7 @@ void QoreTarFile::setupCompressionFilter(ExceptionSink* xsink) {
     // Set compression level if specified (1-9)
     if (compression_level >= 1 && compression_level <= 9 && compression_method != TAR_CM_NONE) {
         char level_option[32];
-        const char* filter_name = nullptr;
-        switch (compression_method) {
-            case TAR_CM_GZIP:  filter_name = "gzip"; break;
-            case TAR_CM_BZIP2: filter_name = "bzip2"; break;
-            case TAR_CM_XZ:    filter_name = "xz"; break;
-            case TAR_CM_ZSTD:  filter_name = "zstd"; break;
-            case TAR_CM_LZ4:   filter_name = "lz4"; break;
-            default: break;
-        }
+        const char* filter_name = get_compression_name(compression_method);
         if (filter_name) {
             snprintf(level_option, sizeof(level_option), "%s:compression-level=%d", filter_name, compression_level);
             r = archive_write_set_options(write_archive, level_option);
@@ -515,8 +820,100 @@ void QoreTarFile::setupCompressionFilter(ExceptionSink* xsink) {
     }
 }
 
+// Check if the archive is compressed with multiple threads
+bool QoreTarFile::useParallelSink() const {
+    return threads > 1 && !seekable && TarParallelSink::supported(compression_method);
+}
+
+// Set up the compression sink for archives whose compressed layout is written by the module
+void QoreTarFile::setupCompressionSink(ExceptionSink* xsink) {
+    if (seekable && compression_method != TAR_CM_ZSTD && compression_method != TAR_CM_XZ) {
+        xsink->raiseException("TAR-ERROR", "seekable archives are only supported with TAR_CM_ZSTD and TAR_CM_XZ "
+            "compression");
+        return;
+    }
+#ifndef HAVE_ZSTD
+    if (compression_method == TAR_CM_ZSTD) {
+        xsink->raiseException("TAR-ERROR", "seekable zstd archives are not supported; the module was built without "
+            "libzstd");
+        return;
+    }
+#endif
+#ifndef HAVE_LZMA
+    if (compression_method == TAR_CM_XZ) {
+        xsink->raiseException("TAR-ERROR", "seekable xz archives are not supported; the module was built without "
+            "liblzma");
+        return;
+    }
+#endif
+
+    // the sink needs all data as soon as it is written to see entry boundaries, so libarchive must not block it
+    if (archive_write_add_filter_none(write_archive) != ARCHIVE_OK
+        || archive_write_set_bytes_per_block(write_archive, 0) != ARCHIVE_OK) {
+        xsink->raiseException("TAR-ERROR", "failed to set up archive writer: %s", get_archive_error(write_archive));
+        return;
+    }
+
+    TarSinkOutput output;
+    if (in_memory) {
+        output = [this] (const void* data, size_t len, std::string& err) -> int {
+            if (memory_buffer.append(data, len)) {
+                err = "out of memory";
+                return -1;
+            }
+            return 0;
+        };
+    } else {
+        // the output is opened by setupOutput() once the sink has been created
+        output = [this] (const void* data, size_t len, std::string& err) -> int {
+            return write_behind->write(data, len, err);
+        };
+    }
+
+    std::string err;
+    if (useParallelSink()) {
+        sink.reset(TarParallelSink::create(output, compression_method, compression_level, threads, err));
+    } else if (!seekable) {
+        sink.reset(TarMemberSink::create(output, compression_method, compression_level, err));
+    }
+#ifdef HAVE_ZSTD
+    else if (compression_method == TAR_CM_ZSTD) {
+        sink.reset(TarZstdFrameSink::create(output, compression_level, frame_size, err));
+    }
+#endif
+#ifdef HAVE_LZMA
+    else if (compression_method == TAR_CM_XZ) {
+        sink.reset(TarXzBlockSink::create(output, compression_level, frame_size, err));
+    }
+#endif
+    if (!sink) {
+        xsink->raiseException("TAR-ERROR", "failed to set up %s compression: %s",
+            get_compression_name(compression_method), err.c_str());
+    }
+}
+
 // Reopen archive for reading
 void QoreTarFile::reopenRead(ExceptionSink* xsink) {
+    // the data of stream-based archives is gone once read, so the reader opened by the constructor is used for
+    // the first pass over the archive, and there is no other
+    if (input_stream) {
+        if (stream_started) {
+            xsink->raiseException("TAR-ERROR", "stream-based archives can only be read once; use readMany() or "
+                "extractAll() to read several entries");
+            scan_pos = -1;
+            return;
+        }
+        stream_started = true;
+        scan_pos = 0;
+        return;
+    }
+    if (seek_source) {
+        // scans of seekable archives also use the seek source, so entry data can be skipped without reading it
+        if (!openReadAt(0, xsink)) {
+            scan_pos = 0;
+        }
+        return;
+    }
     if (read_archive) {
         archive_read_close(read_archive);
         archive_read_free(read_archive);
@@ -524,283 +921,1026 @@ void QoreTarFile::reopenRead(ExceptionSink* xsink) {
     }
     memory_pos = 0;
     openRead(xsink);
+    scan_pos = *xsink ? -1 : 0;
 }
 
-// Check archive is open
-bool QoreTarFile::checkOpen(ExceptionSink* xsink, bool forWrite) {
-    if (closed) {
-        xsink->raiseException("TAR-ERROR", "archive is closed");
-        return false;
+// Open the read cursor at an entry header
+int QoreTarFile::openReadAt(int64 offset, ExceptionSink* xsink) {
+    if (read_archive) {
+        archive_read_close(read_archive);
+        archive_read_free(read_archive);
+        read_archive = nullptr;
     }
+    scan_pos = -1;
 
-    if (forWrite) {
-        if (!write_archive) {
-            xsink->raiseException("TAR-ERROR", "archive is not open for writing");
-            return false;
-        }
-    } else {
-        if (!read_archive && !in_memory) {
-            xsink->raiseException("TAR-ERROR", "archive is not open for reading");
-            return false;
-        }
+    // reads at entry offsets are lookups, reads from the start are scans
+    if (file_map) {
+        file_map->adviseSequential(!offset);
     }
-
-    return true;
+    TarSeekReader* reader = seek_source->openAt(offset, xsink);
+    if (!reader) {
+        return -1;
+    }
+    read_archive = tar_open_seek_reader(reader, xsink);
+    return read_archive ? 0 : -1;
 }
 
-// Get list of all entries
-QoreListNode* QoreTarFile::entries(ExceptionSink* xsink) {
-    if (!checkOpen(xsink, false)) {
-        return nullptr;
-    }
+// Set up the seek source for uncompressed tar archives
+void QoreTarFile::checkSeekable() {
+    seek_checked = true;
 
-    // Reopen to read from beginning
-    reopenRead(xsink);
-    if (*xsink) {
-        return nullptr;
+    // entry offsets can be used directly in uncompressed tar archives, in seekable zstd archives and in xz
+    // archives with multiple blocks, and in gzip archives with checkpoints
+    if ((archive_format(read_archive) & ARCHIVE_FORMAT_BASE_MASK) != ARCHIVE_FORMAT_TAR || input_stream) {
+        return;
     }
 
-    QoreListNode* list = new QoreListNode(hashdeclTarEntryInfo->getTypeInfo());
+    // archives decompressed by a parallel reader are passed to libarchive already decompressed
+    switch (parallel_filter >= 0 ? parallel_filter : archive_filter_code(read_archive, 0)) {
+        case ARCHIVE_FILTER_NONE:
+            seek_flags = TIDX_FLAG_RAW_TAR;
+            break;
+#ifdef HAVE_ZSTD
+        case ARCHIVE_FILTER_ZSTD:
+            seek_flags = TIDX_FLAG_ZSTD_SEEKABLE;
+            break;
+#endif
+#ifdef HAVE_LZMA
+        case ARCHIVE_FILTER_XZ:
+            seek_flags = TIDX_FLAG_XZ_BLOCKS;
+            break;
+#endif
+#ifdef HAVE_ZLIB
+        case ARCHIVE_FILTER_GZIP:
+            if (!gzip_checkpoints || in_memory) {
+                return;
+            }
+            seek_flags = TIDX_FLAG_GZIP_CHECKPOINTS;
+            break;
+#endif
+        default:
+            return;
+    }
 
-    struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        QoreHashNode* info = createEntryInfo(entry, xsink);
-        if (*xsink) {
-            list->deref(xsink);
-            return nullptr;
+    if (in_memory) {
+        if (seek_flags & TIDX_FLAG_RAW_TAR) {
+            seek_source.reset(new TarMemorySeekSource(memory_data, memory_size));
         }
-        list->push(info, xsink);
-        archive_read_data_skip(read_archive);
+#ifdef HAVE_ZSTD
+        else if (seek_flags & TIDX_FLAG_ZSTD_SEEKABLE) {
+            seek_source.reset(TarZstdSeekSource::open(memory_data, memory_size));
+        }
+#endif
+#ifdef HAVE_LZMA
+        else if (seek_flags & TIDX_FLAG_XZ_BLOCKS) {
+            seek_source.reset(TarXzSeekSource::open(memory_data, memory_size));
+        }
+#endif
+    } else {
+        // if the file cannot be opened again or has no seek table, lookups fall back to sequential scans
+        openFileSeekSource();
     }
-
-    return list;
 }
 
-// Get number of entries
-int64 QoreTarFile::count(ExceptionSink* xsink) {
-    if (!checkOpen(xsink, false)) {
-        return -1;
+// Open the seek source for the archive file according to the seek flags
+void QoreTarFile::openFileSeekSource() {
+    // mapped files are read in place; gzip checkpoints are only supported for files
+    if (file_map && !(seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS)) {
+        if (seek_flags & TIDX_FLAG_RAW_TAR) {
+            seek_source.reset(new TarMemorySeekSource(file_map->data(), file_map->size()));
+        }
+#ifdef HAVE_ZSTD
+        else if (seek_flags & TIDX_FLAG_ZSTD_SEEKABLE) {
+            seek_source.reset(TarZstdSeekSource::open(file_map->data(), file_map->size()));
+        }
+#endif
+#ifdef HAVE_LZMA
+        else if (seek_flags & TIDX_FLAG_XZ_BLOCKS) {
+            seek_source.reset(TarXzSeekSource::open(file_map->data(), file_map->size()));
+        }
+#endif
+        return;
     }
 
-    reopenRead(xsink);
-    if (*xsink) {
-        return -1;
+    if (seek_flags & TIDX_FLAG_RAW_TAR) {
+        seek_source.reset(TarFileSeekSource::open(filepath.c_str()));
     }
-
-    int64 count = 0;
-    struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        count++;
-        archive_read_data_skip(read_archive);
+#ifdef HAVE_ZSTD
+    else if (seek_flags & TIDX_FLAG_ZSTD_SEEKABLE) {
+        seek_source.reset(TarZstdSeekSource::open(filepath.c_str()));
     }
-
-    return count;
+#endif
+#ifdef HAVE_LZMA
+    else if (seek_flags & TIDX_FLAG_XZ_BLOCKS) {
+        seek_source.reset(TarXzSeekSource::open(filepath.c_str()));
+    }
+#endif
+#ifdef HAVE_ZLIB
+    else if (seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS) {
+        seek_source.reset(TarGzipSeekSource::open(filepath.c_str(), checkpoint_interval));
+    }
+#endif
 }
 
-// Check if entry exists
-bool QoreTarFile::hasEntry(const char* name, ExceptionSink* xsink) {
-    if (!checkOpen(xsink, false)) {
-        return false;
+// Restart the first scan using the seek source
+void QoreTarFile::restartScanAtSeekSource(struct archive_entry** entry) {
+    ExceptionSink xsink;
+    TarSeekReader* reader = seek_source->openAt(0, &xsink);
+    struct archive* a = reader ? tar_open_seek_reader(reader, &xsink) : nullptr;
+    struct archive_entry* first;
+    if (a && archive_read_next_header(a, &first) == ARCHIVE_OK) {
+        archive_read_close(read_archive);
+        archive_read_free(read_archive);
+        read_archive = a;
+        *entry = first;
+        return;
     }
 
-    reopenRead(xsink);
-    if (*xsink) {
-        return false;
+    // the current read cursor is still positioned at the first entry, so the scan continues with it
+    if (a) {
+        archive_read_free(a);
     }
+    xsink.clear();
+    seek_source.reset();
+    seek_flags = 0;
+}
 
-    struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        if (entryNameEquals(archive_entry_pathname(entry), name)) {
-            return true;
+// Read the next header and record it in the entry index
+int QoreTarFile::nextHeader(struct archive_entry** entry) {
+    int r = archive_read_next_header(read_archive, entry);
+    if (scan_pos < 0 || !useIndex()) {
+        return r;
+    }
+
+    if (r == ARCHIVE_OK) {
+        if (!scan_pos && !seek_checked) {
+            checkSeekable();
+            // checkpoints are recorded by the seek source, so the first scan has to read the archive through it
+            if (seek_source && (seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS)) {
+                restartScanAtSeekSource(entry);
+            }
         }
-        archive_read_data_skip(read_archive);
+        // entries already indexed by a previous scan are not added again
+        if ((size_t)scan_pos == entry_index.size() && !entry_index.isComplete()) {
+            TarIndexEntry e;
+            e.set(read_archive, *entry);
+            entry_index.add(std::move(e));
+        }
+        ++scan_pos;
+    } else if (r == ARCHIVE_EOF && !entry_index.isComplete() && (size_t)scan_pos == entry_index.size()) {
+        setIndexComplete();
     }
+    return r;
+}
 
-    return false;
+// Mark the entry index as complete
+void QoreTarFile::setIndexComplete() {
+    entry_index.setComplete();
+    updateIndexFile();
+    storeCachedIndex();
 }
 
-// Get entry info
-QoreHashNode* QoreTarFile::getEntry(const char* name, ExceptionSink* xsink) {
+// Write the index file if requested
+void QoreTarFile::updateIndexFile() {
+    if (write_index_file) {
+        // the index file is only a cache, so failing to write it does not affect the operation
+        ExceptionSink xsink;
+        saveIndexFile(getIndexPath().c_str(), &xsink);
+        xsink.clear();
+    }
+}
+
+// Read the headers of an uncompressed archive without libarchive
+int QoreTarFile::scanHeaders() {
+    if (!useIndex()) {
+        return -1;
+    }
+    if (entry_index.isComplete()) {
+        return 0;
+    }
+    if (!native_scan || input_stream) {
+        return -1;
+    }
+
+    // the archive is identified by libarchive when the first header is read
+    if (!seek_checked) {
+        ExceptionSink xsink;
+        reopenRead(&xsink);
+        struct archive_entry* entry;
+        int r = xsink ? ARCHIVE_FATAL : nextHeader(&entry);
+        xsink.clear();
+        if (r != ARCHIVE_OK) {
+            // empty archives are completely indexed at this point
+            native_scan = false;
+            return entry_index.isComplete() ? 0 : -1;
+        }
+    }
+    if (!seek_source || !(seek_flags & TIDX_FLAG_RAW_TAR)) {
+        native_scan = false;
+        return -1;
+    }
+
+    std::vector<TarIndexEntry> scanned;
+    if (tar_scan_headers(*static_cast<const TarRawSeekSource*>(seek_source.get()), scanned)) {
+        native_scan = false;
+        return -1;
+    }
+    // entries indexed by earlier scans are replaced; they are the same as the first entries scanned here
+    entry_index.clear();
+    for (TarIndexEntry& e : scanned) {
+        entry_index.add(std::move(e));
+    }
+    setIndexComplete();
+    return 0;
+}
+
+// Read all remaining headers into the entry index
+int QoreTarFile::buildIndex(ExceptionSink* xsink) {
+    if (!scanHeaders()) {
+        return 0;
+    }
+
+    reopenRead(xsink);
+    if (*xsink) {
+        return -1;
+    }
+
+    struct archive_entry* entry;
+    int r;
+    while ((r = nextHeader(&entry)) == ARCHIVE_OK) {
+        archive_read_data_skip(read_archive);
+    }
+    if (r != ARCHIVE_EOF) {
+        xsink->raiseException("TAR-ERROR", "failed to read archive: %s", get_archive_error(read_archive));
+        return -1;
+    }
+    return 0;
+}
+
+// Get the index file path
+std::string QoreTarFile::getIndexPath() const {
+    return index_path.empty() ? filepath + ".idx" : index_path;
+}
+
+// Load the entry index from the index file
+void QoreTarFile::loadIndexFile() {
+    TarIndexFingerprint fp;
+    if (fp.get(filepath.c_str())) {
+        return;
+    }
+    unsigned file_flags;
+    if (!entry_index.load(getIndexPath().c_str(), fp, file_flags)) {
+        return;
+    }
+    // the archive type is known from the index file, so it does not have to be checked on the first scan
+    seek_checked = true;
+    seek_flags = file_flags & (TIDX_FLAG_RAW_TAR | TIDX_FLAG_ZSTD_SEEKABLE | TIDX_FLAG_GZIP_CHECKPOINTS
+        | TIDX_FLAG_XZ_BLOCKS);
+    openFileSeekSource();
+#ifdef HAVE_ZLIB
+    if (seek_source && (seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS)) {
+        const char* data;
+        size_t len;
+        if (!entry_index.getSection(TIDX_SEC_GZIP_CHECKPOINTS, data, len)
+            || static_cast<TarGzipSeekSource*>(seek_source.get())->deserialize(data, len)) {
+            seek_source.reset();
+        }
+    }
+#endif
+}
+
+// Take the entry index from the metadata cache
+void QoreTarFile::loadCachedIndex() {
+    TarCachedIndex idx;
+    if (!tar_metadata_cache.lookup(filepath, open_fp, idx)) {
+        return;
+    }
+    // an index built without gzip checkpoints is rebuilt when they are requested
+    if (gzip_checkpoints && compression_method == TAR_CM_GZIP && !(idx.seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS)) {
+        return;
+    }
+    entry_index.setData(idx.data);
+    seek_checked = true;
+    seek_flags = idx.seek_flags;
+    openFileSeekSource();
+#ifdef HAVE_ZLIB
+    if (seek_source && (seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS)
+        && static_cast<TarGzipSeekSource*>(seek_source.get())->deserialize(idx.checkpoints.data(),
+            idx.checkpoints.size())) {
+        seek_source.reset();
+    }
+#endif
+    updateIndexFile();
+}
+
+// Store the complete entry index in the metadata cache
+void QoreTarFile::storeCachedIndex() {
+    if (!have_open_fp) {
+        return;
+    }
+    TarCachedIndex idx;
+    idx.data = entry_index.getData();
+    TarIndexFingerprint fp;
+    // indexes loaded from index files are not cached, and neither are indexes of changed archives
+    if (!idx.data || fp.get(filepath.c_str()) || !(fp == open_fp)) {
+        return;
+    }
+    if (seek_source) {
+        idx.seek_flags = seek_flags;
+#ifdef HAVE_ZLIB
+        if (seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS) {
+            static_cast<const TarGzipSeekSource*>(seek_source.get())->serialize(idx.checkpoints);
+        }
+#endif
+    }
+    tar_metadata_cache.store(filepath, open_fp, std::move(idx));
+}
+
+// Save the entry index to an index file
+int QoreTarFile::saveIndexFile(const char* path, ExceptionSink* xsink) {
+    TarIndexFingerprint fp;
+    if (fp.get(filepath.c_str())) {
+        xsink->raiseException("TAR-ERROR", "cannot access archive '%s': %s", filepath.c_str(), strerror(errno));
+        return -1;
+    }
+    TarIndexSectionList extra;
+#ifdef HAVE_ZLIB
+    if (seek_source && (seek_flags & TIDX_FLAG_GZIP_CHECKPOINTS)) {
+        extra.push_back(std::make_pair((uint32_t)TIDX_SEC_GZIP_CHECKPOINTS, std::string()));
+        static_cast<const TarGzipSeekSource*>(seek_source.get())->serialize(extra.back().second);
+    }
+#endif
+    return entry_index.save(path, fp, seek_source ? seek_flags : 0, &extra, xsink);
+}
+
+// Write the entry index to an index file
+QoreStringNode* QoreTarFile::writeIndex(const char* path, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, false)) {
         return nullptr;
     }
+    if (!useIndex()) {
+        xsink->raiseException("TAR-ERROR", "index files can only be written for archives opened for reading");
+        return nullptr;
+    }
+    if (in_memory || input_stream) {
+        xsink->raiseException("TAR-ERROR", "index files can only be written for file-based archives");
+        return nullptr;
+    }
+
+    if (buildIndex(xsink)) {
+        return nullptr;
+    }
+
+    std::string target = path ? std::string(path) : getIndexPath();
+    if (saveIndexFile(target.c_str(), xsink)) {
+        return nullptr;
+    }
+    return new QoreStringNode(target);
+}
+
+// Position the read cursor at the data of the given entry
+struct archive_entry* QoreTarFile::findEntry(const char* name, ExceptionSink* xsink) {
+    std::string key = tar_normalize_entry_name(name);
+    struct archive_entry* entry;
+
+    if (useIndex()) {
+        scanHeaders();
+        TarIndexEntry e;
+        if (entry_index.find(key, e)) {
+            if (seek_source) {
+                if (openReadAt(e.header_offset, xsink)) {
+                    return nullptr;
+                }
+                if (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK
+                    && entryNameEquals(archive_entry_pathname(entry), key.c_str())) {
+                    return entry;
+                }
+                // the offset did not lead to the entry; fall back to a sequential scan
+            }
+        } else if (entry_index.isComplete()) {
+            return nullptr;
+        }
+    }
 
     reopenRead(xsink);
     if (*xsink) {
         return nullptr;
     }
 
-    struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        if (entryNameEquals(archive_entry_pathname(entry), name)) {
-            return createEntryInfo(entry, xsink);
+    while (nextHeader(&entry) == ARCHIVE_OK) {
+        if (entryNameEquals(archive_entry_pathname(entry), key.c_str())) {
+            return entry;
         }
         archive_read_data_skip(read_archive);
     }
 
-    return nullptr;  // Entry not found
+    return nullptr;
 }
 
-// Read entry as binary data
-BinaryNode* QoreTarFile::read(const char* name, ExceptionSink* xsink) {
+// Open a reader for the whole archive independent of the read cursor
+struct archive* QoreTarFile::openArchiveHandle(ExceptionSink* xsink) const {
+    struct archive* a = archive_read_new();
+    if (!a) {
+        xsink->raiseException("TAR-ERROR", "failed to create archive reader");
+        return nullptr;
+    }
+    archive_read_support_format_all(a);
+    archive_read_support_filter_all(a);
+    // an empty in-memory archive is read as an empty buffer; files are read from the mapping only with the mmap
+    // option, as other mappings can be replaced when the read cursor is reopened
+    int r;
+    if (in_memory) {
+        r = archive_read_open_memory(a, memory_data, memory_size);
+    } else if (use_mmap && file_map) {
+        r = archive_read_open_memory(a, file_map->data(), file_map->size());
+    } else {
+        r = archive_read_open_filename(a, filepath.c_str(), TAR_BUFFER_SIZE);
+    }
+    if (r != ARCHIVE_OK) {
+        xsink->raiseException("TAR-ERROR", "failed to open archive for reading: %s", get_archive_error(a));
+        archive_read_free(a);
+        return nullptr;
+    }
+    return a;
+}
+
+// Open a read handle of its own at the data of an entry
+struct archive* QoreTarFile::openEntryHandle(std::unique_lock<std::mutex>& guard, const char* name, bool always,
+        struct archive_entry*& entry, bool& shared, ExceptionSink* xsink) {
+    entry = nullptr;
+    shared = false;
+    // stream-based archives can only be read once, and archives being written are not indexed
+    if (input_stream || !useIndex()) {
+        shared = true;
+        return nullptr;
+    }
+
+    // with the concurrent_reads option, the index is completed by the first lookup and then only read
+    if (concurrent_reads) {
+        if (buildIndex(xsink)) {
+            return nullptr;
+        }
+    } else {
+        scanHeaders();
+    }
+    std::string key = tar_normalize_entry_name(name);
+    TarIndexEntry e;
+    bool found = entry_index.find(key, e);
+    if (!found && entry_index.isComplete()) {
+        return nullptr;
+    }
+
+    if (found && seek_source) {
+        // the header is read with the lock held, as the seek source is only set up while the lock is held
+        if (file_map) {
+            file_map->adviseSequential(false);
+        }
+        TarSeekReader* reader = seek_source->openAt(e.header_offset, xsink);
+        ArchiveReadGuard a(reader ? tar_open_seek_reader(reader, xsink) : nullptr);
+        if (!a) {
+            return nullptr;
+        }
+        if (archive_read_next_header(a.get(), &entry) == ARCHIVE_OK
+            && entryNameEquals(archive_entry_pathname(entry), key.c_str())) {
+            guard.unlock();
+            return a.release();
+        }
+        // the offset did not lead to the entry; the archive is read from the start below
+        entry = nullptr;
+    }
+
+    if (!always && !concurrent_reads) {
+        shared = true;
+        return nullptr;
+    }
+
+    // the archive is read from the start without the lock; an indexed entry is identified by its header offset,
+    // as names can occur more than once
+    guard.unlock();
+    ArchiveReadGuard a(openArchiveHandle(xsink));
+    if (!a) {
+        return nullptr;
+    }
+    int r;
+    while ((r = archive_read_next_header(a.get(), &entry)) == ARCHIVE_OK) {
+        if (entryNameEquals(archive_entry_pathname(entry), key.c_str())
+            && (!found || archive_read_header_position(a.get()) == e.header_offset)) {
+            return a.release();
+        }
+        archive_read_data_skip(a.get());
+    }
+    entry = nullptr;
+    if (r != ARCHIVE_EOF) {
+        xsink->raiseException("TAR-ERROR", "failed to read archive: %s", get_archive_error(a.get()));
+    }
+    return nullptr;
+}
+
+// Check archive is open
+bool QoreTarFile::checkOpen(ExceptionSink* xsink, bool forWrite) {
+    if (closed) {
+        xsink->raiseException("TAR-ERROR", "archive is closed");
+        return false;
+    }
+
+    if (forWrite) {
+        if (!write_archive) {
+            xsink->raiseException("TAR-ERROR", "archive is not open for writing");
+            return false;
+        }
+        if (stream_entry) {
+            xsink->raiseException("TAR-ERROR", "cannot write to the archive while an entry is being written with a "
+                "TarOutputStream; close the stream first");
+            return false;
+        }
+    } else {
+        if (!read_archive && !in_memory) {
+            xsink->raiseException("TAR-ERROR", "archive is not open for reading");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Get list of all entries
+QoreListNode* QoreTarFile::entries(ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, false)) {
         return nullptr;
     }
 
+    QoreListNode* list = new QoreListNode(hashdeclTarEntryInfo->getTypeInfo());
+
+    if (!scanHeaders()) {
+        TarIndexEntry e;
+        for (size_t i = 0, e_count = entry_index.size(); i < e_count; ++i) {
+            entry_index.get(i, e);
+            QoreHashNode* info = createEntryInfo(e, xsink);
+            if (*xsink) {
+                list->deref(xsink);
+                return nullptr;
+            }
+            list->push(info, xsink);
+        }
+        return list;
+    }
+
+    // Reopen to read from beginning
     reopenRead(xsink);
     if (*xsink) {
+        list->deref(xsink);
         return nullptr;
     }
 
     struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        if (entryNameEquals(archive_entry_pathname(entry), name)) {
-            int64 size = archive_entry_size(entry);
-            if (size <= 0) {
-                return new BinaryNode();
-            }
+    while (nextHeader(&entry) == ARCHIVE_OK) {
+        QoreHashNode* info = createEntryInfo(entry, xsink);
+        if (*xsink) {
+            list->deref(xsink);
+            return nullptr;
+        }
+        list->push(info, xsink);
+        archive_read_data_skip(read_archive);
+    }
 
-            SimpleRefHolder<BinaryNode> data(new BinaryNode());
-            // Note: don't use preallocate() as it sets size, not just capacity
+    return list;
+}
 
-            char buffer[TAR_BUFFER_SIZE];
-            la_ssize_t bytes_read;
-            while ((bytes_read = archive_read_data(read_archive, buffer, sizeof(buffer))) > 0) {
-                data->append(buffer, bytes_read);
+// Get number of entries
+int64 QoreTarFile::count(ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return -1;
+    }
+
+    if (!scanHeaders()) {
+        return entry_index.size();
+    }
+
+    reopenRead(xsink);
+    if (*xsink) {
+        return -1;
+    }
+
+    int64 count = 0;
+    struct archive_entry* entry;
+    while (nextHeader(&entry) == ARCHIVE_OK) {
+        count++;
+        archive_read_data_skip(read_archive);
+    }
+
+    return count;
+}
+
+// Find entries matching a query
+QoreListNode* QoreTarFile::find(const QoreHashNode* query, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return nullptr;
+    }
+
+    TarEntryQuery q;
+    if (q.parse(query, xsink)) {
+        return nullptr;
+    }
+
+    ReferenceHolder<QoreListNode> list(new QoreListNode(hashdeclTarEntryInfo->getTypeInfo()), xsink);
+    if (!q.limit) {
+        return list.release();
+    }
+    int64 skip = q.offset;
+
+    // adds the entry if it matches and is within the requested page; returns false once the page is full
+    auto add = [&] (const TarIndexEntry& e) -> bool {
+        if (!q.match(e)) {
+            return true;
+        }
+        if (skip) {
+            --skip;
+            return true;
+        }
+        QoreHashNode* info = createEntryInfo(e, xsink);
+        if (*xsink) {
+            return false;
+        }
+        list->push(info, xsink);
+        return q.limit < 0 || (int64)list->size() < q.limit;
+    };
+
+    if (!scanHeaders()) {
+        std::shared_ptr<const TarIndexData> data = entry_index.getData();
+        if (data) {
+            // entries held in memory are matched without copying them
+            for (const TarIndexEntry& e : data->entries) {
+                if (!add(e)) {
+                    break;
+                }
+            }
+        } else {
+            TarIndexEntry e;
+            for (size_t i = 0, e_count = entry_index.size(); i < e_count; ++i) {
+                entry_index.get(i, e);
+                if (!add(e)) {
+                    break;
+                }
             }
+        }
+        return *xsink ? nullptr : list.release();
+    }
 
-            if (bytes_read < 0) {
-                xsink->raiseException("TAR-ERROR", "failed to read entry data: %s",
-                                      get_archive_error(read_archive));
+    reopenRead(xsink);
+    if (*xsink) {
+        return nullptr;
+    }
+
+    struct archive_entry* entry;
+    TarIndexEntry e;
+    int r;
+    while ((r = nextHeader(&entry)) == ARCHIVE_OK) {
+        e.set(nullptr, entry);
+        if (!add(e)) {
+            break;
+        }
+        archive_read_data_skip(read_archive);
+    }
+    if (*xsink) {
+        return nullptr;
+    }
+    if (r != ARCHIVE_OK && r != ARCHIVE_EOF) {
+        xsink->raiseException("TAR-ERROR", "failed to read archive: %s", get_archive_error(read_archive));
+        return nullptr;
+    }
+    return list.release();
+}
+
+// Create an entry iterator
+QoreObject* QoreTarFile::iterator(const QoreHashNode* query, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return nullptr;
+    }
+    if (!useIndex()) {
+        xsink->raiseException("TAR-ERROR", "entry iterators can only be created for archives opened for reading");
+        return nullptr;
+    }
+    if (input_stream) {
+        xsink->raiseException("TAR-ERROR", "entry iterators cannot be created for stream-based archives");
+        return nullptr;
+    }
+
+    // the iterator has its own handle, so it is independent of the read cursor of this object
+    struct archive* a = openArchiveHandle(xsink);
+    if (!a) {
+        return nullptr;
+    }
+
+    // the cursor references this object, which holds the data of in-memory archives and the file mapping
+    ReferenceHolder<TarEntryIterator> it(new TarEntryIterator(new TarReadCursor(a, this)), xsink);
+    if (it->getQuery().parse(query, xsink)) {
+        return nullptr;
+    }
+    return new QoreObject(QC_TARENTRYITERATOR, getProgram(), it.release());
+}
+
+// Check if entry exists
+bool QoreTarFile::hasEntry(const char* name, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return false;
+    }
+
+    if (useIndex()) {
+        scanHeaders();
+        TarIndexEntry e;
+        if (entry_index.find(tar_normalize_entry_name(name), e)) {
+            return true;
+        }
+        if (entry_index.isComplete()) {
+            return false;
+        }
+    }
+
+    return findEntry(name, xsink) != nullptr;
+}
+
+// Get entry info
+QoreHashNode* QoreTarFile::getEntry(const char* name, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return nullptr;
+    }
+
+    if (useIndex()) {
+        scanHeaders();
+        TarIndexEntry e;
+        if (entry_index.find(tar_normalize_entry_name(name), e)) {
+            return createEntryInfo(e, xsink);
+        }
+        if (entry_index.isComplete()) {
+            return nullptr;  // Entry not found
+        }
+    }
+
+    struct archive_entry* entry = findEntry(name, xsink);
+    if (!entry) {
+        return nullptr;  // Entry not found
+    }
+    return createEntryInfo(entry, xsink);
+}
+
+// Read entry as binary data
+BinaryNode* QoreTarFile::read(const char* name, ExceptionSink* xsink) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return nullptr;
+    }
+
+    // with a handle of its own, the data is read without the lock
+    struct archive_entry* entry;
+    bool shared;
+    ArchiveReadGuard a(openEntryHandle(guard, name, false, entry, shared, xsink));
+    if (shared) {
+        entry = findEntry(name, xsink);
+    }
+    if (!entry) {
+        if (!*xsink) {
+            xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
+        }
+        return nullptr;
+    }
+
+    return readEntryData(a ? a.get() : read_archive, entry, xsink);
+}
+
+// Read the data of the current entry
+BinaryNode* QoreTarFile::readEntryData(struct archive* a, struct archive_entry* entry, ExceptionSink* xsink) {
+    size_t len;
+    char* buf = readEntryBuffer(a, entry, 0, len, xsink);
+    if (!buf) {
+        return nullptr;
+    }
+    if (!len) {
+        free(buf);
+        return new BinaryNode();
+    }
+    // the BinaryNode takes ownership of the buffer
+    return new BinaryNode(buf, len);
+}
+
+// Read the data of the current entry into a buffer of the size given in the header
+char* QoreTarFile::readEntryBuffer(struct archive* a, struct archive_entry* entry, size_t extra, size_t& len,
+        ExceptionSink* xsink) {
+    int64 size = archive_entry_size(entry);
+    if (size < 0) {
+        size = 0;
+    }
+    if ((uint64_t)size > SIZE_MAX - extra) {
+        xsink->raiseException("TAR-ERROR", "entry size " QLLD " is too large to read into memory", size);
+        return nullptr;
+    }
+    // the data is read directly into the result, so each byte is copied once
+    size_t alloc = (size_t)size + extra;
+    char* buf = static_cast<char*>(malloc(alloc ? alloc : 1));
+    if (!buf) {
+        xsink->raiseException("TAR-ERROR", "failed to allocate " QLLD " bytes for entry data", size);
+        return nullptr;
+    }
+
+    len = 0;
+    while (len < (size_t)size) {
+        la_ssize_t bytes_read = archive_read_data(a, buf + len, (size_t)size - len);
+        if (bytes_read < 0) {
+            free(buf);
+            xsink->raiseException("TAR-ERROR", "failed to read entry data: %s", get_archive_error(a));
+            return nullptr;
+        }
+        if (!bytes_read) {
+            break;
+        }
+        len += bytes_read;
+    }
+    return buf;
+}
+
+// Read several entries in a single pass
+QoreHashNode* QoreTarFile::readMany(const QoreListNode* names, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return nullptr;
+    }
+
+    bool indexed = !scanHeaders();
+    // requested entries not found yet by normalized name
+    std::unordered_map<std::string, const char*> pending;
+    // the first requested header in the archive, if known from the index
+    int64 start = -1;
+    for (size_t i = 0, n = names->size(); i < n; ++i) {
+        const char* name = names->retrieveEntry(i).get<const QoreStringNode>()->c_str();
+        std::string key = tar_normalize_entry_name(name);
+        if (indexed) {
+            TarIndexEntry e;
+            if (!entry_index.find(key, e)) {
+                xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
                 return nullptr;
             }
+            if (start < 0 || e.header_offset < start) {
+                start = e.header_offset;
+            }
+        }
+        pending.emplace(std::move(key), name);
+    }
+
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(binaryTypeInfo), xsink);
+    if (pending.empty()) {
+        return rv.release();
+    }
 
-            return data.release();
+    // with a seek source, the pass starts at the first requested entry
+    if (seek_source && start >= 0) {
+        if (openReadAt(start, xsink)) {
+            return nullptr;
+        }
+    } else {
+        reopenRead(xsink);
+        if (*xsink) {
+            return nullptr;
         }
-        archive_read_data_skip(read_archive);
     }
 
-    xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
-    return nullptr;
+    struct archive_entry* entry;
+    int r = ARCHIVE_OK;
+    while (!pending.empty() && (r = nextHeader(&entry)) == ARCHIVE_OK) {
+        const char* path = archive_entry_pathname(entry);
+        std::unordered_map<std::string, const char*>::iterator i = path
+            ? pending.find(tar_normalize_entry_name(path)) : pending.end();
+        if (i == pending.end()) {
+            archive_read_data_skip(read_archive);
+            continue;
+        }
+        BinaryNode* data = readEntryData(read_archive, entry, xsink);
+        if (!data) {
+            return nullptr;
+        }
+        rv->setKeyValue(i->second, data, xsink);
+        pending.erase(i);
+    }
+
+    if (!pending.empty()) {
+        if (r != ARCHIVE_EOF) {
+            xsink->raiseException("TAR-ERROR", "failed to read archive: %s", get_archive_error(read_archive));
+        } else {
+            xsink->raiseException("TAR-ERROR", "entry '%s' not found", pending.begin()->second);
+        }
+        return nullptr;
+    }
+    return rv.release();
 }
 
 // Read entry as text
 QoreStringNode* QoreTarFile::readText(const char* name, const char* encoding, ExceptionSink* xsink) {
-    SimpleRefHolder<BinaryNode> data(read(name, xsink));
-    if (*xsink || !data) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!checkOpen(xsink, false)) {
+        return nullptr;
+    }
+
+    struct archive_entry* entry;
+    bool shared;
+    ArchiveReadGuard a(openEntryHandle(guard, name, false, entry, shared, xsink));
+    if (shared) {
+        entry = findEntry(name, xsink);
+    }
+    if (!entry) {
+        if (!*xsink) {
+            xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
+        }
         return nullptr;
     }
 
     const QoreEncoding* enc = encoding ? QEM.findCreate(encoding) : QCS_DEFAULT;
-    return new QoreStringNode((const char*)data->getPtr(), data->size(), enc);
+
+    // the string takes ownership of the buffer, which has room for the terminating null
+    size_t len;
+    char* buf = readEntryBuffer(a ? a.get() : read_archive, entry, 1, len, xsink);
+    if (!buf) {
+        return nullptr;
+    }
+    buf[len] = '\0';
+    return new QoreStringNode(buf, len, len + 1, enc);
 }
 
 // Create TarEntryInfo hash from archive_entry
 QoreHashNode* QoreTarFile::createEntryInfo(struct archive_entry* entry, ExceptionSink* xsink) const {
+    TarIndexEntry e;
+    e.set(nullptr, entry);
+    return createEntryInfo(e, xsink);
+}
+
+// Create TarEntryInfo hash from an index entry
+QoreHashNode* QoreTarFile::createEntryInfo(const TarIndexEntry& e, ExceptionSink* xsink) {
     ReferenceHolder<QoreHashNode> info(new QoreHashNode(hashdeclTarEntryInfo, xsink), xsink);
 
-    info->setKeyValue("name", new QoreStringNode(archive_entry_pathname(entry)), xsink);
-    info->setKeyValue("size", archive_entry_size(entry), xsink);
+    info->setKeyValue("name", new QoreStringNode(e.name), xsink);
+    info->setKeyValue("size", e.size, xsink);
 
     // Timestamps
-    if (archive_entry_mtime_is_set(entry)) {
-        info->setKeyValue("modified", DateTimeNode::makeAbsolute(currentTZ(), archive_entry_mtime(entry)), xsink);
+    if (e.flags & TIE_MTIME_SET) {
+        info->setKeyValue("modified", DateTimeNode::makeAbsolute(currentTZ(), e.mtime), xsink);
     }
-    if (archive_entry_atime_is_set(entry)) {
-        info->setKeyValue("accessed", DateTimeNode::makeAbsolute(currentTZ(), archive_entry_atime(entry)), xsink);
+    if (e.flags & TIE_ATIME_SET) {
+        info->setKeyValue("accessed", DateTimeNode::makeAbsolute(currentTZ(), e.atime), xsink);
     }
-    if (archive_entry_ctime_is_set(entry)) {
-        info->setKeyValue("created", DateTimeNode::makeAbsolute(currentTZ(), archive_entry_ctime(entry)), xsink);
+    if (e.flags & TIE_CTIME_SET) {
+        info->setKeyValue("created", DateTimeNode::makeAbsolute(currentTZ(), e.ctime), xsink);
     }
 
-    info->setKeyValue("mode", archive_entry_mode(entry), xsink);
-    info->setKeyValue("uid", (int64)archive_entry_uid(entry), xsink);
-    info->setKeyValue("gid", (int64)archive_entry_gid(entry), xsink);
+    info->setKeyValue("mode", e.mode, xsink);
+    info->setKeyValue("uid", e.uid, xsink);
+    info->setKeyValue("gid", e.gid, xsink);
 
-    const char* uname = archive_entry_uname(entry);
-    if (uname) {
-        info->setKeyValue("uname", new QoreStringNode(uname), xsink);
+    if (e.flags & TIE_UNAME_SET) {
+        info->setKeyValue("uname", new QoreStringNode(e.uname), xsink);
     }
 
-    const char* gname = archive_entry_gname(entry);
-    if (gname) {
-        info->setKeyValue("gname", new QoreStringNode(gname), xsink);
+    if (e.flags & TIE_GNAME_SET) {
+        info->setKeyValue("gname", new QoreStringNode(e.gname), xsink);
     }
 
-    // Determine type - check for hardlink first (hardlinks can have any filetype)
-    int filetype = archive_entry_filetype(entry);
-    const char* hardlink_target = archive_entry_hardlink(entry);
-    const char* type_str;
-    if (hardlink_target && *hardlink_target) {
-        type_str = "hardlink";
-    } else {
-        switch (filetype) {
-            case AE_IFREG:  type_str = "file"; break;
-            case AE_IFDIR:  type_str = "directory"; break;
-            case AE_IFLNK:  type_str = "symlink"; break;
-            case AE_IFCHR:  type_str = "chardev"; break;
-            case AE_IFBLK:  type_str = "blockdev"; break;
-            case AE_IFIFO:  type_str = "fifo"; break;
-            case AE_IFSOCK: type_str = "socket"; break;
-            default:        type_str = "unknown"; break;
-        }
-    }
-    info->setKeyValue("type", new QoreStringNode(type_str), xsink);
+    // hardlinks are reported as such whatever their file type
+    info->setKeyValue("type", new QoreStringNode(tar_entry_type_names[e.getType()]), xsink);
 
     // Link target
-    const char* link = archive_entry_symlink(entry);
-    if (!link) {
-        link = archive_entry_hardlink(entry);
-    }
-    if (link) {
-        info->setKeyValue("link_target", new QoreStringNode(link), xsink);
+    if (e.flags & (TIE_SYMLINK_SET | TIE_HARDLINK_SET)) {
+        info->setKeyValue("link_target", new QoreStringNode(e.link_target), xsink);
     }
 
     // Convenience flags
-    info->setKeyValue("is_directory", filetype == AE_IFDIR, xsink);
-    info->setKeyValue("is_symlink", filetype == AE_IFLNK, xsink);
-    info->setKeyValue("is_hardlink", archive_entry_hardlink(entry) != nullptr, xsink);
+    info->setKeyValue("is_directory", e.filetype == AE_IFDIR, xsink);
+    info->setKeyValue("is_symlink", e.filetype == AE_IFLNK, xsink);
+    info->setKeyValue("is_hardlink", (bool)(e.flags & TIE_HARDLINK_SET), xsink);
 
     // Device numbers
-    if (filetype == AE_IFCHR || filetype == AE_IFBLK) {
-        info->setKeyValue("devmajor", (int64)archive_entry_devmajor(entry), xsink);
-        info->setKeyValue("devminor", (int64)archive_entry_devminor(entry), xsink);
+    if (e.filetype == AE_IFCHR || e.filetype == AE_IFBLK) {
+        info->setKeyValue("devmajor", (int64)e.devmajor, xsink);
+        info->setKeyValue("devminor", (int64)e.devminor, xsink);
     }
 
     return info.release();
 }
 
-// Add binary data as entry
-void QoreTarFile::add(const char* name, const BinaryNode* data, const QoreHashNode* opts, ExceptionSink* xsink) {
-    if (!checkOpen(xsink, true)) {
-        return;
-    }
-
-    int mode_val = 0644;
-    int uid = 0, gid = 0;
-    std::string uname, gname;
-    int64 modified_time = 0;
-    bool preserve_permissions = true;
-    bool dereference_symlinks = false;
-
-    if (opts) {
-        parseAddOptions(opts, mode_val, uid, gid, uname, gname, modified_time,
-                        preserve_permissions, dereference_symlinks, xsink);
-        if (*xsink) {
-            return;
-        }
-    }
-
+// Create a regular file entry with the given metadata
+struct archive_entry* QoreTarFile::newFileEntry(const char* name, int mode, int uid, int gid, const std::string& uname,
+        const std::string& gname, int64 modified_time, ExceptionSink* xsink) {
     struct archive_entry* entry = archive_entry_new();
     if (!entry) {
         xsink->raiseException("TAR-ERROR", "failed to create archive entry");
-        return;
+        return nullptr;
     }
 
     archive_entry_set_pathname(entry, name);
-    archive_entry_set_size(entry, data ? data->size() : 0);
     archive_entry_set_filetype(entry, AE_IFREG);
-    archive_entry_set_perm(entry, mode_val);
+    archive_entry_set_perm(entry, mode);
 
     if (uid > 0) {
         archive_entry_set_uid(entry, uid);
@@ -820,8 +1960,59 @@ void QoreTarFile::add(const char* name, const BinaryNode* data, const QoreHashNo
     } else {
         archive_entry_set_mtime(entry, time(nullptr), 0);
     }
+    return entry;
+}
 
-    int r = archive_write_header(write_archive, entry);
+// Create an entry of the given type with the metadata of add options
+struct archive_entry* QoreTarFile::newEntry(const char* name, mode_t type, int mode, const QoreHashNode* opts,
+        ExceptionSink* xsink) const {
+    int uid = 0, gid = 0;
+    std::string uname, gname;
+    int64 modified_time = 0;
+    bool preserve_permissions = true;
+    bool dereference_symlinks = false;
+    parseAddOptions(opts, mode, uid, gid, uname, gname, modified_time, preserve_permissions,
+                    dereference_symlinks, xsink);
+    if (*xsink) {
+        return nullptr;
+    }
+
+    struct archive_entry* entry = newFileEntry(name, mode, uid, gid, uname, gname, modified_time, xsink);
+    if (entry) {
+        archive_entry_set_filetype(entry, type);
+    }
+    return entry;
+}
+
+// Add binary data as entry
+void QoreTarFile::add(const char* name, const BinaryNode* data, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, true)) {
+        return;
+    }
+
+    int mode_val = 0644;
+    int uid = 0, gid = 0;
+    std::string uname, gname;
+    int64 modified_time = 0;
+    bool preserve_permissions = true;
+    bool dereference_symlinks = false;
+
+    if (opts) {
+        parseAddOptions(opts, mode_val, uid, gid, uname, gname, modified_time,
+                        preserve_permissions, dereference_symlinks, xsink);
+        if (*xsink) {
+            return;
+        }
+    }
+
+    struct archive_entry* entry = newFileEntry(name, mode_val, uid, gid, uname, gname, modified_time, xsink);
+    if (!entry) {
+        return;
+    }
+    archive_entry_set_size(entry, data ? data->size() : 0);
+
+    int r = tar_write_header(write_archive, sink.get(), entry);
     if (r != ARCHIVE_OK) {
         xsink->raiseException("TAR-ERROR", "failed to write entry header: %s",
                               get_archive_error(write_archive));
@@ -856,6 +2047,7 @@ void QoreTarFile::addText(const char* name, const QoreStringNode* text, const ch
 
 // Add file from filesystem
 void QoreTarFile::addFile(const char* name, const char* filepath, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, true)) {
         return;
     }
@@ -875,57 +2067,140 @@ void QoreTarFile::addFile(const char* name, const char* filepath, const QoreHash
     archive_entry_set_pathname(entry.get(), name);
     archive_entry_copy_stat(entry.get(), &st);
 
-    int r = archive_write_header(write_archive, entry.get());
+    int r = tar_write_header(write_archive, sink.get(), entry.get());
     if (r != ARCHIVE_OK) {
         xsink->raiseException("TAR-ERROR", "failed to write entry header: %s",
                               get_archive_error(write_archive));
         return;
     }
 
-    // Read and write file data
-    if (S_ISREG(st.st_mode) && st.st_size > 0) {
-        FileHandle fp(fopen(filepath, "rb"));
-        if (!fp) {
-            xsink->raiseException("TAR-ERROR", "failed to open file '%s': %s", filepath, strerror(errno));
-            return;
+    // Read and write file data
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        FileHandle fp(fopen(filepath, "rb"));
+        if (!fp) {
+            xsink->raiseException("TAR-ERROR", "failed to open file '%s': %s", filepath, strerror(errno));
+            return;
+        }
+
+        char buffer[TAR_BUFFER_SIZE];
+        size_t bytes_read;
+        while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp.get())) > 0) {
+            if (archive_write_data(write_archive, buffer, bytes_read) < 0) {
+                xsink->raiseException("TAR-ERROR", "failed to write file data: %s",
+                                      get_archive_error(write_archive));
+                return;
+            }
+        }
+    }
+}
+
+// Add a directory tree from the filesystem
+int64 QoreTarFile::addTree(const char* prefix, const char* source_dir, const QoreHashNode* opts,
+                           ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, true)) {
+        return -1;
+    }
+
+    TarTreeWalker walker;
+    if (walker.parse(opts, xsink)) {
+        return -1;
+    }
+    // the archive file is not added to itself
+    int archive_fd = output_fd >= 0 ? output_fd : append_fd;
+    struct stat archive_st;
+    if (archive_fd >= 0 && !fstat(archive_fd, &archive_st)) {
+        walker.skipFile(archive_st.st_dev, archive_st.st_ino);
+    }
+
+    std::string base = prefix;
+    if (!base.empty() && base.back() != '/') {
+        base += '/';
+    }
+
+    std::unique_ptr<char[]> buffer(new char[TAR_BUFFER_SIZE]);
+    int64 count = 0;
+    auto visit = [&] (const std::string& path, const struct stat& st, int fd, const char* target) -> int {
+        // the source directory itself only has an entry if it is added under a prefix
+        if (path.empty() && base.empty()) {
+            return 0;
+        }
+        std::string name = base + path;
+
+        ArchiveEntryGuard entry(archive_entry_new());
+        if (!entry) {
+            xsink->raiseException("TAR-ERROR", "failed to create archive entry");
+            return -1;
+        }
+        archive_entry_set_pathname(entry.get(), name.c_str());
+        archive_entry_copy_stat(entry.get(), &st);
+        if (!S_ISREG(st.st_mode)) {
+            archive_entry_set_size(entry.get(), 0);
+        }
+        if (target) {
+            archive_entry_set_symlink(entry.get(), target);
+        }
+
+        if (tar_write_header(write_archive, sink.get(), entry.get()) != ARCHIVE_OK) {
+            xsink->raiseException("TAR-ERROR", "failed to write entry header for '%s': %s", name.c_str(),
+                                  get_archive_error(write_archive));
+            return -1;
+        }
+        ++count;
+        if (fd < 0) {
+            return 0;
         }
 
-        char buffer[TAR_BUFFER_SIZE];
-        size_t bytes_read;
-        while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp.get())) > 0) {
-            if (archive_write_data(write_archive, buffer, bytes_read) < 0) {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        // a file that shrinks while it is read is padded with zeros to the size in its header
+        int64 left = st.st_size;
+        while (left > 0) {
+            ssize_t n = ::read(fd, buffer.get(), (size_t)std::min<int64>(left, TAR_BUFFER_SIZE));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                xsink->raiseException("TAR-ERROR", "failed to read file '%s/%s': %s", source_dir, path.c_str(),
+                                      strerror(errno));
+                return -1;
+            }
+            if (!n) {
+                break;
+            }
+            if (archive_write_data(write_archive, buffer.get(), n) < 0) {
                 xsink->raiseException("TAR-ERROR", "failed to write file data: %s",
                                       get_archive_error(write_archive));
-                return;
+                return -1;
             }
+            left -= n;
         }
-    }
+        return 0;
+    };
+
+    return walker.walk(source_dir, visit, xsink) ? -1 : count;
 }
 
 // Add directory entry
 void QoreTarFile::addDirectory(const char* name, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, true)) {
         return;
     }
 
-    struct archive_entry* entry = archive_entry_new();
-    if (!entry) {
-        xsink->raiseException("TAR-ERROR", "failed to create archive entry");
-        return;
-    }
-
     // Ensure name ends with /
     std::string dirname = name;
     if (!dirname.empty() && dirname.back() != '/') {
         dirname += '/';
     }
 
-    archive_entry_set_pathname(entry, dirname.c_str());
-    archive_entry_set_filetype(entry, AE_IFDIR);
-    archive_entry_set_perm(entry, 0755);
-    archive_entry_set_mtime(entry, time(nullptr), 0);
+    struct archive_entry* entry = newEntry(dirname.c_str(), AE_IFDIR, 0755, opts, xsink);
+    if (!entry) {
+        return;
+    }
 
-    int r = archive_write_header(write_archive, entry);
+    int r = tar_write_header(write_archive, sink.get(), entry);
     if (r != ARCHIVE_OK) {
         xsink->raiseException("TAR-ERROR", "failed to write directory entry: %s",
                               get_archive_error(write_archive));
@@ -936,23 +2211,18 @@ void QoreTarFile::addDirectory(const char* name, const QoreHashNode* opts, Excep
 
 // Add symlink entry
 void QoreTarFile::addSymlink(const char* name, const char* target, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, true)) {
         return;
     }
 
-    struct archive_entry* entry = archive_entry_new();
+    struct archive_entry* entry = newEntry(name, AE_IFLNK, 0777, opts, xsink);
     if (!entry) {
-        xsink->raiseException("TAR-ERROR", "failed to create archive entry");
         return;
     }
-
-    archive_entry_set_pathname(entry, name);
-    archive_entry_set_filetype(entry, AE_IFLNK);
     archive_entry_set_symlink(entry, target);
-    archive_entry_set_perm(entry, 0777);
-    archive_entry_set_mtime(entry, time(nullptr), 0);
 
-    int r = archive_write_header(write_archive, entry);
+    int r = tar_write_header(write_archive, sink.get(), entry);
     if (r != ARCHIVE_OK) {
         xsink->raiseException("TAR-ERROR", "failed to write symlink entry: %s",
                               get_archive_error(write_archive));
@@ -963,21 +2233,19 @@ void QoreTarFile::addSymlink(const char* name, const char* target, const QoreHas
 
 // Add hardlink entry
 void QoreTarFile::addHardlink(const char* name, const char* target, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, true)) {
         return;
     }
 
-    struct archive_entry* entry = archive_entry_new();
+    // hardlink entries have the metadata of a regular file
+    struct archive_entry* entry = newEntry(name, AE_IFREG, 0644, opts, xsink);
     if (!entry) {
-        xsink->raiseException("TAR-ERROR", "failed to create archive entry");
         return;
     }
-
-    archive_entry_set_pathname(entry, name);
     archive_entry_set_hardlink(entry, target);
-    archive_entry_set_mtime(entry, time(nullptr), 0);
 
-    int r = archive_write_header(write_archive, entry);
+    int r = tar_write_header(write_archive, sink.get(), entry);
     if (r != ARCHIVE_OK) {
         xsink->raiseException("TAR-ERROR", "failed to write hardlink entry: %s",
                               get_archive_error(write_archive));
@@ -988,6 +2256,7 @@ void QoreTarFile::addHardlink(const char* name, const char* target, const QoreHa
 
 // Extract all entries
 void QoreTarFile::extractAll(const char* destPath, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
     if (!checkOpen(xsink, false)) {
         return;
     }
@@ -999,10 +2268,11 @@ void QoreTarFile::extractAll(const char* destPath, const QoreHashNode* opts, Exc
     bool overwrite = true;
     bool create_directories = true;
     int strip_count = 0;
+    unsigned threads = 1;
 
     if (opts) {
         parseExtractOptions(opts, destination, preserve_permissions, preserve_ownership,
-                            preserve_times, overwrite, create_directories, strip_count, xsink);
+                            preserve_times, overwrite, create_directories, strip_count, threads, xsink);
         if (*xsink) {
             return;
         }
@@ -1034,16 +2304,28 @@ void QoreTarFile::extractAll(const char* destPath, const QoreHashNode* opts, Exc
     archive_write_disk_set_options(disk, flags);
     archive_write_disk_set_standard_lookup(disk);
 
+    // with more than one thread, entries are written to disk by a pool of writer threads
+    std::unique_ptr<TarParallelExtractor> extractor;
+    if (threads > 1) {
+        extractor.reset(new TarParallelExtractor(flags, threads));
+        if (extractor->start()) {
+            xsink->raiseException("TAR-ERROR", "%s", extractor->getError().c_str());
+            archive_write_free(disk);
+            return;
+        }
+    }
+
     struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        // Build destination path
-        const char* entry_name = archive_entry_pathname(entry);
+    while (nextHeader(&entry) == ARCHIVE_OK) {
+        // Build destination path; the name is copied, as setting the pathname below can free its buffer
+        const char* path = archive_entry_pathname(entry);
+        std::string entry_name = path ? path : "";
 
         // Security check: prevent path traversal attacks
-        if (!isPathSafe(entry_name)) {
+        if (!isPathSafe(entry_name.c_str())) {
             xsink->raiseException("TAR-SECURITY-ERROR",
                 "refusing to extract entry with unsafe path: '%s' (potential path traversal attack)",
-                entry_name);
+                entry_name.c_str());
             break;
         }
 
@@ -1075,10 +2357,17 @@ void QoreTarFile::extractAll(const char* destPath, const QoreHashNode* opts, Exc
             }
         }
 
+        if (extractor) {
+            if (extractor->add(read_archive, entry, entry_name.c_str())) {
+                break;
+            }
+            continue;
+        }
+
         int r = archive_write_header(disk, entry);
         if (r != ARCHIVE_OK) {
             xsink->raiseException("TAR-ERROR", "failed to extract '%s': %s",
-                                  entry_name, get_archive_error(disk));
+                                  entry_name.c_str(), get_archive_error(disk));
             break;
         }
 
@@ -1091,7 +2380,7 @@ void QoreTarFile::extractAll(const char* destPath, const QoreHashNode* opts, Exc
             while (archive_read_data_block(read_archive, &buffer, &size, &offset) == ARCHIVE_OK) {
                 if (archive_write_data_block(disk, buffer, size, offset) != ARCHIVE_OK) {
                     xsink->raiseException("TAR-ERROR", "failed to write data for '%s': %s",
-                                          entry_name, get_archive_error(disk));
+                                          entry_name.c_str(), get_archive_error(disk));
                     break;
                 }
             }
@@ -1100,6 +2389,11 @@ void QoreTarFile::extractAll(const char* destPath, const QoreHashNode* opts, Exc
         archive_write_finish_entry(disk);
     }
 
+    // errors of the writer threads are reported unless an exception has been raised already
+    if (extractor && extractor->finish() && !*xsink) {
+        xsink->raiseException("TAR-ERROR", "%s", extractor->getError().c_str());
+    }
+
     archive_write_close(disk);
     archive_write_free(disk);
 }
@@ -1111,43 +2405,44 @@ void QoreTarFile::extractEntry(const char* name, const char* destPath, Exception
 
 // Extract entry to destination
 void QoreTarFile::extractTo(const char* name, const char* destination, ExceptionSink* xsink) {
+    std::unique_lock<std::mutex> guard(lock);
     if (!checkOpen(xsink, false)) {
         return;
     }
 
-    reopenRead(xsink);
-    if (*xsink) {
+    struct archive_entry* entry;
+    bool shared;
+    ArchiveReadGuard handle(openEntryHandle(guard, name, false, entry, shared, xsink));
+    if (shared) {
+        entry = findEntry(name, xsink);
+    }
+    if (!entry) {
+        if (!*xsink) {
+            xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
+        }
         return;
     }
+    struct archive* a = handle ? handle.get() : read_archive;
 
-    struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        if (entryNameEquals(archive_entry_pathname(entry), name)) {
-            // Found the entry, write to file
-            FILE* fp = fopen(destination, "wb");
-            if (!fp) {
-                xsink->raiseException("TAR-ERROR", "failed to open destination file '%s': %s",
-                                      destination, strerror(errno));
-                return;
-            }
-
-            char buffer[TAR_BUFFER_SIZE];
-            la_ssize_t bytes_read;
-            while ((bytes_read = archive_read_data(read_archive, buffer, sizeof(buffer))) > 0) {
-                if (fwrite(buffer, 1, bytes_read, fp) != (size_t)bytes_read) {
-                    xsink->raiseException("TAR-ERROR", "failed to write to destination file");
-                    fclose(fp);
-                    return;
-                }
-            }
+    // Found the entry, write to file
+    FILE* fp = fopen(destination, "wb");
+    if (!fp) {
+        xsink->raiseException("TAR-ERROR", "failed to open destination file '%s': %s",
+                              destination, strerror(errno));
+        return;
+    }
 
+    char buffer[TAR_BUFFER_SIZE];
+    la_ssize_t bytes_read;
+    while ((bytes_read = archive_read_data(a, buffer, sizeof(buffer))) > 0) {
+        if (fwrite(buffer, 1, bytes_read, fp) != (size_t)bytes_read) {
+            xsink->raiseException("TAR-ERROR", "failed to write to destination file");
             fclose(fp);
             return;
         }
-        archive_read_data_skip(read_archive);
     }
 
-    xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
+    fclose(fp);
 }
 
 // Get archive path
@@ -1158,6 +2453,154 @@ QoreStringNode* QoreTarFile::getPath() const {
     return new QoreStringNode(filepath);
 }
 
+// Get information about the decompression of the archive
+QoreHashNode* QoreTarFile::getDecompressionInfo(ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(hashdeclTarDecompressionInfo, xsink), xsink);
+    rv->setKeyValue("threads", (int64)(parallel_filter >= 0 ? threads : 1), xsink);
+    rv->setKeyValue("speculative", speculative_read, xsink);
+    rv->setKeyValue("speculative_chunks", speculative_stats ? (int64)speculative_stats->chunks : 0ll, xsink);
+    rv->setKeyValue("fallback_chunks", speculative_stats ? (int64)speculative_stats->fallback_chunks : 0ll,
+                    xsink);
+    return rv.release();
+}
+
+// Parse create options
+void QoreTarFile::parseCreateOptions(const QoreHashNode* opts, ExceptionSink* xsink) {
+    if (!opts) {
+        return;
+    }
+
+    QoreValue v = opts->getKeyValue("compression_level");
+    if (!v.isNothing()) {
+        compression_level = (int)v.getAsBigInt();
+    }
+
+    v = opts->getKeyValue("seekable");
+    if (!v.isNothing()) {
+        seekable = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("frame_size");
+    if (!v.isNothing()) {
+        int64 size = v.getAsBigInt();
+        if (size < 0 || size > TAR_MAX_FRAME_SIZE) {
+            xsink->raiseException("TAR-ERROR", "invalid frame_size " QLLD "; must be between 0 and %d", size,
+                TAR_MAX_FRAME_SIZE);
+            return;
+        }
+        frame_size = (size_t)size;
+    }
+
+    v = opts->getKeyValue("index_file");
+    if (v.getType() == NT_STRING) {
+        index_path = v.get<const QoreStringNode>()->c_str();
+    }
+
+    v = opts->getKeyValue("use_index_file");
+    if (!v.isNothing()) {
+        use_index_file = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("write_index_file");
+    if (!v.isNothing()) {
+        write_index_file = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("metadata_cache");
+    if (!v.isNothing()) {
+        use_metadata_cache = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("mmap");
+    if (!v.isNothing()) {
+        use_mmap = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("gzip_checkpoints");
+    if (!v.isNothing()) {
+        gzip_checkpoints = v.getAsBool();
+#ifndef HAVE_ZLIB
+        if (gzip_checkpoints) {
+            xsink->raiseException("TAR-ERROR", "gzip checkpoints are not supported; the module was built without "
+                "zlib");
+            return;
+        }
+#endif
+    }
+
+    v = opts->getKeyValue("checkpoint_interval");
+    if (!v.isNothing()) {
+        checkpoint_interval = v.getAsBigInt();
+        if (checkpoint_interval < TAR_GZIP_MIN_CHECKPOINT_INTERVAL) {
+            xsink->raiseException("TAR-ERROR", "invalid checkpoint_interval " QLLD "; must be at least %d",
+                checkpoint_interval, TAR_GZIP_MIN_CHECKPOINT_INTERVAL);
+            return;
+        }
+    }
+
+    v = opts->getKeyValue("threads");
+    if (!v.isNothing() && parseThreads(v, threads, xsink)) {
+        return;
+    }
+
+    v = opts->getKeyValue("speculative_gzip");
+    if (!v.isNothing()) {
+        speculative_gzip = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("concurrent_reads");
+    if (!v.isNothing()) {
+        concurrent_reads = v.getAsBool();
+    }
+
+    v = opts->getKeyValue("write_behind");
+    if (!v.isNothing()) {
+        int64 depth = v.getAsBigInt();
+        if (depth < 0 || depth > TAR_MAX_WRITE_BEHIND_DEPTH) {
+            xsink->raiseException("TAR-ERROR", "invalid write_behind value " QLLD "; must be between 0 and %d",
+                depth, TAR_MAX_WRITE_BEHIND_DEPTH);
+            return;
+        }
+        write_behind_depth = (unsigned)depth;
+    }
+
+    v = opts->getKeyValue("read_ahead");
+    if (!v.isNothing()) {
+        int64 depth = v.getAsBigInt();
+        if (depth < 0 || depth > TAR_MAX_READ_AHEAD_DEPTH) {
+            xsink->raiseException("TAR-ERROR", "invalid read_ahead value " QLLD "; must be between 0 and %d",
+                depth, TAR_MAX_READ_AHEAD_DEPTH);
+            return;
+        }
+        read_ahead = (unsigned)depth;
+    }
+
+    v = opts->getKeyValue("read_ahead_size");
+    if (!v.isNothing()) {
+        int64 size = v.getAsBigInt();
+        if (size < 1 || size > TAR_MAX_READ_AHEAD_SIZE) {
+            xsink->raiseException("TAR-ERROR", "invalid read_ahead_size " QLLD "; must be between 1 and %d",
+                size, TAR_MAX_READ_AHEAD_SIZE);
+            return;
+        }
+        read_ahead_size = (size_t)size;
+    }
+}
+
+// Parse the threads option
+int QoreTarFile::parseThreads(const QoreValue v, unsigned& threads, ExceptionSink* xsink) {
+    int64 n = v.getAsBigInt();
+    if (n < 0 || n > TAR_MAX_THREADS) {
+        xsink->raiseException("TAR-ERROR", "invalid threads value " QLLD "; must be between 0 and %d", n,
+            TAR_MAX_THREADS);
+        return -1;
+    }
+    // 0 uses a thread for each CPU
+    threads = n ? (unsigned)n : std::max(1u, std::thread::hardware_concurrency());
+    return 0;
+}
+
 // Parse add options
 void QoreTarFile::parseAddOptions(const QoreHashNode* opts, int& mode, int& uid, int& gid,
                                   std::string& uname, std::string& gname, int64& modified_time,
@@ -1212,7 +2655,7 @@ void QoreTarFile::parseAddOptions(const QoreHashNode* opts, int& mode, int& uid,
 void QoreTarFile::parseExtractOptions(const QoreHashNode* opts, std::string& destination,
                                        bool& preserve_permissions, bool& preserve_ownership,
                                        bool& preserve_times, bool& overwrite, bool& create_directories,
-                                       int& strip_count, ExceptionSink* xsink) const {
+                                       int& strip_count, unsigned& threads, ExceptionSink* xsink) const {
     if (!opts) {
         return;
     }
@@ -1251,38 +2694,49 @@ void QoreTarFile::parseExtractOptions(const QoreHashNode* opts, std::string& des
     if (!v.isNothing()) {
         strip_count = (int)v.getAsBigInt();
     }
+
+    v = opts->getKeyValue("threads");
+    if (!v.isNothing()) {
+        parseThreads(v, threads, xsink);
+    }
 }
 
 // Open an input stream for reading an entry
 QoreObject* QoreTarFile::openInputStream(const char* name, ExceptionSink* xsink) {
+    std::unique_lock<std::mutex> guard(lock);
     if (!checkOpen(xsink, false)) {
         return nullptr;
     }
 
-    reopenRead(xsink);
-    if (*xsink) {
-        return nullptr;
-    }
-
+    // streams are read after this call has returned, so they always get a handle of their own unless the
+    // archive is stream-based
     struct archive_entry* entry;
-    while (archive_read_next_header(read_archive, &entry) == ARCHIVE_OK) {
-        if (entryNameEquals(archive_entry_pathname(entry), name)) {
-            TarInputStream* is = new TarInputStream(read_archive, entry, xsink);
-            if (*xsink) {
-                delete is;
-                return nullptr;
-            }
-            return new QoreObject(QC_TARINPUTSTREAM, getProgram(), is);
+    bool shared;
+    ArchiveReadGuard a(openEntryHandle(guard, name, true, entry, shared, xsink));
+    if (shared) {
+        entry = findEntry(name, xsink);
+    }
+    if (!entry) {
+        if (!*xsink) {
+            xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
         }
-        archive_read_data_skip(read_archive);
+        return nullptr;
     }
 
-    xsink->raiseException("TAR-ERROR", "entry '%s' not found", name);
-    return nullptr;
+    // the cursor references this object, which holds the archive data and the seek source used by the handle
+    TarInputStream* is = a
+        ? new TarInputStream(std::make_shared<TarReadCursor>(a.release(), this), entry, xsink)
+        : new TarInputStream(read_archive, entry, xsink);
+    if (*xsink) {
+        delete is;
+        return nullptr;
+    }
+    return new QoreObject(QC_TARINPUTSTREAM, getProgram(), is);
 }
 
 // Open an output stream for writing an entry
 QoreObject* QoreTarFile::openOutputStream(const char* name, const QoreHashNode* opts, ExceptionSink* xsink) {
+    std::unique_lock<std::mutex> guard(lock);
     if (!checkOpen(xsink, true)) {
         return nullptr;
     }
@@ -1302,27 +2756,132 @@ QoreObject* QoreTarFile::openOutputStream(const char* name, const QoreHashNode*
         }
     }
 
-    TarOutputStream* os = new TarOutputStream(write_archive, name, mode_val, xsink);
-    if (*xsink) {
-        delete os;
+    int64 size = -1;
+    int64 spill_threshold = TAR_STREAM_SPILL_THRESHOLD;
+    if (opts) {
+        QoreValue v = opts->getKeyValue("size");
+        if (!v.isNothing()) {
+            size = v.getAsBigInt();
+            if (size < 0) {
+                xsink->raiseException("TAR-ERROR", "invalid entry size " QLLD "; must not be negative", size);
+                return nullptr;
+            }
+        }
+        v = opts->getKeyValue("spill_threshold");
+        if (!v.isNothing()) {
+            spill_threshold = v.getAsBigInt();
+            if (spill_threshold < 0) {
+                xsink->raiseException("TAR-ERROR", "invalid spill_threshold " QLLD "; must not be negative",
+                    spill_threshold);
+                return nullptr;
+            }
+        }
+    }
+
+    struct archive_entry* entry = newFileEntry(name, mode_val, uid, gid, uname, gname, modified_time, xsink);
+    if (!entry) {
         return nullptr;
     }
-    return new QoreObject(QC_TAROUTPUTSTREAM, getProgram(), os);
+    // the stream writes the archive with the methods below, which take the lock themselves
+    guard.unlock();
+
+    ReferenceHolder<TarOutputStream> os(new TarOutputStream(this, entry, size, spill_threshold), xsink);
+    if (os->start(xsink)) {
+        return nullptr;
+    }
+    return new QoreObject(QC_TAROUTPUTSTREAM, getProgram(), os.release());
+}
+
+// Write the header of an entry of declared size for an output stream
+int QoreTarFile::startStreamEntry(struct archive_entry* entry, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!checkOpen(xsink, true)) {
+        return -1;
+    }
+    if (tar_write_header(write_archive, sink.get(), entry) != ARCHIVE_OK) {
+        xsink->raiseException("TAR-ERROR", "failed to write entry header: %s", get_archive_error(write_archive));
+        return -1;
+    }
+    stream_entry = true;
+    return 0;
+}
+
+// Write data of an entry started with startStreamEntry()
+int QoreTarFile::writeStreamData(const void* data, size_t len, ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (closed || !write_archive || !stream_entry) {
+        xsink->raiseException("TAR-WRITE-ERROR", "the archive has been closed");
+        return -1;
+    }
+    return writeEntryData(data, len, xsink);
+}
+
+// End an entry started with startStreamEntry()
+int QoreTarFile::finishStreamEntry() {
+    std::lock_guard<std::mutex> guard(lock);
+    bool open = stream_entry && !closed && write_archive;
+    stream_entry = false;
+    return open ? 0 : -1;
+}
+
+// Write an entry of unknown size buffered by an output stream
+int QoreTarFile::writeStreamEntry(struct archive_entry* entry, const std::vector<char>& buffer, FILE* spill,
+        ExceptionSink* xsink) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (closed || !write_archive) {
+        xsink->raiseException("TAR-ERROR", "the archive was closed before entry '%s' was written",
+            archive_entry_pathname(entry));
+        return -1;
+    }
+    if (!checkOpen(xsink, true)) {
+        return -1;
+    }
+    if (tar_write_header(write_archive, sink.get(), entry) != ARCHIVE_OK) {
+        xsink->raiseException("TAR-ERROR", "failed to write entry header: %s", get_archive_error(write_archive));
+        return -1;
+    }
+
+    if (!spill) {
+        return buffer.empty() ? 0 : writeEntryData(buffer.data(), buffer.size(), xsink);
+    }
+
+    std::unique_ptr<char[]> buf(new char[TAR_BUFFER_SIZE]);
+    size_t n;
+    while ((n = fread(buf.get(), 1, TAR_BUFFER_SIZE, spill)) > 0) {
+        if (writeEntryData(buf.get(), n, xsink)) {
+            return -1;
+        }
+    }
+    if (ferror(spill)) {
+        xsink->raiseException("TAR-ERROR", "failed to read temporary file: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Write entry data for an output stream
+int QoreTarFile::writeEntryData(const void* data, size_t len, ExceptionSink* xsink) {
+    la_ssize_t written = archive_write_data(write_archive, data, len);
+    if (written < 0 || (size_t)written != len) {
+        xsink->raiseException("TAR-ERROR", "failed to write entry data: %s", get_archive_error(write_archive));
+        return -1;
+    }
+    return 0;
 }
 
 // Memory read callback for libarchive
 la_ssize_t QoreTarFile::memory_read_callback(struct archive*, void* client_data, const void** buffer) {
     QoreTarFile* self = static_cast<QoreTarFile*>(client_data);
 
-    if (self->memory_pos >= self->memory_buffer.size()) {
+    if (self->memory_pos >= self->memory_size) {
         *buffer = nullptr;
         return 0;
     }
 
-    size_t remaining = self->memory_buffer.size() - self->memory_pos;
+    size_t remaining = self->memory_size - self->memory_pos;
     size_t to_read = std::min(remaining, (size_t)TAR_BUFFER_SIZE);
 
-    *buffer = self->memory_buffer.data() + self->memory_pos;
+    *buffer = self->memory_data + self->memory_pos;
     self->memory_pos += to_read;
 
     return to_read;
@@ -1334,59 +2893,200 @@ int QoreTarFile::memory_close_callback(struct archive*, void* client_data) {
 }
 
 // Memory write callback
-la_ssize_t QoreTarFile::memory_write_callback(struct archive*, void* client_data, const void* buffer, size_t length) {
+la_ssize_t QoreTarFile::memory_write_callback(struct archive* a, void* client_data, const void* buffer, size_t length) {
     QoreTarFile* self = static_cast<QoreTarFile*>(client_data);
 
-    size_t old_size = self->memory_buffer.size();
-    self->memory_buffer.resize(old_size + length);
-    memcpy(self->memory_buffer.data() + old_size, buffer, length);
+    if (self->memory_buffer.append(buffer, length)) {
+        archive_set_error(a, ENOMEM, "failed to allocate memory for the archive");
+        return -1;
+    }
 
     return length;
 }
 
-// Stream read callback
-la_ssize_t QoreTarFile::stream_read_callback(struct archive*, void* client_data, const void** buffer) {
+// File and stream write callback
+la_ssize_t QoreTarFile::output_write_callback(struct archive* a, void* client_data, const void* buffer,
+        size_t length) {
     QoreTarFile* self = static_cast<QoreTarFile*>(client_data);
-    // Lazy allocation: only allocate buffer when first used by this thread
-    static thread_local std::unique_ptr<char[]> read_buffer;
-    if (!read_buffer) {
-        read_buffer.reset(new char[TAR_BUFFER_SIZE]);
+    std::string err;
+    if (self->write_behind->write(buffer, length, err)) {
+        archive_set_error(a, EIO, "%s", err.c_str());
+        return ARCHIVE_FATAL;
     }
+    return length;
+}
 
-    if (!self->input_stream) {
-        return 0;
+// File and stream close callback
+int QoreTarFile::output_close_callback(struct archive* a, void* client_data) {
+    QoreTarFile* self = static_cast<QoreTarFile*>(client_data);
+    std::string err;
+    if (self->closeOutput(err)) {
+        archive_set_error(a, EIO, "%s", err.c_str());
+        return ARCHIVE_FATAL;
     }
+    return ARCHIVE_OK;
+}
 
-    ExceptionSink xsink;
-    int64 bytes_read = self->input_stream->read(read_buffer.get(), TAR_BUFFER_SIZE, &xsink);
-    if (xsink) {
+// Compression sink write callback
+la_ssize_t QoreTarFile::sink_write_callback(struct archive* a, void* client_data, const void* buffer, size_t length) {
+    QoreTarFile* self = static_cast<QoreTarFile*>(client_data);
+    if (self->sink->write(buffer, length)) {
+        archive_set_error(a, EIO, "%s", self->sink->getError());
         return ARCHIVE_FATAL;
     }
-
-    *buffer = read_buffer.get();
-    return bytes_read;
+    return length;
 }
 
-// Stream write callback
-la_ssize_t QoreTarFile::stream_write_callback(struct archive*, void* client_data, const void* buffer, size_t length) {
+// Compression sink close callback
+int QoreTarFile::sink_close_callback(struct archive* a, void* client_data) {
     QoreTarFile* self = static_cast<QoreTarFile*>(client_data);
+    int rc = ARCHIVE_OK;
+    if (self->sink->finish()) {
+        archive_set_error(a, EIO, "%s", self->sink->getError());
+        rc = ARCHIVE_FATAL;
+    }
+    std::string err;
+    if (self->closeOutput(err) && rc == ARCHIVE_OK) {
+        archive_set_error(a, EIO, "%s", err.c_str());
+        rc = ARCHIVE_FATAL;
+    }
+    return rc;
+}
 
-    if (!self->output_stream) {
-        return ARCHIVE_FATAL;
+// Write to the archive file appended to in place
+int QoreTarFile::appendWrite(const void* data, size_t len, std::string& err) {
+    const char* p = static_cast<const char*>(data);
+    while (len) {
+        ssize_t rc = pwrite(append_fd, p, len, append_pos);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = std::string("failed to write to archive file: ") + strerror(errno);
+            return -1;
+        }
+        p += rc;
+        len -= rc;
+        append_pos += rc;
     }
+    return 0;
+}
 
-    ExceptionSink xsink;
-    self->output_stream->write(buffer, length, &xsink);
-    if (xsink) {
-        return ARCHIVE_FATAL;
+// Close the archive file appended to in place
+int QoreTarFile::closeAppendFile(std::string& err) {
+    int rc = 0;
+    // any data after the new trailer is left over from the old end of the archive; if nothing was written, the
+    // file is left as it was
+    if (append_pos > append_start && ftruncate(append_fd, append_pos)) {
+        err = std::string("failed to truncate archive file: ") + strerror(errno);
+        rc = -1;
+    }
+    if (::close(append_fd) && !rc) {
+        err = std::string("failed to close archive file: ") + strerror(errno);
+        rc = -1;
+    }
+    append_fd = -1;
+    return rc;
+}
+
+// Open the archive file or output stream for writing
+int QoreTarFile::setupOutput(ExceptionSink* xsink) {
+    TarSinkOutput output;
+    // output streams may be implemented in Qore
+    bool qore_thread = false;
+    if (output_stream) {
+        output = [this] (const void* data, size_t len, std::string& err) -> int {
+            ExceptionSink xsink;
+            output_stream->write(data, len, &xsink);
+            if (xsink) {
+                // the exception is raised again by a later call, so its cause is kept in the message
+                err = "failed to write to output stream: " + get_exception_text(xsink);
+                xsink.clear();
+                return -1;
+            }
+            return 0;
+        };
+        qore_thread = true;
+    } else if (append_fd >= 0) {
+        // the archive is not padded to a full block, so the file only grows by the new entries and the trailer
+        archive_write_set_bytes_in_last_block(write_archive, 1);
+        output = [this] (const void* data, size_t len, std::string& err) -> int {
+            return appendWrite(data, len, err);
+        };
+    } else {
+        output_fd = ::open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (output_fd < 0) {
+            xsink->raiseException("TAR-ERROR", "failed to open archive for writing: %s", strerror(errno));
+            return -1;
+        }
+        // as with libarchive's own file output, archives written to regular files are not padded to a full block,
+        // and the archive file is not added to itself
+        struct stat st;
+        if (!fstat(output_fd, &st)) {
+            archive_write_set_bytes_in_last_block(write_archive, S_ISREG(st.st_mode) ? 1 : 0);
+            archive_write_set_skip_file(write_archive, st.st_dev, st.st_ino);
+        }
+        output = [this] (const void* data, size_t len, std::string& err) -> int {
+            const char* p = static_cast<const char*>(data);
+            while (len) {
+                ssize_t rc = ::write(output_fd, p, len);
+                if (rc < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    err = std::string("failed to write to archive file: ") + strerror(errno);
+                    return -1;
+                }
+                p += rc;
+                len -= rc;
+            }
+            return 0;
+        };
     }
 
-    return length;
+    write_behind.reset(new TarWriteBehind(output, write_behind_depth, qore_thread));
+    if (write_behind->start()) {
+        xsink->raiseException("TAR-ERROR", "failed to start the write-behind thread");
+        return -1;
+    }
+    return 0;
 }
 
-// Stream close callback
-int QoreTarFile::stream_close_callback(struct archive*, void* client_data) {
-    return ARCHIVE_OK;
+// Write the remaining data and close the archive file or output stream
+int QoreTarFile::closeOutput(std::string& err) {
+    int rc = 0;
+    if (write_behind) {
+        rc = write_behind->finish(err);
+        write_behind.reset();
+    }
+    if (output_fd >= 0) {
+        if (::close(output_fd) && !rc) {
+            err = std::string("failed to close archive file: ") + strerror(errno);
+            rc = -1;
+        }
+        output_fd = -1;
+    }
+    if (append_fd >= 0) {
+        std::string close_err;
+        if (closeAppendFile(close_err) && !rc) {
+            err = close_err;
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+// Close the archive file or output stream without writing the remaining data
+void QoreTarFile::discardOutput() {
+    write_behind.reset();
+    if (output_fd >= 0) {
+        ::close(output_fd);
+        output_fd = -1;
+    }
+    if (append_fd >= 0) {
+        ::close(append_fd);
+        append_fd = -1;
+    }
 }
 
 // QoreTarEntry implementation
@@ -28,27 +28,87 @@
 #define _QORE_TAR_QORETARFILE_H
 
 #include "tar-module.h"
-
+#include "TarEntryIndex.h"
+#include "TarSeekSource.h"
+#include "TarCompressionSink.h"
+#include "TarStreamReader.h"
+#include "TarWriteBehind.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+struct TarSpeculativeGzipStats;
+
+//! Initial capacity of the buffer of an in-memory archive being written
+#define TAR_WRITE_BUFFER_INITIAL_CAPACITY (64 * 1024)
+
+//! Buffer holding an in-memory archive being written
+/** The buffer grows geometrically with realloc(), which can usually extend large blocks in place, and is
+    handed over to a BinaryNode without being copied once the archive is complete.
+*/
+class TarWriteBuffer {
+public:
+    DLLLOCAL TarWriteBuffer() = default;
+
+    DLLLOCAL ~TarWriteBuffer() {
+        free(buf);
+    }
+
+    TarWriteBuffer(const TarWriteBuffer&) = delete;
+    TarWriteBuffer& operator=(const TarWriteBuffer&) = delete;
+
+    //! Appends data; returns -1 if memory could not be allocated
+    DLLLOCAL int append(const void* data, size_t len);
+
+    //! Returns the data written so far
+    DLLLOCAL const char* data() const {
+        return buf;
+    }
+
+    //! Returns the number of bytes written so far
+    DLLLOCAL size_t size() const {
+        return len;
+    }
+
+    //! Returns a BinaryNode taking over the buffer; the buffer is empty afterwards
+    DLLLOCAL BinaryNode* release();
+
+private:
+    char* buf = nullptr;
+    size_t len = 0;
+    size_t capacity = 0;
+};
+
 //! QoreTarFile - private data class for TarFile Qore class
 class QoreTarFile : public AbstractPrivateData {
 public:
     //! Constructor for file-based archive
-    DLLLOCAL QoreTarFile(const char* path, TarMode mode, int compression_method, int format, ExceptionSink* xsink);
+    DLLLOCAL QoreTarFile(const char* path, TarMode mode, int compression_method, int format,
+                         const QoreHashNode* opts, ExceptionSink* xsink);
 
     //! Constructor for in-memory archive (from binary data)
-    DLLLOCAL QoreTarFile(const BinaryNode* data, ExceptionSink* xsink);
+    /** Only the threads, speculative_gzip and concurrent_reads options are used
+    */
+    DLLLOCAL QoreTarFile(const BinaryNode* data, const QoreHashNode* opts, ExceptionSink* xsink);
 
     //! Constructor for new in-memory archive
-    DLLLOCAL QoreTarFile(int compression_method, int format, ExceptionSink* xsink);
+    DLLLOCAL QoreTarFile(int compression_method, int format, const QoreHashNode* opts, ExceptionSink* xsink);
 
     //! Constructor for stream-based reading
-    DLLLOCAL QoreTarFile(InputStream* input, ExceptionSink* xsink);
+    /** @param input the stream to read the archive from
+        @param opts the create options; the read_ahead and read_ahead_size options set the number and size of
+        the blocks read ahead from the stream by a background thread
+        @param xsink for exceptions
+    */
+    DLLLOCAL QoreTarFile(InputStream* input, const QoreHashNode* opts, ExceptionSink* xsink);
 
     //! Constructor for stream-based writing
-    DLLLOCAL QoreTarFile(OutputStream* output, int compression_method, int format, ExceptionSink* xsink);
+    DLLLOCAL QoreTarFile(OutputStream* output, int compression_method, int format, const QoreHashNode* opts,
+                         ExceptionSink* xsink);
 
     //! Destructor
     DLLLOCAL virtual ~QoreTarFile();
@@ -56,6 +116,9 @@ public:
     //! Close the archive
     DLLLOCAL void close(ExceptionSink* xsink);
 
+    //! Waits until the archive data written so far has been written to the archive file or output stream
+    DLLLOCAL void flush(ExceptionSink* xsink);
+
     //! Get archive as binary data (for in-memory archives)
     DLLLOCAL BinaryNode* toData(ExceptionSink* xsink);
 
@@ -65,6 +128,15 @@ public:
     //! Get number of entries
     DLLLOCAL int64 count(ExceptionSink* xsink);
 
+    //! Find entries matching a TarQuery hash
+    DLLLOCAL QoreListNode* find(const QoreHashNode* query, ExceptionSink* xsink);
+
+    //! Create an iterator over the entries matching an optional TarQuery hash
+    DLLLOCAL QoreObject* iterator(const QoreHashNode* query, ExceptionSink* xsink);
+
+    //! Create TarEntryInfo hash from an index entry
+    DLLLOCAL static QoreHashNode* createEntryInfo(const TarIndexEntry& e, ExceptionSink* xsink);
+
     //! Check if entry exists
     DLLLOCAL bool hasEntry(const char* name, ExceptionSink* xsink);
 
@@ -74,6 +146,9 @@ public:
     //! Read entry as text
     DLLLOCAL QoreStringNode* readText(const char* name, const char* encoding, ExceptionSink* xsink);
 
+    //! Read several entries as binary data in a single pass; returns a hash of names to data
+    DLLLOCAL QoreHashNode* readMany(const QoreListNode* names, ExceptionSink* xsink);
+
     //! Get entry info
     DLLLOCAL QoreHashNode* getEntry(const char* name, ExceptionSink* xsink);
 
@@ -87,6 +162,12 @@ public:
     //! Add file from filesystem
     DLLLOCAL void addFile(const char* name, const char* filepath, const QoreHashNode* opts, ExceptionSink* xsink);
 
+    //! Add a directory tree from the filesystem
+    /** @return the number of entries added, or -1 if an exception was raised
+    */
+    DLLLOCAL int64 addTree(const char* prefix, const char* source_dir, const QoreHashNode* opts,
+                           ExceptionSink* xsink);
+
     //! Add directory entry
     DLLLOCAL void addDirectory(const char* name, const QoreHashNode* opts, ExceptionSink* xsink);
 
@@ -108,6 +189,9 @@ public:
     //! Get archive path
     DLLLOCAL QoreStringNode* getPath() const;
 
+    //! Get a TarDecompressionInfo hash describing how the archive is decompressed
+    DLLLOCAL QoreHashNode* getDecompressionInfo(ExceptionSink* xsink);
+
     //! Get compression method
     DLLLOCAL int getCompressionMethod() const { return compression_method; }
 
@@ -120,12 +204,47 @@ public:
     //! Open an output stream for writing an entry
     DLLLOCAL QoreObject* openOutputStream(const char* name, const QoreHashNode* opts, ExceptionSink* xsink);
 
+    //! Returns true while an output stream is writing an entry of declared size
+    DLLLOCAL bool hasStreamEntry() {
+        std::lock_guard<std::mutex> guard(lock);
+        return stream_entry;
+    }
+
+    //! Writes the header of an entry of declared size for an output stream
+    /** Nothing else can be written to the archive until finishStreamEntry() is called.
+
+        @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int startStreamEntry(struct archive_entry* entry, ExceptionSink* xsink);
+
+    //! Writes data of an entry started with startStreamEntry()
+    /** @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int writeStreamData(const void* data, size_t len, ExceptionSink* xsink);
+
+    //! Ends an entry started with startStreamEntry()
+    /** @return 0 for OK, -1 if the archive was closed before the entry was complete
+    */
+    DLLLOCAL int finishStreamEntry();
+
+    //! Writes an entry of unknown size buffered by an output stream
+    /** @param entry the entry, with its size set
+        @param buffer the data of the entry if \a spill is nullptr
+        @param spill the temporary file holding the data of the entry, positioned at its start, or nullptr
+
+        @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int writeStreamEntry(struct archive_entry* entry, const std::vector<char>& buffer, FILE* spill,
+                                  ExceptionSink* xsink);
+
+    //! Write the entry index to an index file
+    /** @return the path of the index file written
+    */
+    DLLLOCAL QoreStringNode* writeIndex(const char* path, ExceptionSink* xsink);
+
     //! Get reader handle (for stream classes)
     DLLLOCAL struct archive* getReadArchive() const { return read_archive; }
 
-    //! Get writer handle (for stream classes)
-    DLLLOCAL struct archive* getWriteArchive() const { return write_archive; }
-
 private:
     std::string filepath;
     TarMode mode;
@@ -137,28 +256,227 @@ private:
     bool in_memory;
     bool closed;
 
-    // For in-memory archives
-    std::vector<char> memory_buffer;
+    // For in-memory archives: the archive being written
+    TarWriteBuffer memory_buffer;
+    // The binary data of an in-memory archive being read, or of a written archive once toData() has completed
+    // it; it is referenced instead of copied, which is safe since Qore copies shared binary values before
+    // modifying them
+    SimpleRefHolder<BinaryNode> memory_binary;
+    const char* memory_data;
+    size_t memory_size;
     size_t memory_pos;
 
     // For stream-based archives
     InputStream* input_stream;
     OutputStream* output_stream;
 
+    // Entry index built while walking the archive headers in read mode
+    TarEntryIndex entry_index;
+    // Mapping of an archive file opened for reading with the mmap option; it must outlive the seek source
+    bool use_mmap;
+    std::unique_ptr<TarFileMapping> file_map;
+    // Random-access source for uncompressed tar archives; set once the archive has been identified
+    std::unique_ptr<TarSeekSource> seek_source;
+    // Number of headers read since the read cursor was opened at the start of the archive, -1 if the
+    // cursor was opened at an entry offset
+    int64 scan_pos;
+    // True once the archive has been checked for random access
+    bool seek_checked;
+    // TIDX_FLAG_* flags giving the type of the seek source
+    unsigned seek_flags;
+    // False once the native header scanner has rejected the archive
+    bool native_scan;
+
+    // Index file options; an empty path means the archive path with ".idx" appended
+    std::string index_path;
+    bool use_index_file;
+    bool write_index_file;
+
+    // Metadata cache: used for file-based archives opened for reading if the archive file could be accessed
+    bool use_metadata_cache;
+    bool have_open_fp;
+    // Fingerprint of the archive file when it was opened
+    TarIndexFingerprint open_fp;
+
+    // Gzip checkpoints: recorded about every checkpoint_interval bytes on the first scan of a gzip archive
+    bool gzip_checkpoints;
+    int64 checkpoint_interval;
+
+    // Seekable output: compressed by the module into independent frames of about frame_size bytes
+    bool seekable;
+    size_t frame_size;
+    std::unique_ptr<TarCompressionSink> sink;
+    // Number of threads compressing the archive being written or decompressing the archive being read; see
+    // TarParallelSink and TarParallelReader
+    unsigned threads = 1;
+    // libarchive filter code of the archive being read if it is decompressed by a TarParallelReader, otherwise -1
+    int parallel_filter = -1;
+    // Decompress gzip archives being read with a TarSpeculativeGzipReader, which also splits single members
+    bool speculative_gzip = false;
+    // True if the archive being read is decompressed by a TarSpeculativeGzipReader, and the chunk counts of all
+    // speculative readers of the archive
+    bool speculative_read = false;
+    std::shared_ptr<TarSpeculativeGzipStats> speculative_stats;
+    // True while an output stream is writing an entry of declared size; no other writes are possible meanwhile
+    bool stream_entry = false;
+    // Archive file written by the module, unless appended to in place
+    int output_fd = -1;
+    // Writes the archive data to the archive file or output stream; archives written to memory have none
+    std::unique_ptr<TarWriteBehind> write_behind;
+    // Number of blocks queued for the write-behind thread; see TarWriteBehind
+    unsigned write_behind_depth = TAR_WRITE_BEHIND_DEPTH;
+    // Gzip or zstd archive file appended to: written as members with the end-of-archive blocks in their own, so
+    // later appends only replace that member
+    bool append_members = false;
+    // Archive file appended to in place, the offset of its old end-of-archive blocks (or of the compressed member
+    // holding them) and the offset of the next write
+    int append_fd = -1;
+    int64 append_start = 0;
+    int64 append_pos = 0;
+    // Serializes all operations on the archive; entries read with a handle of their own are read without it, see
+    // openEntryHandle()
+    std::mutex lock;
+    // Read entries of archives without a seek source with a new reader each, so they can be read concurrently
+    bool concurrent_reads = false;
+    // Number and size of the blocks read ahead from the input stream of stream-based archives; see TarStreamReader
+    unsigned read_ahead = TAR_READ_AHEAD_DEPTH;
+    size_t read_ahead_size = TAR_READ_AHEAD_SIZE;
+    // True once the first pass over a stream-based archive has started; the stream cannot be read again
+    bool stream_started = false;
+
     //! Create TarEntryInfo hash from archive_entry
     DLLLOCAL QoreHashNode* createEntryInfo(struct archive_entry* entry, ExceptionSink* xsink) const;
 
+    //! Returns true if the entry index is used; only archives opened for reading are indexed
+    DLLLOCAL bool useIndex() const {
+        return mode == TAR_MODE_READ;
+    }
+
+    //! Reads the next header from the read cursor and records it in the entry index
+    DLLLOCAL int nextHeader(struct archive_entry** entry);
+
+    //! Positions the read cursor at the data of the given entry
+    /** @return the entry, or nullptr if the entry was not found or an exception was raised
+    */
+    DLLLOCAL struct archive_entry* findEntry(const char* name, ExceptionSink* xsink);
+
+    //! Opens a libarchive reader for the whole archive that is independent of the read cursor
+    /** The reader can be used without holding the lock; stream-based archives cannot be read this way.
+
+        @return the reader, or nullptr if an exception was raised
+    */
+    DLLLOCAL struct archive* openArchiveHandle(ExceptionSink* xsink) const;
+
+    //! Opens a read handle of its own positioned at the data of the given entry
+    /** Called with the lock held.  Entries in the entry index are read through the seek source if there is one.
+        Otherwise the archive is read from the start with a new reader after releasing the lock, if \a always is
+        true or the concurrent_reads option is set; in all other cases, and for stream-based archives, \a shared
+        is set and the entry has to be found with the read cursor instead.
+
+        @param guard the lock, which is released if a handle is returned
+        @param name the name of the entry
+        @param always read archives without a seek source with a new reader regardless of concurrent_reads
+        @param entry returns the entry if found
+        @param shared set if the read cursor has to be used; the lock is still held in this case
+        @param xsink for exceptions
+
+        @return the handle, or nullptr if the entry was not found, an exception was raised or \a shared was set
+    */
+    DLLLOCAL struct archive* openEntryHandle(std::unique_lock<std::mutex>& guard, const char* name, bool always,
+            struct archive_entry*& entry, bool& shared, ExceptionSink* xsink);
+
+    //! Reads the data of the current entry of the given reader
+    DLLLOCAL BinaryNode* readEntryData(struct archive* a, struct archive_entry* entry, ExceptionSink* xsink);
+
+    //! Reads the data of the current entry of the given reader into a new buffer of the size given in the header
+    /** @param a the reader
+        @param entry the current entry
+        @param extra the number of additional bytes to allocate after the data
+        @param len returns the number of bytes read
+        @param xsink for exceptions
+
+        @return the buffer, to be freed with free(), or nullptr if an exception was raised
+    */
+    DLLLOCAL char* readEntryBuffer(struct archive* a, struct archive_entry* entry, size_t extra, size_t& len,
+            ExceptionSink* xsink);
+
+    //! Opens the read cursor at the given header offset using the seek source
+    DLLLOCAL int openReadAt(int64 offset, ExceptionSink* xsink);
+
+    //! Sets up the seek source if the archive being read is an uncompressed tar archive
+    DLLLOCAL void checkSeekable();
+
+    //! Opens the seek source for the archive file according to the seek flags
+    DLLLOCAL void openFileSeekSource();
+
+    //! Restarts the first scan at the first header using the seek source
+    /** Used for sources that record checkpoints while the archive is read through them; if the seek source
+        cannot be used, it is discarded and the scan continues with the current read cursor.
+    */
+    DLLLOCAL void restartScanAtSeekSource(struct archive_entry** entry);
+
+    //! Reads all remaining headers so that the entry index is complete
+    DLLLOCAL int buildIndex(ExceptionSink* xsink);
+
+    //! Completes the entry index by reading the headers of an uncompressed archive directly
+    /** Entry data is skipped without reading it; archives the native scanner cannot handle are left to
+        libarchive.
+
+        @return 0 if the entry index is complete, -1 if not
+    */
+    DLLLOCAL int scanHeaders();
+
+    //! Marks the entry index as complete, writes the index file if requested and caches the index
+    DLLLOCAL void setIndexComplete();
+
+    //! Writes the index file if requested
+    DLLLOCAL void updateIndexFile();
+
+    //! Takes the entry index from the metadata cache if the archive has not been changed
+    DLLLOCAL void loadCachedIndex();
+
+    //! Stores the complete entry index in the metadata cache if the archive has not been changed
+    DLLLOCAL void storeCachedIndex();
+
+    //! Returns the path of the index file for the archive
+    DLLLOCAL std::string getIndexPath() const;
+
+    //! Loads the entry index from the index file if it exists and matches the archive
+    DLLLOCAL void loadIndexFile();
+
+    //! Saves the complete entry index to the given index file
+    DLLLOCAL int saveIndexFile(const char* path, ExceptionSink* xsink);
+
+    //! Parse create options
+    DLLLOCAL void parseCreateOptions(const QoreHashNode* opts, ExceptionSink* xsink);
+
+    //! Creates a regular file entry with the given metadata; the size is not set
+    DLLLOCAL static struct archive_entry* newFileEntry(const char* name, int mode, int uid, int gid,
+            const std::string& uname, const std::string& gname, int64 modified_time, ExceptionSink* xsink);
+
+    //! Creates an entry of the given type with the metadata of a TarAddOptions hash; the size is not set
+    /** @param mode the permissions used if the options do not give any
+    */
+    DLLLOCAL struct archive_entry* newEntry(const char* name, mode_t type, int mode, const QoreHashNode* opts,
+            ExceptionSink* xsink) const;
+
+    //! Writes entry data for an output stream; must be called with the lock held
+    DLLLOCAL int writeEntryData(const void* data, size_t len, ExceptionSink* xsink);
+
     //! Parse add options
     DLLLOCAL void parseAddOptions(const QoreHashNode* opts, int& mode, int& uid, int& gid,
                                   std::string& uname, std::string& gname, int64& modified_time,
                                   bool& preserve_permissions, bool& dereference_symlinks,
                                   ExceptionSink* xsink) const;
 
+    //! Parse the threads option; returns -1 if an exception was raised
+    DLLLOCAL static int parseThreads(const QoreValue v, unsigned& threads, ExceptionSink* xsink);
+
     //! Parse extract options
     DLLLOCAL void parseExtractOptions(const QoreHashNode* opts, std::string& destination,
                                        bool& preserve_permissions, bool& preserve_ownership,
                                        bool& preserve_times, bool& overwrite, bool& create_directories,
-                                       int& strip_count, ExceptionSink* xsink) const;
+                                       int& strip_count, unsigned& threads, ExceptionSink* xsink) const;
 
     //! Check archive is open and in correct mode
     DLLLOCAL bool checkOpen(ExceptionSink* xsink, bool forWrite = false);
@@ -166,12 +484,47 @@ private:
     //! Open for reading (file or memory)
     DLLLOCAL void openRead(ExceptionSink* xsink);
 
+    //! Open for reading with a pool of decompression threads; returns false if the archive cannot be read this way
+    DLLLOCAL bool openParallelRead(ExceptionSink* xsink);
+
     //! Open for writing (file or memory)
     DLLLOCAL void openWrite(ExceptionSink* xsink);
 
     //! Open for appending (reads existing, prepares for writing)
     DLLLOCAL void openAppend(ExceptionSink* xsink);
 
+    //! Opens an archive file for writing new entries over its end-of-archive blocks
+    /** Uncompressed archives are written over the end-of-archive blocks; gzip and zstd archives over their last
+        member if it only holds the end-of-archive blocks.
+
+        @return true if the archive was opened or an exception was raised, false if the archive cannot be
+        appended to in place and has to be rewritten
+    */
+    DLLLOCAL bool openAppendInPlace(ExceptionSink* xsink);
+
+    //! Writes data at the current position of the archive file appended to in place
+    /** @return 0 for OK, -1 for error, in which case \a err is set
+    */
+    DLLLOCAL int appendWrite(const void* data, size_t len, std::string& err);
+
+    //! Truncates the archive file appended to in place after the written data and closes it
+    /** @return 0 for OK, -1 for error, in which case \a err is set
+    */
+    DLLLOCAL int closeAppendFile(std::string& err);
+
+    //! Opens the archive file or output stream for writing, except for in-memory archives
+    /** @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int setupOutput(ExceptionSink* xsink);
+
+    //! Writes the remaining data and closes the archive file or output stream
+    /** @return 0 for OK, -1 for error, in which case \a err is set
+    */
+    DLLLOCAL int closeOutput(std::string& err);
+
+    //! Closes the archive file or output stream after an error without writing the remaining data
+    DLLLOCAL void discardOutput();
+
     //! Copy entries from read archive to write archive
     DLLLOCAL void copyEntries(ExceptionSink* xsink);
 
@@ -181,15 +534,25 @@ private:
     //! Setup compression filter for writing
     DLLLOCAL void setupCompressionFilter(ExceptionSink* xsink);
 
+    //! Returns true if the archive is compressed by a TarParallelSink
+    DLLLOCAL bool useParallelSink() const;
+
+    //! Setup the compression sink for writing seekable archives, gzip or zstd archives appended to, and archives
+    //! compressed with multiple threads
+    DLLLOCAL void setupCompressionSink(ExceptionSink* xsink);
+
     //! libarchive callbacks for memory operations
     static la_ssize_t memory_read_callback(struct archive*, void* client_data, const void** buffer);
     static int memory_close_callback(struct archive*, void* client_data);
     static la_ssize_t memory_write_callback(struct archive*, void* client_data, const void* buffer, size_t length);
 
-    //! libarchive callbacks for stream operations
-    static la_ssize_t stream_read_callback(struct archive*, void* client_data, const void** buffer);
-    static la_ssize_t stream_write_callback(struct archive*, void* client_data, const void* buffer, size_t length);
-    static int stream_close_callback(struct archive*, void* client_data);
+    //! libarchive callbacks for archives written to files and output streams
+    static la_ssize_t output_write_callback(struct archive*, void* client_data, const void* buffer, size_t length);
+    static int output_close_callback(struct archive*, void* client_data);
+
+    //! libarchive callbacks for compression sink operations
+    static la_ssize_t sink_write_callback(struct archive*, void* client_data, const void* buffer, size_t length);
+    static int sink_close_callback(struct archive*, void* client_data);
 };
 
 //! QoreTarEntry - private data class for TarEntry Qore class
@@ -0,0 +1,653 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarCompressionSink.cpp archive compression sink implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarCompressionSink.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+int TarCompressionSink::startEntry(struct archive* a) {
+    // writes the padding of the previous entry, so all of its data has reached the sink afterwards
+    if (archive_write_finish_entry(a) != ARCHIVE_OK) {
+        return -1;
+    }
+    if (entryBoundary()) {
+        archive_set_error(a, EIO, "%s", err.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int TarCompressionSink::startTrailer(struct archive* a) {
+    if (archive_write_finish_entry(a) != ARCHIVE_OK) {
+        return -1;
+    }
+    if (trailerBoundary()) {
+        archive_set_error(a, EIO, "%s", err.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int tar_write_header(struct archive* a, TarCompressionSink* sink, struct archive_entry* entry) {
+    if (sink && sink->startEntry(a)) {
+        return ARCHIVE_FATAL;
+    }
+    return archive_write_header(a, entry);
+}
+
+int TarFrameSink::write(const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len) {
+        // frames within large entries are ended when they reach the maximum size
+        size_t avail = TAR_MAX_FRAME_SIZE - frame_in;
+        if (len < avail) {
+            return compressFrame(p, len, false);
+        }
+        if (compressFrame(p, avail, true)) {
+            return -1;
+        }
+        p += avail;
+        len -= avail;
+    }
+    return 0;
+}
+
+int TarFrameSink::entryBoundary() {
+    if (frame_in && frame_in >= frame_size) {
+        return compressFrame(nullptr, 0, true);
+    }
+    return 0;
+}
+
+int TarFrameSink::compressFrame(const char* data, size_t len, bool end) {
+    if (compress(data, len, end)) {
+        return -1;
+    }
+    frame_in = end ? 0 : frame_in + len;
+    return 0;
+}
+
+int TarMemberSink::write(const void* data, size_t len) {
+    if (!len) {
+        return 0;
+    }
+    member_open = true;
+    return compress(static_cast<const char*>(data), len, false);
+}
+
+int TarMemberSink::trailerBoundary() {
+    // an empty member is never written
+    if (!member_open) {
+        return 0;
+    }
+    member_open = false;
+    return compress(nullptr, 0, true);
+}
+
+int TarMemberSink::finish() {
+    return trailerBoundary();
+}
+
+namespace {
+#ifdef HAVE_ZLIB
+//! Writes gzip members
+class TarGzipMemberSink : public TarMemberSink {
+public:
+    DLLLOCAL TarGzipMemberSink(TarSinkOutput output) : TarMemberSink(output), out_buffer(TAR_BUFFER_SIZE) {
+    }
+
+    DLLLOCAL virtual ~TarGzipMemberSink() {
+        if (initialized) {
+            deflateEnd(&strm);
+        }
+    }
+
+    DLLLOCAL int init(int level, std::string& err) {
+        // a window size of 15 plus 16 writes gzip headers and trailers
+        if (deflateInit2(&strm, level >= 1 && level <= 9 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+            err = "failed to initialize the gzip compressor";
+            return -1;
+        }
+        initialized = true;
+        return 0;
+    }
+
+protected:
+    DLLLOCAL virtual int compress(const char* data, size_t len, bool end) override {
+        strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        strm.avail_in = (uInt)len;
+        int flush = end ? Z_FINISH : Z_NO_FLUSH;
+        while (true) {
+            strm.next_out = reinterpret_cast<Bytef*>(out_buffer.data());
+            strm.avail_out = (uInt)out_buffer.size();
+            int rc = deflate(&strm, flush);
+            if (rc == Z_STREAM_ERROR) {
+                err = "gzip compression failed";
+                return -1;
+            }
+            size_t n = out_buffer.size() - strm.avail_out;
+            if (n && writeOutput(out_buffer.data(), n)) {
+                return -1;
+            }
+            if (end ? rc == Z_STREAM_END : !strm.avail_in && strm.avail_out) {
+                break;
+            }
+        }
+        // the next data starts a new member
+        if (end && deflateReset(&strm) != Z_OK) {
+            err = "failed to reset the gzip compressor";
+            return -1;
+        }
+        return 0;
+    }
+
+private:
+    z_stream strm = z_stream();
+    bool initialized = false;
+    std::vector<char> out_buffer;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+//! Writes zstd frames
+class TarZstdMemberSink : public TarMemberSink {
+public:
+    DLLLOCAL TarZstdMemberSink(TarSinkOutput output, ZSTD_CCtx* cctx) : TarMemberSink(output), cctx(cctx),
+            out_buffer(ZSTD_CStreamOutSize()) {
+    }
+
+    DLLLOCAL virtual ~TarZstdMemberSink() {
+        ZSTD_freeCCtx(cctx);
+    }
+
+protected:
+    DLLLOCAL virtual int compress(const char* data, size_t len, bool end) override {
+        ZSTD_inBuffer in = { data, len, 0 };
+        ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+        while (true) {
+            ZSTD_outBuffer out = { out_buffer.data(), out_buffer.size(), 0 };
+            size_t rc = ZSTD_compressStream2(cctx, &out, &in, mode);
+            if (ZSTD_isError(rc)) {
+                err = ZSTD_getErrorName(rc);
+                return -1;
+            }
+            if (out.pos && writeOutput(out.dst, out.pos)) {
+                return -1;
+            }
+            // with ZSTD_e_end, rc is the amount of data still to be flushed
+            if (end ? !rc : in.pos == in.size) {
+                return 0;
+            }
+        }
+    }
+
+private:
+    ZSTD_CCtx* cctx;
+    std::vector<char> out_buffer;
+};
+#endif
+}
+
+bool TarMemberSink::supported(int compression_method) {
+#ifdef HAVE_ZLIB
+    if (compression_method == TAR_CM_GZIP) {
+        return true;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (compression_method == TAR_CM_ZSTD) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+TarMemberSink* TarMemberSink::create(TarSinkOutput output, int compression_method, int level,
+                                     std::string& err) {
+#ifdef HAVE_ZLIB
+    if (compression_method == TAR_CM_GZIP) {
+        std::unique_ptr<TarGzipMemberSink> sink(new TarGzipMemberSink(output));
+        if (sink->init(level, err)) {
+            return nullptr;
+        }
+        return sink.release();
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (compression_method == TAR_CM_ZSTD) {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        if (!cctx) {
+            err = "failed to create zstd compression context";
+            return nullptr;
+        }
+        size_t rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+            level > 0 ? level : ZSTD_CLEVEL_DEFAULT);
+        if (ZSTD_isError(rc)) {
+            err = ZSTD_getErrorName(rc);
+            ZSTD_freeCCtx(cctx);
+            return nullptr;
+        }
+        return new TarZstdMemberSink(output, cctx);
+    }
+#endif
+    err = "the compression method is not supported";
+    return nullptr;
+}
+
+namespace {
+//! Decompresses gzip members or zstd frames for libarchive and records where each of them starts
+class TarMemberReader {
+public:
+    struct Member {
+        // compressed offset
+        int64 offset;
+        // uncompressed offset and size
+        int64 data_offset;
+        int64 size;
+        // true if the member only holds zero bytes
+        bool zero;
+    };
+    std::vector<Member> members;
+
+    DLLLOCAL TarMemberReader(int compression_method) : compression_method(compression_method),
+            in_buffer(TAR_BUFFER_SIZE), out_buffer(TAR_BUFFER_SIZE) {
+    }
+
+    DLLLOCAL ~TarMemberReader() {
+        if (f) {
+            fclose(f);
+        }
+#ifdef HAVE_ZLIB
+        if (zinit) {
+            inflateEnd(&strm);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        ZSTD_freeDCtx(dctx);
+#endif
+    }
+
+    DLLLOCAL int open(const char* path) {
+        f = fopen(path, "rb");
+        if (!f) {
+            return -1;
+        }
+#ifdef HAVE_ZLIB
+        if (compression_method == TAR_CM_GZIP) {
+            if (inflateInit2(&strm, 31) != Z_OK) {
+                return -1;
+            }
+            zinit = true;
+            return 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (compression_method == TAR_CM_ZSTD) {
+            dctx = ZSTD_createDCtx();
+            return dctx ? 0 : -1;
+        }
+#endif
+        return -1;
+    }
+
+    //! Returns the next decompressed data, 0 at the end of the file, or -1 for errors and truncated members
+    DLLLOCAL la_ssize_t read(const void** buffer) {
+        while (true) {
+            if (in_pos == in_len) {
+                if (eof) {
+                    return in_member ? -1 : 0;
+                }
+                in_offset += in_len;
+                in_len = fread(in_buffer.data(), 1, in_buffer.size(), f);
+                in_pos = 0;
+                if (!in_len) {
+                    if (ferror(f)) {
+                        return -1;
+                    }
+                    eof = true;
+                }
+                continue;
+            }
+            if (!in_member) {
+                members.push_back({in_offset + (int64)in_pos, data_pos, 0, true});
+                in_member = true;
+            }
+
+            size_t produced = 0;
+            bool end = false;
+#ifdef HAVE_ZLIB
+            if (compression_method == TAR_CM_GZIP) {
+                strm.next_in = reinterpret_cast<Bytef*>(in_buffer.data() + in_pos);
+                strm.avail_in = (uInt)(in_len - in_pos);
+                strm.next_out = reinterpret_cast<Bytef*>(out_buffer.data());
+                strm.avail_out = (uInt)out_buffer.size();
+                int rc = inflate(&strm, Z_NO_FLUSH);
+                if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                    return -1;
+                }
+                in_pos = in_len - strm.avail_in;
+                produced = out_buffer.size() - strm.avail_out;
+                end = rc == Z_STREAM_END;
+                if (end && inflateReset(&strm) != Z_OK) {
+                    return -1;
+                }
+            }
+#endif
+#ifdef HAVE_ZSTD
+            if (compression_method == TAR_CM_ZSTD) {
+                ZSTD_inBuffer in = { in_buffer.data() + in_pos, in_len - in_pos, 0 };
+                ZSTD_outBuffer out = { out_buffer.data(), out_buffer.size(), 0 };
+                size_t rc = ZSTD_decompressStream(dctx, &out, &in);
+                if (ZSTD_isError(rc)) {
+                    return -1;
+                }
+                in_pos += in.pos;
+                produced = out.pos;
+                // 0 is returned once a frame is completely decoded and flushed
+                end = !rc;
+            }
+#endif
+            Member& m = members.back();
+            if (m.zero && produced) {
+                const char* p = out_buffer.data();
+                for (size_t i = 0; i < produced; ++i) {
+                    if (p[i]) {
+                        m.zero = false;
+                        break;
+                    }
+                }
+            }
+            m.size += produced;
+            data_pos += produced;
+            if (end) {
+                in_member = false;
+            }
+            if (produced) {
+                *buffer = out_buffer.data();
+                return produced;
+            }
+        }
+    }
+
+    DLLLOCAL static la_ssize_t read_callback(struct archive*, void* client_data, const void** buffer) {
+        return static_cast<TarMemberReader*>(client_data)->read(buffer);
+    }
+
+private:
+    int compression_method;
+    FILE* f = nullptr;
+    std::vector<char> in_buffer;
+    std::vector<char> out_buffer;
+    // compressed offset of in_buffer, and the position and amount of data in it
+    int64 in_offset = 0;
+    size_t in_pos = 0;
+    size_t in_len = 0;
+    bool eof = false;
+    bool in_member = false;
+    // uncompressed offset of the next data returned
+    int64 data_pos = 0;
+#ifdef HAVE_ZLIB
+    z_stream strm = z_stream();
+    bool zinit = false;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx* dctx = nullptr;
+#endif
+};
+
+//! Frees a libarchive read handle
+struct TarReadArchiveHolder {
+    struct archive* a;
+
+    DLLLOCAL ~TarReadArchiveHolder() {
+        archive_read_free(a);
+    }
+};
+}
+
+int tar_find_trailer_member(const char* path, int compression_method, int64& offset) {
+    TarMemberReader reader(compression_method);
+    if (reader.open(path)) {
+        return -1;
+    }
+
+    TarReadArchiveHolder holder = { archive_read_new() };
+    struct archive* a = holder.a;
+    if (!a || archive_read_support_format_tar(a) != ARCHIVE_OK
+        || archive_read_open(a, &reader, nullptr, TarMemberReader::read_callback, nullptr) != ARCHIVE_OK) {
+        return -1;
+    }
+
+    // the position after skipping the data and padding of the last entry is the end of the entries
+    int64 end = 0;
+    struct archive_entry* entry;
+    int rc;
+    while ((rc = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+        if (archive_read_data_skip(a) != ARCHIVE_OK) {
+            return -1;
+        }
+        end = archive_filter_bytes(a, 0);
+    }
+    if (rc != ARCHIVE_EOF) {
+        return -1;
+    }
+
+    // libarchive stops reading at the end-of-archive blocks; the rest of the file is checked here
+    const void* buf;
+    la_ssize_t n;
+    while ((n = reader.read(&buf)) > 0) {
+    }
+    if (n < 0 || reader.members.empty()) {
+        return -1;
+    }
+
+    const TarMemberReader::Member& m = reader.members.back();
+    if (!m.zero || m.size < 2 * 512 || m.data_offset != end) {
+        return -1;
+    }
+    offset = m.offset;
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+namespace {
+void put_le32(char* p, uint32_t v) {
+    for (unsigned i = 0; i < 4; ++i) {
+        p[i] = (char)(v >> (i * 8));
+    }
+}
+}
+
+TarZstdFrameSink::TarZstdFrameSink(TarSinkOutput output, ZSTD_CCtx* cctx, size_t frame_size)
+        : TarFrameSink(output, frame_size), cctx(cctx), frame_out(0), out_buffer(ZSTD_CStreamOutSize()) {
+}
+
+TarZstdFrameSink::~TarZstdFrameSink() {
+    ZSTD_freeCCtx(cctx);
+}
+
+TarZstdFrameSink* TarZstdFrameSink::create(TarSinkOutput output, int level, size_t frame_size,
+                                           std::string& err) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (!cctx) {
+        err = "failed to create zstd compression context";
+        return nullptr;
+    }
+    size_t rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level > 0 ? level : ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(rc)) {
+        err = ZSTD_getErrorName(rc);
+        ZSTD_freeCCtx(cctx);
+        return nullptr;
+    }
+    return new TarZstdFrameSink(output, cctx, frame_size);
+}
+
+int TarZstdFrameSink::compress(const char* data, size_t len, bool end) {
+    ZSTD_inBuffer in = { data, len, 0 };
+    ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+    while (true) {
+        ZSTD_outBuffer out = { out_buffer.data(), out_buffer.size(), 0 };
+        size_t rc = ZSTD_compressStream2(cctx, &out, &in, mode);
+        if (ZSTD_isError(rc)) {
+            err = ZSTD_getErrorName(rc);
+            return -1;
+        }
+        if (out.pos) {
+            if (writeOutput(out.dst, out.pos)) {
+                return -1;
+            }
+            frame_out += out.pos;
+        }
+        // with ZSTD_e_end, rc is the amount of data still to be flushed
+        if (end ? !rc : in.pos == in.size) {
+            break;
+        }
+    }
+
+    if (end) {
+        frames.push_back(std::make_pair((uint32_t)frame_out, (uint32_t)(frame_in + len)));
+        frame_out = 0;
+    }
+    return 0;
+}
+
+int TarZstdFrameSink::finish() {
+    if (frame_in && compressFrame(nullptr, 0, true)) {
+        return -1;
+    }
+
+    // seek table in a skippable frame: frame header, one entry per frame and the footer
+    size_t table_size = frames.size() * 8 + TAR_ZSTD_SEEK_FOOTER_SIZE;
+    std::vector<char> table(8 + table_size);
+    char* p = table.data();
+    put_le32(p, TAR_ZSTD_SKIPPABLE_MAGIC);
+    put_le32(p + 4, (uint32_t)table_size);
+    p += 8;
+    for (const std::pair<uint32_t, uint32_t>& f : frames) {
+        put_le32(p, f.first);
+        put_le32(p + 4, f.second);
+        p += 8;
+    }
+    put_le32(p, (uint32_t)frames.size());
+    // descriptor: no frame checksums
+    p[4] = 0;
+    put_le32(p + 5, TAR_ZSTD_SEEKABLE_MAGIC);
+    return writeOutput(table.data(), table.size());
+}
+#endif
+
+#ifdef HAVE_LZMA
+struct TarXzStream {
+    lzma_stream strm = LZMA_STREAM_INIT;
+
+    DLLLOCAL ~TarXzStream() {
+        lzma_end(&strm);
+    }
+};
+
+const char* tar_lzma_error(int rc) {
+    switch (rc) {
+        case LZMA_MEM_ERROR: return "out of memory";
+        case LZMA_MEMLIMIT_ERROR: return "memory usage limit reached";
+        case LZMA_FORMAT_ERROR: return "file format not recognized";
+        case LZMA_OPTIONS_ERROR: return "unsupported options";
+        case LZMA_DATA_ERROR: return "compressed data is corrupt";
+        case LZMA_BUF_ERROR: return "unexpected end of compressed data";
+        case LZMA_UNSUPPORTED_CHECK: return "unsupported integrity check";
+        default: return "internal xz error";
+    }
+}
+
+TarXzBlockSink::TarXzBlockSink(TarSinkOutput output, TarXzStream* stream, size_t frame_size)
+        : TarFrameSink(output, frame_size), stream(stream), out_buffer(TAR_BUFFER_SIZE) {
+}
+
+TarXzBlockSink::~TarXzBlockSink() {
+}
+
+TarXzBlockSink* TarXzBlockSink::create(TarSinkOutput output, int level, size_t frame_size, std::string& err) {
+    std::unique_ptr<TarXzStream> stream(new TarXzStream);
+    uint32_t preset = level >= 0 && level <= 9 ? (uint32_t)level : LZMA_PRESET_DEFAULT;
+    lzma_ret rc = lzma_easy_encoder(&stream->strm, preset, LZMA_CHECK_CRC64);
+    if (rc != LZMA_OK) {
+        err = tar_lzma_error(rc);
+        return nullptr;
+    }
+    return new TarXzBlockSink(output, stream.release(), frame_size);
+}
+
+int TarXzBlockSink::code(int action) {
+    lzma_stream& strm = stream->strm;
+    while (true) {
+        strm.next_out = reinterpret_cast<uint8_t*>(out_buffer.data());
+        strm.avail_out = out_buffer.size();
+        lzma_ret rc = lzma_code(&strm, (lzma_action)action);
+        if (rc != LZMA_OK && rc != LZMA_STREAM_END) {
+            err = tar_lzma_error(rc);
+            return -1;
+        }
+        size_t n = out_buffer.size() - strm.avail_out;
+        if (n && writeOutput(out_buffer.data(), n)) {
+            return -1;
+        }
+        // flushing and finishing are complete when LZMA_STREAM_END is returned
+        if (action == LZMA_RUN ? !strm.avail_in : rc == LZMA_STREAM_END) {
+            return 0;
+        }
+    }
+}
+
+int TarXzBlockSink::compress(const char* data, size_t len, bool end) {
+    lzma_stream& strm = stream->strm;
+    strm.next_in = reinterpret_cast<const uint8_t*>(data);
+    strm.avail_in = len;
+    // a full flush ends the current block; the encoder starts a new block with the next data
+    if (len && code(LZMA_RUN)) {
+        return -1;
+    }
+    return end ? code(LZMA_FULL_FLUSH) : 0;
+}
+
+int TarXzBlockSink::finish() {
+    // ends the last block and writes the index and the stream footer
+    return code(LZMA_FINISH);
+}
+#endif
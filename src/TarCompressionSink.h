@@ -0,0 +1,263 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarCompressionSink.h archive compression sink classes */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARCOMPRESSIONSINK_H
+#define _QORE_TAR_TARCOMPRESSIONSINK_H
+
+#include "tar-module.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// zstd seekable format constants
+#define TAR_ZSTD_SKIPPABLE_MAGIC    0x184D2A5E
+#define TAR_ZSTD_SEEKABLE_MAGIC     0x8F92EAB1
+//! Size of the seek table footer: frame count, descriptor and magic number
+#define TAR_ZSTD_SEEK_FOOTER_SIZE   9
+//! Maximum uncompressed size of a zstd frame or xz block in a seekable archive
+#define TAR_MAX_FRAME_SIZE          (256 * 1024 * 1024)
+//! Default target uncompressed size of a zstd frame or xz block in a seekable archive
+#define TAR_DEFAULT_FRAME_SIZE      (1024 * 1024)
+
+//! Function receiving the compressed archive data; returns 0 for OK or -1 and sets the error message
+typedef std::function<int (const void* data, size_t len, std::string& err)> TarSinkOutput;
+
+//! Compresses the uncompressed tar stream written by libarchive
+/** Used instead of a libarchive filter when the module controls the compressed layout of the archive.  The
+    archive is opened with no filter and a block size of 0, so all data reaches the sink as soon as libarchive
+    writes it, and the sink is told when a new entry starts with startEntry().
+*/
+class TarCompressionSink {
+public:
+    DLLLOCAL TarCompressionSink(TarSinkOutput output) : output(output) {
+    }
+
+    DLLLOCAL virtual ~TarCompressionSink() {
+    }
+
+    //! Compresses the given uncompressed data
+    /** @return 0 for OK, -1 for error, in which case getError() returns the error message
+    */
+    DLLLOCAL virtual int write(const void* data, size_t len) = 0;
+
+    //! Finishes the compressed stream; called when the archive is closed
+    /** @return 0 for OK, -1 for error, in which case getError() returns the error message
+    */
+    DLLLOCAL virtual int finish() = 0;
+
+    //! Completes the current entry and notifies the sink that a new entry starts
+    /** Sets the archive error on failure.
+
+        @return 0 for OK, -1 for error
+    */
+    DLLLOCAL int startEntry(struct archive* a);
+
+    //! Completes the current entry and notifies the sink that the end-of-archive blocks follow
+    /** Called before the archive is closed.  Sets the archive error on failure.
+
+        @return 0 for OK, -1 for error
+    */
+    DLLLOCAL int startTrailer(struct archive* a);
+
+    //! Returns the last error message
+    DLLLOCAL const char* getError() const {
+        return err.c_str();
+    }
+
+protected:
+    TarSinkOutput output;
+    std::string err;
+
+    //! Called at an entry boundary once all data of the previous entry has been written
+    /** @return 0 for OK, -1 for error
+    */
+    DLLLOCAL virtual int entryBoundary() {
+        return 0;
+    }
+
+    //! Called once all entries have been written, before the end-of-archive blocks
+    /** @return 0 for OK, -1 for error
+    */
+    DLLLOCAL virtual int trailerBoundary() {
+        return 0;
+    }
+
+    //! Writes compressed data to the output
+    DLLLOCAL int writeOutput(const void* data, size_t len) {
+        return output(data, len, err);
+    }
+};
+
+//! Compresses the archive into independently decompressible frames
+/** Frames end at the first entry boundary after the frame has reached the target size, and within large
+    entries at TAR_MAX_FRAME_SIZE.
+*/
+class TarFrameSink : public TarCompressionSink {
+public:
+    DLLLOCAL TarFrameSink(TarSinkOutput output, size_t frame_size) : TarCompressionSink(output),
+            frame_size(frame_size), frame_in(0) {
+    }
+
+    DLLLOCAL virtual int write(const void* data, size_t len) override;
+
+protected:
+    size_t frame_size;
+    // uncompressed size of the current frame
+    size_t frame_in;
+
+    DLLLOCAL virtual int entryBoundary() override;
+
+    //! Compresses data into the current frame; ends the frame if \a end is true
+    /** frame_in gives the uncompressed size of the frame before the data.
+
+        @return 0 for OK, -1 for error
+    */
+    DLLLOCAL virtual int compress(const char* data, size_t len, bool end) = 0;
+
+    //! Compresses data and updates the frame size
+    DLLLOCAL int compressFrame(const char* data, size_t len, bool end);
+};
+
+//! Compresses the archive as a single gzip member or zstd frame, with the end-of-archive blocks in their own
+/** Gzip members and zstd frames can be concatenated, so new entries can be appended to such an archive by
+    overwriting the last member, which only holds the end-of-archive blocks, with new members; see
+    tar_find_trailer_member().
+*/
+class TarMemberSink : public TarCompressionSink {
+public:
+    //! Returns true if the sink supports the given TAR_CM_* compression method
+    DLLLOCAL static bool supported(int compression_method);
+
+    //! Creates the sink; returns nullptr and sets \a err if the compressor cannot be created
+    DLLLOCAL static TarMemberSink* create(TarSinkOutput output, int compression_method, int level,
+                                          std::string& err);
+
+    DLLLOCAL virtual int write(const void* data, size_t len) override;
+
+    DLLLOCAL virtual int finish() override;
+
+protected:
+    // true if data has been written to the current member
+    bool member_open = false;
+
+    DLLLOCAL TarMemberSink(TarSinkOutput output) : TarCompressionSink(output) {
+    }
+
+    DLLLOCAL virtual int trailerBoundary() override;
+
+    //! Compresses data into the current member; ends the member if \a end is true
+    /** @return 0 for OK, -1 for error
+    */
+    DLLLOCAL virtual int compress(const char* data, size_t len, bool end) = 0;
+};
+
+#ifdef HAVE_ZSTD
+struct ZSTD_CCtx_s;
+
+//! Writes a seekable zstd archive
+/** Data is compressed into independent zstd frames.  The compressed and uncompressed size of each frame are
+    written to a seek table in a trailing skippable frame, using the zstd seekable format, so the archive
+    remains a valid zstd stream.
+*/
+class TarZstdFrameSink : public TarFrameSink {
+public:
+    //! Creates the sink; returns nullptr and sets \a err if the compressor cannot be created
+    DLLLOCAL static TarZstdFrameSink* create(TarSinkOutput output, int level, size_t frame_size,
+                                             std::string& err);
+
+    DLLLOCAL virtual ~TarZstdFrameSink();
+
+    DLLLOCAL virtual int finish() override;
+
+protected:
+    DLLLOCAL virtual int compress(const char* data, size_t len, bool end) override;
+
+private:
+    struct ZSTD_CCtx_s* cctx;
+    // compressed size of the current frame
+    size_t frame_out;
+    // compressed and uncompressed size of each completed frame
+    std::vector<std::pair<uint32_t, uint32_t>> frames;
+    std::vector<char> out_buffer;
+
+    DLLLOCAL TarZstdFrameSink(TarSinkOutput output, struct ZSTD_CCtx_s* cctx, size_t frame_size);
+};
+#endif
+
+#ifdef HAVE_LZMA
+struct TarXzStream;
+
+//! Writes an xz archive with multiple blocks
+/** Each frame is written as a separate xz block; the xz index at the end of the stream records the
+    compressed and uncompressed size of every block, so readers can decompress single blocks.
+*/
+class TarXzBlockSink : public TarFrameSink {
+public:
+    //! Creates the sink; returns nullptr and sets \a err if the compressor cannot be created
+    DLLLOCAL static TarXzBlockSink* create(TarSinkOutput output, int level, size_t frame_size, std::string& err);
+
+    DLLLOCAL virtual ~TarXzBlockSink();
+
+    DLLLOCAL virtual int finish() override;
+
+protected:
+    DLLLOCAL virtual int compress(const char* data, size_t len, bool end) override;
+
+private:
+    std::unique_ptr<TarXzStream> stream;
+    std::vector<char> out_buffer;
+
+    DLLLOCAL TarXzBlockSink(TarSinkOutput output, TarXzStream* stream, size_t frame_size);
+
+    //! Runs the encoder with the given lzma_action until the input is consumed or the action is complete
+    DLLLOCAL int code(int action);
+};
+
+//! Returns an error message for a liblzma return code
+DLLLOCAL const char* tar_lzma_error(int rc);
+#endif
+
+//! Finds the last member of a gzip or zstd archive if it only holds the end-of-archive blocks
+/** The archive is decompressed and its headers are read; the last member qualifies if it starts exactly at
+    the end of the last entry and only contains zero blocks.  Archives written with a TarMemberSink have this
+    layout; in other archives the end-of-archive blocks usually share a member with entry data.
+
+    @param path the archive file
+    @param compression_method TAR_CM_GZIP or TAR_CM_ZSTD
+    @param offset returns the compressed offset of the last member
+
+    @return 0 if the member was found, -1 if the archive does not have this layout or cannot be read
+*/
+DLLLOCAL int tar_find_trailer_member(const char* path, int compression_method, int64& offset);
+
+//! Writes an entry header; if a compression sink is given, it is notified first
+DLLLOCAL int tar_write_header(struct archive* a, TarCompressionSink* sink, struct archive_entry* entry);
+
+#endif // _QORE_TAR_TARCOMPRESSIONSINK_H
@@ -0,0 +1,673 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarEntryIndex.cpp TarEntryIndex class implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarEntryIndex.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+
+/* Index file layout; all integers are little-endian:
+
+    header (72 bytes):
+        0   magic "QTARIDX\0"
+        8   u32 format version
+        12  u32 TIDX_FLAG_* flags
+        16  i64 archive size
+        24  i64 archive mtime (seconds)
+        32  i64 archive mtime (nanoseconds)
+        40  u64 archive inode
+        48  u64 archive device
+        56  u64 entry count
+        64  u32 section count
+        68  u32 reserved
+    section table (section count * 24 bytes): u32 type, u32 reserved, u64 offset, u64 length
+    sections, each starting at an 8-byte aligned offset:
+        TIDX_SEC_RECORDS: entry count * TIDX_RECORD_SIZE byte records in archive order
+        TIDX_SEC_STRINGS: string data referenced by the records
+        TIDX_SEC_NAMES: entry count * u64 record numbers sorted by name; duplicate names keep archive order
+        followed by any additional sections, which are ignored by readers that do not know them
+*/
+#define TIDX_MAGIC              "QTARIDX"
+#define TIDX_VERSION            1
+#define TIDX_HEADER_SIZE        72
+#define TIDX_SECTION_SIZE       24
+#define TIDX_MAX_SECTIONS       64
+#define TIDX_SEC_RECORDS        1
+#define TIDX_SEC_STRINGS        2
+#define TIDX_SEC_NAMES          3
+#define TIDX_RECORD_SIZE        136
+
+// record field offsets
+#define TIDX_R_HEADER_OFFSET    0
+#define TIDX_R_DATA_OFFSET      8
+#define TIDX_R_SIZE             16
+#define TIDX_R_MTIME            24
+#define TIDX_R_ATIME            32
+#define TIDX_R_CTIME            40
+#define TIDX_R_UID              48
+#define TIDX_R_GID              56
+#define TIDX_R_NAME             64
+#define TIDX_R_UNAME            72
+#define TIDX_R_GNAME            80
+#define TIDX_R_LINK             88
+#define TIDX_R_NAME_LEN         96
+#define TIDX_R_UNAME_LEN        100
+#define TIDX_R_GNAME_LEN        104
+#define TIDX_R_LINK_LEN         108
+#define TIDX_R_MODE             112
+#define TIDX_R_FILETYPE         116
+#define TIDX_R_DEVMAJOR         120
+#define TIDX_R_DEVMINOR         124
+#define TIDX_R_FLAGS            128
+
+//! Read-only mapping of an index file
+class TarIndexMapping {
+public:
+    void* addr;
+    size_t len;
+
+    DLLLOCAL TarIndexMapping(void* addr, size_t len) : addr(addr), len(len) {
+    }
+
+    DLLLOCAL ~TarIndexMapping() {
+        munmap(addr, len);
+    }
+};
+
+namespace {
+void put_u32(char* p, uint32_t v) {
+    for (unsigned i = 0; i < 4; ++i) {
+        p[i] = (char)(v >> (i * 8));
+    }
+}
+
+void put_u64(char* p, uint64_t v) {
+    for (unsigned i = 0; i < 8; ++i) {
+        p[i] = (char)(v >> (i * 8));
+    }
+}
+
+uint32_t get_u32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+uint64_t get_u64(const char* p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+size_t align8(size_t v) {
+    return (v + 7) & ~(size_t)7;
+}
+
+// Writes data to the index file; returns -1 on error
+int write_all(FILE* fp, const void* data, size_t len) {
+    return len && fwrite(data, 1, len, fp) != len ? -1 : 0;
+}
+}
+
+int TarIndexFingerprint::get(const char* path) {
+    struct stat st;
+    if (stat(path, &st)) {
+        return -1;
+    }
+    size = st.st_size;
+    mtime = st.st_mtime;
+#if defined(__APPLE__)
+    mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+    mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+    inode = st.st_ino;
+    device = st.st_dev;
+    return 0;
+}
+
+const char* tar_entry_type_names[TET_NUM_TYPES] = {
+    "file", "directory", "symlink", "hardlink", "chardev", "blockdev", "fifo", "socket", "unknown",
+};
+
+TarEntryType TarIndexEntry::getType() const {
+    if (flags & TIE_HARDLINK_NONEMPTY) {
+        return TET_HARDLINK;
+    }
+    switch (filetype) {
+        case AE_IFREG:  return TET_FILE;
+        case AE_IFDIR:  return TET_DIRECTORY;
+        case AE_IFLNK:  return TET_SYMLINK;
+        case AE_IFCHR:  return TET_CHARDEV;
+        case AE_IFBLK:  return TET_BLOCKDEV;
+        case AE_IFIFO:  return TET_FIFO;
+        case AE_IFSOCK: return TET_SOCKET;
+        default:        return TET_UNKNOWN;
+    }
+}
+
+void TarIndexEntry::set(struct archive* a, struct archive_entry* entry) {
+    const char* str = archive_entry_pathname(entry);
+    name = str ? str : "";
+    size = archive_entry_size(entry);
+    mode = archive_entry_mode(entry);
+    filetype = archive_entry_filetype(entry);
+    uid = archive_entry_uid(entry);
+    gid = archive_entry_gid(entry);
+    mtime = atime = ctime = 0;
+    devmajor = devminor = 0;
+    flags = 0;
+
+    if (archive_entry_mtime_is_set(entry)) {
+        mtime = archive_entry_mtime(entry);
+        flags |= TIE_MTIME_SET;
+    }
+    if (archive_entry_atime_is_set(entry)) {
+        atime = archive_entry_atime(entry);
+        flags |= TIE_ATIME_SET;
+    }
+    if (archive_entry_ctime_is_set(entry)) {
+        ctime = archive_entry_ctime(entry);
+        flags |= TIE_CTIME_SET;
+    }
+
+    str = archive_entry_uname(entry);
+    if (str) {
+        uname = str;
+        flags |= TIE_UNAME_SET;
+    } else {
+        uname.clear();
+    }
+
+    str = archive_entry_gname(entry);
+    if (str) {
+        gname = str;
+        flags |= TIE_GNAME_SET;
+    } else {
+        gname.clear();
+    }
+
+    const char* hardlink = archive_entry_hardlink(entry);
+    if (hardlink) {
+        flags |= TIE_HARDLINK_SET;
+        if (*hardlink) {
+            flags |= TIE_HARDLINK_NONEMPTY;
+        }
+    }
+    str = archive_entry_symlink(entry);
+    if (str) {
+        flags |= TIE_SYMLINK_SET;
+    } else {
+        str = hardlink;
+    }
+    if (str) {
+        link_target = str;
+    } else {
+        link_target.clear();
+    }
+
+    if (filetype == AE_IFCHR || filetype == AE_IFBLK) {
+        devmajor = archive_entry_rdevmajor(entry);
+        devminor = archive_entry_rdevminor(entry);
+    }
+
+    if (archive_entry_sparse_count(entry) > 0) {
+        flags |= TIE_SPARSE;
+    }
+
+    if (a) {
+        header_offset = archive_read_header_position(a);
+        // the header blocks have been consumed at this point, so the filter position is the data offset
+        data_offset = archive_filter_bytes(a, 0);
+    }
+}
+
+TarEntryIndex::TarEntryIndex() : complete(false), mapped_count(0), records(nullptr), strings(nullptr),
+        strings_len(0), sorted(nullptr) {
+}
+
+TarEntryIndex::~TarEntryIndex() {
+}
+
+size_t TarIndexData::memorySize() const {
+    size_t rc = sizeof(*this) + entries.capacity() * sizeof(TarIndexEntry);
+    for (const TarIndexEntry& e : entries) {
+        rc += e.name.capacity() + e.uname.capacity() + e.gname.capacity() + e.link_target.capacity();
+    }
+    // hash nodes with their keys, plus the bucket array
+    rc += by_name.size() * (sizeof(std::pair<const std::string, size_t>) + 2 * sizeof(void*))
+        + by_name.bucket_count() * sizeof(void*);
+    for (const std::pair<const std::string, size_t>& i : by_name) {
+        rc += i.first.capacity();
+    }
+    return rc;
+}
+
+void TarEntryIndex::add(TarIndexEntry&& e) {
+    assert(!complete && !mapping);
+    // entries are only added while the index is being built, when the data is not shared yet
+    if (!data) {
+        data = std::make_shared<TarIndexData>();
+    }
+    TarIndexData* d = const_cast<TarIndexData*>(data.get());
+    std::string key = tar_normalize_entry_name(e.name.c_str());
+    // keep the first entry for duplicate names, like a sequential scan would
+    d->by_name.emplace(std::move(key), d->entries.size());
+    d->entries.push_back(std::move(e));
+}
+
+void TarEntryIndex::setData(const std::shared_ptr<const TarIndexData>& d) {
+    clear();
+    data = d;
+    complete = true;
+}
+
+bool TarEntryIndex::find(const std::string& key, TarIndexEntry& e) const {
+    if (mapping) {
+        // binary search for the first record with the given name
+        size_t lo = 0, hi = mapped_count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (compareMappedName(get_u64(sorted + mid * 8), key) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == mapped_count) {
+            return false;
+        }
+        size_t i = get_u64(sorted + lo * 8);
+        if (compareMappedName(i, key)) {
+            return false;
+        }
+        decodeRecord(i, e);
+        return true;
+    }
+
+    if (!data) {
+        return false;
+    }
+    std::unordered_map<std::string, size_t>::const_iterator i = data->by_name.find(key);
+    if (i == data->by_name.end()) {
+        return false;
+    }
+    e = data->entries[i->second];
+    return true;
+}
+
+void TarEntryIndex::clear() {
+    data.reset();
+    complete = false;
+    mapping.reset();
+    mapped_count = 0;
+    records = strings = sorted = nullptr;
+    strings_len = 0;
+    mapped_sections.clear();
+}
+
+bool TarEntryIndex::getSection(uint32_t type, const char*& data, size_t& len) const {
+    for (const TarIndexMappedSection& sec : mapped_sections) {
+        if (sec.type == type) {
+            data = sec.data;
+            len = sec.len;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TarEntryIndex::getMappedString(uint64_t offset, uint32_t len, std::string& str) const {
+    // string references are checked here rather than on load, so opening a large index stays cheap
+    if (offset > strings_len || len > strings_len - offset) {
+        str.clear();
+        return;
+    }
+    str.assign(strings + offset, len);
+}
+
+int TarEntryIndex::compareMappedName(size_t i, const std::string& key) const {
+    if (i >= mapped_count) {
+        return 1;
+    }
+    std::string name;
+    const char* r = records + i * TIDX_RECORD_SIZE;
+    getMappedString(get_u64(r + TIDX_R_NAME), get_u32(r + TIDX_R_NAME_LEN), name);
+#ifdef __APPLE__
+    name = tar_normalize_entry_name(name.c_str());
+#endif
+    return name.compare(key);
+}
+
+void TarEntryIndex::decodeRecord(size_t i, TarIndexEntry& e) const {
+    const char* r = records + i * TIDX_RECORD_SIZE;
+    getMappedString(get_u64(r + TIDX_R_NAME), get_u32(r + TIDX_R_NAME_LEN), e.name);
+    getMappedString(get_u64(r + TIDX_R_UNAME), get_u32(r + TIDX_R_UNAME_LEN), e.uname);
+    getMappedString(get_u64(r + TIDX_R_GNAME), get_u32(r + TIDX_R_GNAME_LEN), e.gname);
+    getMappedString(get_u64(r + TIDX_R_LINK), get_u32(r + TIDX_R_LINK_LEN), e.link_target);
+    e.header_offset = (int64)get_u64(r + TIDX_R_HEADER_OFFSET);
+    e.data_offset = (int64)get_u64(r + TIDX_R_DATA_OFFSET);
+    e.size = (int64)get_u64(r + TIDX_R_SIZE);
+    e.mtime = (int64)get_u64(r + TIDX_R_MTIME);
+    e.atime = (int64)get_u64(r + TIDX_R_ATIME);
+    e.ctime = (int64)get_u64(r + TIDX_R_CTIME);
+    e.uid = (int64)get_u64(r + TIDX_R_UID);
+    e.gid = (int64)get_u64(r + TIDX_R_GID);
+    e.mode = (int)get_u32(r + TIDX_R_MODE);
+    e.filetype = (int)get_u32(r + TIDX_R_FILETYPE);
+    e.devmajor = (int)get_u32(r + TIDX_R_DEVMAJOR);
+    e.devminor = (int)get_u32(r + TIDX_R_DEVMINOR);
+    e.flags = get_u32(r + TIDX_R_FLAGS);
+}
+
+int TarEntryIndex::save(const char* path, const TarIndexFingerprint& fp, unsigned file_flags,
+                        const TarIndexSectionList* extra, ExceptionSink* xsink) const {
+    assert(complete);
+    size_t count = size();
+
+    // a mapped index is decoded so that both kinds of index are written the same way
+    std::vector<TarIndexEntry> decoded;
+    if (mapping) {
+        decoded.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            decodeRecord(i, decoded[i]);
+        }
+    }
+    const std::vector<TarIndexEntry>& src = mapping ? decoded : (data ? data->entries : decoded);
+
+    size_t strings_size = 0;
+    for (const TarIndexEntry& e : src) {
+        strings_size += e.name.size() + e.uname.size() + e.gname.size() + e.link_target.size();
+    }
+
+    std::vector<uint64_t> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    {
+        std::vector<std::string> keys(count);
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = tar_normalize_entry_name(src[i].name.c_str());
+        }
+        std::stable_sort(order.begin(), order.end(), [&keys] (uint64_t a, uint64_t b) {
+            return keys[a] < keys[b];
+        });
+    }
+
+    size_t extra_count = extra ? extra->size() : 0;
+    size_t section_count = 3 + extra_count;
+    size_t records_offset = TIDX_HEADER_SIZE + section_count * TIDX_SECTION_SIZE;
+    size_t strings_offset = records_offset + count * TIDX_RECORD_SIZE;
+    size_t names_offset = align8(strings_offset + strings_size);
+
+    std::vector<char> hdr(TIDX_HEADER_SIZE + section_count * TIDX_SECTION_SIZE);
+    memcpy(hdr.data(), TIDX_MAGIC, sizeof TIDX_MAGIC);
+    put_u32(&hdr[8], TIDX_VERSION);
+    put_u32(&hdr[12], file_flags);
+    put_u64(&hdr[16], fp.size);
+    put_u64(&hdr[24], fp.mtime);
+    put_u64(&hdr[32], fp.mtime_nsec);
+    put_u64(&hdr[40], fp.inode);
+    put_u64(&hdr[48], fp.device);
+    put_u64(&hdr[56], count);
+    put_u32(&hdr[64], section_count);
+    char* sec = &hdr[TIDX_HEADER_SIZE];
+    put_u32(sec, TIDX_SEC_RECORDS);
+    put_u64(sec + 8, records_offset);
+    put_u64(sec + 16, count * TIDX_RECORD_SIZE);
+    sec += TIDX_SECTION_SIZE;
+    put_u32(sec, TIDX_SEC_STRINGS);
+    put_u64(sec + 8, strings_offset);
+    put_u64(sec + 16, strings_size);
+    sec += TIDX_SECTION_SIZE;
+    put_u32(sec, TIDX_SEC_NAMES);
+    put_u64(sec + 8, names_offset);
+    put_u64(sec + 16, count * 8);
+    size_t offset = names_offset + count * 8;
+    for (size_t i = 0; i < extra_count; ++i) {
+        sec += TIDX_SECTION_SIZE;
+        offset = align8(offset);
+        put_u32(sec, (*extra)[i].first);
+        put_u64(sec + 8, offset);
+        put_u64(sec + 16, (*extra)[i].second.size());
+        offset += (*extra)[i].second.size();
+    }
+
+    std::string tmp_path = path;
+    tmp_path += ".tmp.";
+    tmp_path += std::to_string((long long)getpid());
+
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        xsink->raiseException("TAR-ERROR", "failed to create index file '%s': %s", tmp_path.c_str(),
+            strerror(errno));
+        return -1;
+    }
+
+    int rc = write_all(f, hdr.data(), hdr.size());
+
+    char rec[TIDX_RECORD_SIZE];
+    uint64_t str_pos = 0;
+    for (size_t i = 0; !rc && i < count; ++i) {
+        const TarIndexEntry& e = src[i];
+        memset(rec, 0, sizeof rec);
+        put_u64(rec + TIDX_R_HEADER_OFFSET, e.header_offset);
+        put_u64(rec + TIDX_R_DATA_OFFSET, e.data_offset);
+        put_u64(rec + TIDX_R_SIZE, e.size);
+        put_u64(rec + TIDX_R_MTIME, e.mtime);
+        put_u64(rec + TIDX_R_ATIME, e.atime);
+        put_u64(rec + TIDX_R_CTIME, e.ctime);
+        put_u64(rec + TIDX_R_UID, e.uid);
+        put_u64(rec + TIDX_R_GID, e.gid);
+        put_u64(rec + TIDX_R_NAME, str_pos);
+        put_u32(rec + TIDX_R_NAME_LEN, e.name.size());
+        str_pos += e.name.size();
+        put_u64(rec + TIDX_R_UNAME, str_pos);
+        put_u32(rec + TIDX_R_UNAME_LEN, e.uname.size());
+        str_pos += e.uname.size();
+        put_u64(rec + TIDX_R_GNAME, str_pos);
+        put_u32(rec + TIDX_R_GNAME_LEN, e.gname.size());
+        str_pos += e.gname.size();
+        put_u64(rec + TIDX_R_LINK, str_pos);
+        put_u32(rec + TIDX_R_LINK_LEN, e.link_target.size());
+        str_pos += e.link_target.size();
+        put_u32(rec + TIDX_R_MODE, e.mode);
+        put_u32(rec + TIDX_R_FILETYPE, e.filetype);
+        put_u32(rec + TIDX_R_DEVMAJOR, e.devmajor);
+        put_u32(rec + TIDX_R_DEVMINOR, e.devminor);
+        put_u32(rec + TIDX_R_FLAGS, e.flags);
+        rc = write_all(f, rec, sizeof rec);
+    }
+
+    for (size_t i = 0; !rc && i < count; ++i) {
+        const TarIndexEntry& e = src[i];
+        rc = write_all(f, e.name.data(), e.name.size())
+            || write_all(f, e.uname.data(), e.uname.size())
+            || write_all(f, e.gname.data(), e.gname.size())
+            || write_all(f, e.link_target.data(), e.link_target.size()) ? -1 : 0;
+    }
+
+    if (!rc) {
+        static const char pad[8] = {};
+        rc = write_all(f, pad, names_offset - strings_offset - strings_size);
+    }
+
+    for (size_t i = 0; !rc && i < count; ++i) {
+        char num[8];
+        put_u64(num, order[i]);
+        rc = write_all(f, num, sizeof num);
+    }
+
+    offset = names_offset + count * 8;
+    for (size_t i = 0; !rc && i < extra_count; ++i) {
+        static const char pad[8] = {};
+        const std::string& data = (*extra)[i].second;
+        rc = write_all(f, pad, align8(offset) - offset) || write_all(f, data.data(), data.size()) ? -1 : 0;
+        offset = align8(offset) + data.size();
+    }
+
+    if (fclose(f)) {
+        rc = -1;
+    }
+    if (!rc && rename(tmp_path.c_str(), path)) {
+        rc = -1;
+    }
+    if (rc) {
+        int err = errno;
+        unlink(tmp_path.c_str());
+        xsink->raiseException("TAR-ERROR", "failed to write index file '%s': %s", path, strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+bool TarEntryIndex::load(const char* path, const TarIndexFingerprint& fp, unsigned& file_flags) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < TIDX_HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    size_t len = st.st_size;
+    void* addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    std::unique_ptr<TarIndexMapping> map(new TarIndexMapping(addr, len));
+
+    const char* base = static_cast<const char*>(addr);
+    if (memcmp(base, TIDX_MAGIC, sizeof TIDX_MAGIC) || get_u32(base + 8) != TIDX_VERSION) {
+        return false;
+    }
+    TarIndexFingerprint file_fp;
+    file_fp.size = (int64)get_u64(base + 16);
+    file_fp.mtime = (int64)get_u64(base + 24);
+    file_fp.mtime_nsec = (int64)get_u64(base + 32);
+    file_fp.inode = get_u64(base + 40);
+    file_fp.device = get_u64(base + 48);
+    if (!(file_fp == fp)) {
+        return false;
+    }
+    uint64_t count = get_u64(base + 56);
+    uint32_t section_count = get_u32(base + 64);
+    if (count > len / TIDX_RECORD_SIZE || section_count > TIDX_MAX_SECTIONS
+        || len < TIDX_HEADER_SIZE + section_count * TIDX_SECTION_SIZE) {
+        return false;
+    }
+
+    const char* sec_records = nullptr;
+    const char* sec_strings = nullptr;
+    const char* sec_names = nullptr;
+    uint64_t sec_strings_len = 0;
+    std::vector<TarIndexMappedSection> sec_extra;
+    const char* sec = base + TIDX_HEADER_SIZE;
+    for (unsigned i = 0; i < section_count; ++i, sec += TIDX_SECTION_SIZE) {
+        uint64_t offset = get_u64(sec + 8);
+        uint64_t slen = get_u64(sec + 16);
+        if (offset > len || slen > len - offset) {
+            return false;
+        }
+        switch (get_u32(sec)) {
+            case TIDX_SEC_RECORDS:
+                if (slen != count * TIDX_RECORD_SIZE) {
+                    return false;
+                }
+                sec_records = base + offset;
+                break;
+            case TIDX_SEC_STRINGS:
+                sec_strings = base + offset;
+                sec_strings_len = slen;
+                break;
+            case TIDX_SEC_NAMES:
+                if (slen != count * 8) {
+                    return false;
+                }
+                sec_names = base + offset;
+                break;
+            default:
+                sec_extra.push_back({get_u32(sec), base + offset, (size_t)slen});
+                break;
+        }
+    }
+    if (!sec_records || !sec_strings || !sec_names) {
+        return false;
+    }
+
+    clear();
+    mapping = std::move(map);
+    mapped_count = count;
+    records = sec_records;
+    strings = sec_strings;
+    strings_len = sec_strings_len;
+    sorted = sec_names;
+    mapped_sections = std::move(sec_extra);
+    complete = true;
+    file_flags = get_u32(base + 12);
+    return true;
+}
+
+std::string tar_normalize_entry_name(const char* name) {
+#ifdef __APPLE__
+    CFStringRef str = CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+    if (!str) {
+        return name;
+    }
+    CFMutableStringRef mstr = CFStringCreateMutableCopy(kCFAllocatorDefault, 0, str);
+    CFRelease(str);
+    if (!mstr) {
+        return name;
+    }
+    CFStringNormalize(mstr, kCFStringNormalizationFormD);
+
+    CFIndex len = CFStringGetMaximumSizeForEncoding(CFStringGetLength(mstr), kCFStringEncodingUTF8) + 1;
+    std::string rv(len, '\0');
+    if (!CFStringGetCString(mstr, &rv[0], len, kCFStringEncodingUTF8)) {
+        CFRelease(mstr);
+        return name;
+    }
+    CFRelease(mstr);
+    rv.resize(strlen(rv.c_str()));
+    return rv;
+#else
+    return name;
+#endif
+}
@@ -0,0 +1,271 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarEntryIndex.h TarEntryIndex class header */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARENTRYINDEX_H
+#define _QORE_TAR_TARENTRYINDEX_H
+
+#include "tar-module.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+// TarIndexEntry flags
+#define TIE_MTIME_SET           (1 << 0)
+#define TIE_ATIME_SET           (1 << 1)
+#define TIE_CTIME_SET           (1 << 2)
+#define TIE_UNAME_SET           (1 << 3)
+#define TIE_GNAME_SET           (1 << 4)
+#define TIE_SYMLINK_SET         (1 << 5)
+#define TIE_HARDLINK_SET        (1 << 6)
+#define TIE_HARDLINK_NONEMPTY   (1 << 7)
+#define TIE_SPARSE              (1 << 8)
+
+//! Entry types as given in the type key of TarEntryInfo hashes; see tar_entry_type_names
+enum TarEntryType {
+    TET_FILE,
+    TET_DIRECTORY,
+    TET_SYMLINK,
+    TET_HARDLINK,
+    TET_CHARDEV,
+    TET_BLOCKDEV,
+    TET_FIFO,
+    TET_SOCKET,
+    TET_UNKNOWN,
+    TET_NUM_TYPES
+};
+
+//! Names of the entry types, indexed by TarEntryType
+DLLLOCAL extern const char* tar_entry_type_names[TET_NUM_TYPES];
+
+//! Metadata and position of a single archive entry
+struct TarIndexEntry {
+    std::string name;
+    std::string uname;
+    std::string gname;
+    //! Symlink target, or hardlink target if the entry has no symlink target
+    std::string link_target;
+    //! Uncompressed offset of the first header block of the entry (including any extension headers)
+    int64 header_offset = -1;
+    //! Uncompressed offset of the entry data
+    int64 data_offset = -1;
+    int64 size = 0;
+    int64 mtime = 0;
+    int64 atime = 0;
+    int64 ctime = 0;
+    int64 uid = 0;
+    int64 gid = 0;
+    int mode = 0;
+    int filetype = 0;
+    int devmajor = 0;
+    int devminor = 0;
+    //! TIE_* flags
+    unsigned flags = 0;
+
+    //! Returns the type of the entry; hardlinks are reported as such whatever their file type
+    DLLLOCAL TarEntryType getType() const;
+
+    //! Fills in the entry from a libarchive header; offsets are only set if an archive handle is given
+    DLLLOCAL void set(struct archive* a, struct archive_entry* entry);
+};
+
+// Index file flags
+//! The archive is an uncompressed tar archive, so entry offsets are file offsets
+#define TIDX_FLAG_RAW_TAR       (1 << 0)
+//! The archive is a seekable zstd archive, so entry offsets are found with its seek table
+#define TIDX_FLAG_ZSTD_SEEKABLE (1 << 1)
+//! The archive is gzip-compressed; entry offsets are found with the TIDX_SEC_GZIP_CHECKPOINTS section
+#define TIDX_FLAG_GZIP_CHECKPOINTS (1 << 2)
+//! The archive is an xz archive with multiple blocks, so entry offsets are found with its block index
+#define TIDX_FLAG_XZ_BLOCKS     (1 << 3)
+
+// Additional index file section types
+//! Gzip decompression checkpoints
+#define TIDX_SEC_GZIP_CHECKPOINTS   16
+
+//! Additional sections to store in an index file, given as type and data
+typedef std::vector<std::pair<uint32_t, std::string>> TarIndexSectionList;
+
+//! Identifies the state of an archive file that an index file was written for
+struct TarIndexFingerprint {
+    int64 size = 0;
+    int64 mtime = 0;
+    int64 mtime_nsec = 0;
+    uint64_t inode = 0;
+    uint64_t device = 0;
+
+    //! Reads the fingerprint of the given file; returns -1 if the file cannot be accessed
+    DLLLOCAL int get(const char* path);
+
+    DLLLOCAL bool operator==(const TarIndexFingerprint& other) const {
+        return size == other.size && mtime == other.mtime && mtime_nsec == other.mtime_nsec
+            && inode == other.inode && device == other.device;
+    }
+};
+
+//! Entries of a complete index held in memory
+/** Once an index is complete its data is never modified, so it can be shared between indexes and the
+    metadata cache.
+*/
+struct TarIndexData {
+    std::vector<TarIndexEntry> entries;
+    std::unordered_map<std::string, size_t> by_name;
+
+    //! Returns the approximate number of bytes of memory used
+    DLLLOCAL size_t memorySize() const;
+};
+
+class TarIndexMapping;
+
+//! Index of archive entries by name, built while walking the archive headers
+/** Entries are stored in archive order; name lookups return the first entry with a given name, which is
+    the same entry a sequential scan would find.
+
+    An index can also be backed by a memory-mapped index file written with save(); in this case entries are
+    decoded from the mapping on access and name lookups use the sorted name table in the file.
+*/
+class TarEntryIndex {
+public:
+    DLLLOCAL TarEntryIndex();
+
+    DLLLOCAL ~TarEntryIndex();
+
+    //! Adds the next entry in archive order
+    DLLLOCAL void add(TarIndexEntry&& e);
+
+    //! Returns the number of indexed entries
+    DLLLOCAL size_t size() const {
+        return mapping ? mapped_count : (data ? data->entries.size() : 0);
+    }
+
+    //! Returns the entry at the given position in archive order
+    DLLLOCAL void get(size_t i, TarIndexEntry& e) const {
+        if (mapping) {
+            decodeRecord(i, e);
+        } else {
+            e = data->entries[i];
+        }
+    }
+
+    //! Looks up an entry by its normalized name; returns false if not indexed
+    DLLLOCAL bool find(const std::string& key, TarIndexEntry& e) const;
+
+    //! Returns true once all headers in the archive have been indexed
+    DLLLOCAL bool isComplete() const {
+        return complete;
+    }
+
+    //! Marks the index as complete
+    DLLLOCAL void setComplete() {
+        complete = true;
+    }
+
+    //! Discards all indexed entries
+    DLLLOCAL void clear();
+
+    //! Writes the complete index to the given index file
+    /** The file is written under a temporary name and renamed, so readers never see a partial index.
+
+        @param path the index file path
+        @param fp the fingerprint of the archive file
+        @param file_flags TIDX_FLAG_* flags describing the archive
+        @param extra additional sections to store in the file; may be nullptr
+        @param xsink for exceptions
+
+        @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int save(const char* path, const TarIndexFingerprint& fp, unsigned file_flags,
+                      const TarIndexSectionList* extra, ExceptionSink* xsink) const;
+
+    //! Replaces the index with the contents of the given memory-mapped index file
+    /** @param path the index file path
+        @param fp the current fingerprint of the archive file
+        @param file_flags returns the TIDX_FLAG_* flags stored in the file
+
+        @return true if the index was loaded, false if the file does not exist, is invalid, or was written for
+        a different state of the archive
+    */
+    DLLLOCAL bool load(const char* path, const TarIndexFingerprint& fp, unsigned& file_flags);
+
+    //! Returns true if the index is backed by an index file
+    DLLLOCAL bool isMapped() const {
+        return (bool)mapping;
+    }
+
+    //! Returns the entries of a complete index that is held in memory, or nullptr if there are none
+    DLLLOCAL std::shared_ptr<const TarIndexData> getData() const {
+        return complete && !mapping ? data : std::shared_ptr<const TarIndexData>();
+    }
+
+    //! Replaces the index with the given complete entries
+    DLLLOCAL void setData(const std::shared_ptr<const TarIndexData>& d);
+
+    //! Returns an additional section of the mapped index file
+    /** The data remains valid until the index is cleared or destroyed.
+
+        @return true if the section exists
+    */
+    DLLLOCAL bool getSection(uint32_t type, const char*& data, size_t& len) const;
+
+private:
+    // Entries held in memory; shared and read-only once the index is complete
+    std::shared_ptr<const TarIndexData> data;
+    bool complete;
+
+    // Index file mapping and the sections found in it
+    std::unique_ptr<TarIndexMapping> mapping;
+    size_t mapped_count;
+    const char* records;
+    const char* strings;
+    size_t strings_len;
+    const char* sorted;
+    struct TarIndexMappedSection {
+        uint32_t type;
+        const char* data;
+        size_t len;
+    };
+    std::vector<TarIndexMappedSection> mapped_sections;
+
+    //! Decodes a record from the mapped index file
+    DLLLOCAL void decodeRecord(size_t i, TarIndexEntry& e) const;
+
+    //! Returns a string from the mapped string table
+    DLLLOCAL void getMappedString(uint64_t offset, uint32_t len, std::string& str) const;
+
+    //! Compares the name of a mapped record with the given key
+    DLLLOCAL int compareMappedName(size_t i, const std::string& key) const;
+};
+
+//! Returns the form of an entry name used for comparisons and index lookups
+/** On macOS, libarchive returns pathnames in NFD (decomposed) form, so names are normalized to NFD there;
+    on other platforms the name is returned unchanged.
+*/
+DLLLOCAL std::string tar_normalize_entry_name(const char* name);
+
+#endif // _QORE_TAR_TARENTRYINDEX_H
@@ -0,0 +1,84 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarEntryIterator.cpp TarEntryIterator class implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarEntryIterator.h"
+#include "QoreTarFile.h"
+#include "QC_TarInputStream.h"
+
+bool TarEntryIterator::next(ExceptionSink* xsink) {
+    entry = nullptr;
+    if (done || (query.limit >= 0 && returned == query.limit)) {
+        done = true;
+        return false;
+    }
+    // streams opened for the previous entry cannot be read any longer
+    ++cursor->position;
+
+    struct archive_entry* e;
+    int r;
+    while ((r = archive_read_next_header(cursor->archive, &e)) == ARCHIVE_OK) {
+        current.set(nullptr, e);
+        if (!query.match(current)) {
+            continue;
+        }
+        if (skipped < query.offset) {
+            ++skipped;
+            continue;
+        }
+        ++returned;
+        entry = e;
+        return true;
+    }
+
+    done = true;
+    if (r != ARCHIVE_OK && r != ARCHIVE_EOF) {
+        xsink->raiseException("TAR-ERROR", "failed to read archive: %s", get_archive_error(cursor->archive));
+    }
+    return false;
+}
+
+QoreHashNode* TarEntryIterator::getValue(ExceptionSink* xsink) const {
+    if (checkValid(xsink)) {
+        return nullptr;
+    }
+    return QoreTarFile::createEntryInfo(current, xsink);
+}
+
+QoreObject* TarEntryIterator::getInputStream(ExceptionSink* xsink) {
+    if (checkValid(xsink)) {
+        return nullptr;
+    }
+    return new QoreObject(QC_TARINPUTSTREAM, getProgram(), new TarInputStream(cursor, entry, xsink));
+}
+
+int TarEntryIterator::checkValid(ExceptionSink* xsink) const {
+    if (!entry) {
+        xsink->raiseException("INVALID-ITERATOR", "the iterator is not pointing at a valid element; make sure "
+            "TarEntryIterator::next() returns True before calling this method");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarEntryIterator.h TarEntryIterator class header */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARENTRYITERATOR_H
+#define _QORE_TAR_TARENTRYITERATOR_H
+
+#include "tar-module.h"
+#include "TarEntryIndex.h"
+#include "TarEntryQuery.h"
+#include "TarInputStream.h"
+
+#include <memory>
+
+//! Iterates the entries of an archive one header at a time
+/** The iterator reads the archive with its own libarchive handle, so it does not move the read cursor of the
+    TarFile it was created from, and it does not add entries to the entry index; only the current entry is
+    held in memory.
+*/
+class TarEntryIterator : public AbstractPrivateData {
+public:
+    //! Creates the iterator; takes ownership of the cursor
+    DLLLOCAL TarEntryIterator(TarReadCursor* cursor) : cursor(cursor) {
+    }
+
+    //! Returns the query used to filter entries
+    DLLLOCAL TarEntryQuery& getQuery() {
+        return query;
+    }
+
+    //! Moves to the next matching entry
+    /** @return true if there is a current entry, false at the end of the archive or if an exception was raised
+    */
+    DLLLOCAL bool next(ExceptionSink* xsink);
+
+    //! Returns true if the iterator is positioned on an entry
+    DLLLOCAL bool valid() const {
+        return (bool)entry;
+    }
+
+    //! Returns a TarEntryInfo hash for the current entry
+    DLLLOCAL QoreHashNode* getValue(ExceptionSink* xsink) const;
+
+    //! Returns a TarInputStream object for the data of the current entry
+    /** The stream can only be read until the iterator moves to another entry.
+    */
+    DLLLOCAL QoreObject* getInputStream(ExceptionSink* xsink);
+
+private:
+    std::shared_ptr<TarReadCursor> cursor;
+    TarEntryQuery query;
+    // Current entry, nullptr if not positioned on an entry
+    struct archive_entry* entry = nullptr;
+    TarIndexEntry current;
+    // Number of matching entries skipped and returned
+    int64 skipped = 0;
+    int64 returned = 0;
+    bool done = false;
+
+    //! Raises an exception if the iterator is not positioned on an entry
+    DLLLOCAL int checkValid(ExceptionSink* xsink) const;
+};
+
+#endif // _QORE_TAR_TARENTRYITERATOR_H
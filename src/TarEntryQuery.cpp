@@ -0,0 +1,161 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarEntryQuery.cpp entry query class implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarEntryQuery.h"
+
+#include <cstring>
+#include <fnmatch.h>
+
+TarEntryQuery::~TarEntryQuery() {
+    if (has_regex) {
+        regfree(&re);
+    }
+}
+
+int TarEntryQuery::parse(const QoreHashNode* query, ExceptionSink* xsink) {
+    if (!query) {
+        return 0;
+    }
+
+    bool case_insensitive = false;
+    QoreValue v = query->getKeyValue("case_insensitive");
+    if (!v.isNothing()) {
+        case_insensitive = v.getAsBool();
+    }
+
+    v = query->getKeyValue("glob");
+    if (v.getType() == NT_STRING) {
+        glob = v.get<const QoreStringNode>()->c_str();
+        has_glob = true;
+        if (case_insensitive) {
+#ifdef FNM_CASEFOLD
+            fnmatch_flags |= FNM_CASEFOLD;
+#else
+            xsink->raiseException("TAR-ERROR", "case-insensitive glob patterns are not supported on this platform");
+            return -1;
+#endif
+        }
+    }
+
+    v = query->getKeyValue("regex");
+    if (v.getType() == NT_STRING) {
+        const char* pattern = v.get<const QoreStringNode>()->c_str();
+        int rc = regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB | (case_insensitive ? REG_ICASE : 0));
+        if (rc) {
+            char buf[256];
+            regerror(rc, &re, buf, sizeof(buf));
+            xsink->raiseException("TAR-ERROR", "invalid regular expression '%s': %s", pattern, buf);
+            return -1;
+        }
+        has_regex = true;
+    }
+
+    v = query->getKeyValue("types");
+    if (v.getType() == NT_LIST) {
+        const QoreListNode* types = v.get<const QoreListNode>();
+        for (size_t i = 0, n = types->size(); i < n; ++i) {
+            const char* name = types->retrieveEntry(i).get<const QoreStringNode>()->c_str();
+            int type = 0;
+            while (type < TET_NUM_TYPES && strcmp(name, tar_entry_type_names[type])) {
+                ++type;
+            }
+            if (type == TET_NUM_TYPES) {
+                xsink->raiseException("TAR-ERROR", "invalid entry type '%s' in query; expecting one of \"file\", "
+                    "\"directory\", \"symlink\", \"hardlink\", \"chardev\", \"blockdev\", \"fifo\", \"socket\" "
+                    "or \"unknown\"", name);
+                return -1;
+            }
+            type_mask |= (1 << type);
+        }
+    }
+
+    v = query->getKeyValue("min_size");
+    if (!v.isNothing()) {
+        min_size = v.getAsBigInt();
+    }
+    v = query->getKeyValue("max_size");
+    if (!v.isNothing()) {
+        max_size = v.getAsBigInt();
+        if (max_size < 0) {
+            xsink->raiseException("TAR-ERROR", "invalid max_size " QLLD " in query; must not be negative",
+                max_size);
+            return -1;
+        }
+    }
+
+    v = query->getKeyValue("min_modified");
+    if (v.getType() == NT_DATE) {
+        min_mtime = v.get<const DateTimeNode>()->getEpochSecondsUTC();
+        has_min_mtime = true;
+    }
+    v = query->getKeyValue("max_modified");
+    if (v.getType() == NT_DATE) {
+        max_mtime = v.get<const DateTimeNode>()->getEpochSecondsUTC();
+        has_max_mtime = true;
+    }
+
+    v = query->getKeyValue("offset");
+    if (!v.isNothing()) {
+        offset = v.getAsBigInt();
+        if (offset < 0) {
+            xsink->raiseException("TAR-ERROR", "invalid offset " QLLD " in query; must not be negative", offset);
+            return -1;
+        }
+    }
+    v = query->getKeyValue("limit");
+    if (!v.isNothing()) {
+        limit = v.getAsBigInt();
+        if (limit < 0) {
+            xsink->raiseException("TAR-ERROR", "invalid limit " QLLD " in query; must not be negative", limit);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+bool TarEntryQuery::match(const TarIndexEntry& e) const {
+    if (type_mask && !(type_mask & (1 << e.getType()))) {
+        return false;
+    }
+    if ((min_size >= 0 && e.size < min_size) || (max_size >= 0 && e.size > max_size)) {
+        return false;
+    }
+    if (has_min_mtime || has_max_mtime) {
+        // entries without a modification time do not match a time range
+        if (!(e.flags & TIE_MTIME_SET) || (has_min_mtime && e.mtime < min_mtime)
+            || (has_max_mtime && e.mtime > max_mtime)) {
+            return false;
+        }
+    }
+    if (has_glob && fnmatch(glob.c_str(), e.name.c_str(), fnmatch_flags)) {
+        return false;
+    }
+    if (has_regex && regexec(&re, e.name.c_str(), 0, nullptr, 0)) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarEntryQuery.h entry query class header */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARENTRYQUERY_H
+#define _QORE_TAR_TARENTRYQUERY_H
+
+#include "TarEntryIndex.h"
+
+#include <regex.h>
+#include <string>
+
+//! Entry filter given by a TarQuery hash
+/** Conditions are checked in order of cost: type, size and modification time first, then the name
+    patterns, so that the name is only matched for entries passing the cheaper checks.
+*/
+class TarEntryQuery {
+public:
+    //! Number of matching entries to skip
+    int64 offset = 0;
+    //! Maximum number of entries to return, -1 for no limit
+    int64 limit = -1;
+
+    DLLLOCAL TarEntryQuery() {
+    }
+
+    DLLLOCAL ~TarEntryQuery();
+
+    //! Parses a TarQuery hash
+    /** @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int parse(const QoreHashNode* query, ExceptionSink* xsink);
+
+    //! Returns true if the entry matches all conditions of the query
+    DLLLOCAL bool match(const TarIndexEntry& e) const;
+
+private:
+    std::string glob;
+    bool has_glob = false;
+    regex_t re;
+    bool has_regex = false;
+    int fnmatch_flags = 0;
+    //! Bitmask of TarEntryType values to match; 0 matches all types
+    unsigned type_mask = 0;
+    int64 min_size = -1;
+    int64 max_size = -1;
+    bool has_min_mtime = false;
+    bool has_max_mtime = false;
+    int64 min_mtime = 0;
+    int64 max_mtime = 0;
+
+    DLLLOCAL TarEntryQuery(const TarEntryQuery&) = delete;
+    DLLLOCAL TarEntryQuery& operator=(const TarEntryQuery&) = delete;
+};
+
+#endif // _QORE_TAR_TARENTRYQUERY_H
@@ -0,0 +1,604 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarHeaderScanner.cpp native tar header scanner implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarHeaderScanner.h"
+
+#include <cstring>
+
+//! Size of a tar header block
+#define TAR_BLOCK_SIZE              512
+//! Maximum size of a pax extended header or GNU long name; libarchive rejects larger long names
+#define TAR_MAX_EXTENSION_SIZE      (1024 * 1024)
+//! Maximum entry size accepted by the scanner, so that offsets cannot overflow
+#define TAR_MAX_SCAN_ENTRY_SIZE     ((int64)1 << 56)
+
+namespace {
+// header block field offsets
+enum {
+    TH_NAME = 0,
+    TH_MODE = 100,
+    TH_UID = 108,
+    TH_GID = 116,
+    TH_SIZE = 124,
+    TH_MTIME = 136,
+    TH_CHKSUM = 148,
+    TH_TYPEFLAG = 156,
+    TH_LINKNAME = 157,
+    TH_MAGIC = 257,
+    TH_UNAME = 265,
+    TH_GNAME = 297,
+    TH_DEVMAJOR = 329,
+    TH_DEVMINOR = 337,
+    TH_PREFIX = 345,
+    // GNU header fields
+    TH_GNU_ATIME = 345,
+    TH_GNU_CTIME = 357,
+    TH_GNU_SPARSE = 386,
+    TH_GNU_ISEXTENDED = 482,
+    TH_GNU_REALSIZE = 483,
+};
+
+// pax attributes that apply to the next entry
+enum {
+    PAX_PATH = (1 << 0),
+    PAX_LINKPATH = (1 << 1),
+    PAX_SIZE = (1 << 2),
+    PAX_UID = (1 << 3),
+    PAX_GID = (1 << 4),
+    PAX_UNAME = (1 << 5),
+    PAX_GNAME = (1 << 6),
+    PAX_MTIME = (1 << 7),
+    PAX_ATIME = (1 << 8),
+    PAX_CTIME = (1 << 9),
+};
+
+struct TarPaxAttributes {
+    std::string path;
+    std::string linkpath;
+    std::string uname;
+    std::string gname;
+    int64 size = 0;
+    int64 uid = 0;
+    int64 gid = 0;
+    int64 mtime = 0;
+    int64 atime = 0;
+    int64 ctime = 0;
+    // PAX_* flags
+    unsigned set = 0;
+};
+
+// Returns the length of a string field that is not necessarily null-terminated
+size_t field_len(const unsigned char* p, size_t len) {
+    const void* end = memchr(p, 0, len);
+    return end ? static_cast<const unsigned char*>(end) - p : len;
+}
+
+void get_field(const unsigned char* p, size_t len, std::string& str) {
+    str.assign(reinterpret_cast<const char*>(p), field_len(p, len));
+}
+
+// Parses a numeric header field in octal or GNU base-256 form; returns false if the value is out of range
+bool parse_number(const unsigned char* p, size_t len, int64& val) {
+    if (*p & 0x80) {
+        // a big-endian two's complement value in the bits following the marker bit
+        uint64_t v = (*p & 0x40) ? (~(uint64_t)0 << 7) | (*p & 0x7f) : (*p & 0x7f);
+        for (size_t i = 1; i < len; ++i) {
+            uint64_t top = v >> 55;
+            if (top && top != 0x1ff) {
+                return false;
+            }
+            v = (v << 8) | p[i];
+        }
+        val = (int64)v;
+        return true;
+    }
+
+    size_t i = 0;
+    while (i < len && (p[i] == ' ' || p[i] == '\t')) {
+        ++i;
+    }
+    bool neg = i < len && p[i] == '-';
+    if (neg) {
+        ++i;
+    }
+    uint64_t v = 0;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i) {
+        if (v >> 60) {
+            return false;
+        }
+        v = (v << 3) | (p[i] - '0');
+    }
+    val = neg ? -(int64)v : (int64)v;
+    return true;
+}
+
+// Parses a decimal pax value; returns false if the value is not a valid number
+bool parse_decimal(const char* p, size_t len, int64& val) {
+    bool neg = len && *p == '-';
+    if (neg) {
+        ++p;
+        --len;
+    }
+    if (!len) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] < '0' || p[i] > '9' || v > (uint64_t)0x7fffffffffffffffLL / 10) {
+            return false;
+        }
+        v = v * 10 + (p[i] - '0');
+    }
+    val = neg ? -(int64)v : (int64)v;
+    return true;
+}
+
+// Parses a pax time value, keeping only the seconds
+bool parse_time(const char* p, size_t len, int64& val) {
+    // libarchive does not accept negative times here
+    if (len && *p == '-') {
+        return false;
+    }
+    const char* dot = static_cast<const char*>(memchr(p, '.', len));
+    if (!dot) {
+        return parse_decimal(p, len, val);
+    }
+    for (const char* f = dot + 1; f < p + len; ++f) {
+        if (*f < '0' || *f > '9') {
+            return false;
+        }
+    }
+    return parse_decimal(p, dot - p, val);
+}
+
+bool is_ascii(const char* p, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] & 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if the header block consists of zero bytes only
+bool is_zero_block(const unsigned char* h) {
+    unsigned char acc = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        acc |= h[i];
+    }
+    return !acc;
+}
+
+// Verifies the header checksum
+/** The byte sums are accumulated in a single branch-free pass over the block that the compiler vectorizes;
+    both the standard unsigned sum and the signed sum written by some old implementations are accepted.
+*/
+bool check_checksum(const unsigned char* h) {
+    for (size_t i = TH_CHKSUM; i < TH_CHKSUM + 8; ++i) {
+        if (h[i] != ' ' && h[i] && (h[i] < '0' || h[i] > '7')) {
+            return false;
+        }
+    }
+    int64 stored;
+    if (!parse_number(h + TH_CHKSUM, 8, stored)) {
+        return false;
+    }
+
+    uint32_t usum = 0;
+    int32_t ssum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        usum += h[i];
+        ssum += (signed char)h[i];
+    }
+    // the checksum field itself is summed as spaces
+    for (size_t i = TH_CHKSUM; i < TH_CHKSUM + 8; ++i) {
+        usum += ' ' - h[i];
+        ssum += ' ' - (signed char)h[i];
+    }
+    return stored == (int64)usum || stored == (int64)ssum;
+}
+
+// Parses the records of a pax extended header; returns false if the header is invalid or uses attributes
+// that cannot be handled here
+bool parse_pax(const std::string& data, TarPaxAttributes& pax) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+        // records have the form "<length> <key>=<value>\n", where the length includes the whole record
+        if (!*p) {
+            // some writers pad the header with null bytes
+            break;
+        }
+        size_t len = 0;
+        const char* q = p;
+        for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+            len = len * 10 + (*q - '0');
+            if (len > data.size()) {
+                return false;
+            }
+        }
+        if (q == p || q == end || *q != ' ' || len > (size_t)(end - p) || p[len - 1] != '\n') {
+            return false;
+        }
+        const char* key = q + 1;
+        const char* rec_end = p + len - 1;
+        const char* eq = static_cast<const char*>(memchr(key, '=', rec_end - key));
+        if (!eq) {
+            return false;
+        }
+        std::string k(key, eq - key);
+        const char* val = eq + 1;
+        size_t val_len = rec_end - val;
+        p += len;
+
+        if (k == "path") {
+            if (!is_ascii(val, val_len)) {
+                return false;
+            }
+            pax.path.assign(val, val_len);
+            pax.set |= PAX_PATH;
+        } else if (k == "linkpath") {
+            if (!is_ascii(val, val_len)) {
+                return false;
+            }
+            pax.linkpath.assign(val, val_len);
+            pax.set |= PAX_LINKPATH;
+        } else if (k == "uname") {
+            if (!is_ascii(val, val_len)) {
+                return false;
+            }
+            pax.uname.assign(val, val_len);
+            pax.set |= PAX_UNAME;
+        } else if (k == "gname") {
+            if (!is_ascii(val, val_len)) {
+                return false;
+            }
+            pax.gname.assign(val, val_len);
+            pax.set |= PAX_GNAME;
+        } else if (k == "size") {
+            if (!parse_decimal(val, val_len, pax.size) || pax.size < 0 || pax.size > TAR_MAX_SCAN_ENTRY_SIZE) {
+                return false;
+            }
+            pax.set |= PAX_SIZE;
+        } else if (k == "uid") {
+            if (!parse_decimal(val, val_len, pax.uid)) {
+                return false;
+            }
+            pax.set |= PAX_UID;
+        } else if (k == "gid") {
+            if (!parse_decimal(val, val_len, pax.gid)) {
+                return false;
+            }
+            pax.set |= PAX_GID;
+        } else if (k == "mtime") {
+            if (!parse_time(val, val_len, pax.mtime)) {
+                return false;
+            }
+            pax.set |= PAX_MTIME;
+        } else if (k == "atime") {
+            if (!parse_time(val, val_len, pax.atime)) {
+                return false;
+            }
+            pax.set |= PAX_ATIME;
+        } else if (k == "ctime") {
+            if (!parse_time(val, val_len, pax.ctime)) {
+                return false;
+            }
+            pax.set |= PAX_CTIME;
+        } else if (k == "hdrcharset" || !k.compare(0, 4, "GNU.") || !k.compare(0, 4, "SUN.")
+            || k == "SCHILY.realsize" || k == "SCHILY.devmajor" || k == "SCHILY.devminor") {
+            // binary strings, sparse files and large device numbers
+            return false;
+        }
+        // other attributes do not affect the indexed entry data
+    }
+    return true;
+}
+
+class TarHeaderScanner {
+public:
+    DLLLOCAL TarHeaderScanner(const TarRawSeekSource& src) : src(src) {
+    }
+
+    DLLLOCAL int scan(std::vector<TarIndexEntry>& entries, int64& end);
+
+private:
+    const TarRawSeekSource& src;
+
+    //! Reads the data of an extension header
+    DLLLOCAL int readExtension(int64 offset, int64 size, std::string& data) {
+        if (size > TAR_MAX_EXTENSION_SIZE) {
+            return -1;
+        }
+        data.resize(size);
+        return src.readAt(offset, &data[0], size) == (la_ssize_t)size ? 0 : -1;
+    }
+
+    //! Checks that the end of the archive was reached at the given offset and not after it
+    DLLLOCAL int checkEnd(int64 offset) {
+        unsigned char c;
+        return !offset || src.readAt(offset - 1, &c, 1) == 1 ? 0 : -1;
+    }
+};
+
+int TarHeaderScanner::scan(std::vector<TarIndexEntry>& entries, int64& end) {
+    unsigned char h[TAR_BLOCK_SIZE];
+    std::string ext;
+    int64 pos = 0;
+
+    while (true) {
+        // extension headers and the header they apply to are read as one entry starting at header_offset
+        TarIndexEntry e;
+        e.header_offset = pos;
+        TarPaxAttributes pax;
+        bool have_pax = false, have_longname = false, have_longlink = false;
+        std::string longname, longlink;
+
+        char type;
+        int64 size;
+        while (true) {
+            la_ssize_t rc = src.readAt(pos, h, TAR_BLOCK_SIZE);
+            if (!rc && pos == e.header_offset) {
+                // the end-of-archive blocks are missing, which libarchive accepts at a block boundary
+                end = pos;
+                return checkEnd(pos);
+            }
+            if (rc != TAR_BLOCK_SIZE) {
+                return -1;
+            }
+            if (!h[0] && is_zero_block(h)) {
+                end = pos;
+                return pos == e.header_offset ? 0 : -1;
+            }
+            if (!check_checksum(h) || !parse_number(h + TH_SIZE, 12, size) || size < 0
+                || size > TAR_MAX_SCAN_ENTRY_SIZE) {
+                return -1;
+            }
+
+            type = (char)h[TH_TYPEFLAG];
+            pos += TAR_BLOCK_SIZE;
+            if (type != 'x' && type != 'g' && type != 'L' && type != 'K') {
+                break;
+            }
+
+            int64 padded = (size + TAR_BLOCK_SIZE - 1) & ~(int64)(TAR_BLOCK_SIZE - 1);
+            switch (type) {
+                case 'x':
+                    if (have_pax || readExtension(pos, size, ext) || !parse_pax(ext, pax)) {
+                        return -1;
+                    }
+                    have_pax = true;
+                    break;
+                case 'L':
+                    if (have_longname || readExtension(pos, size, ext)) {
+                        return -1;
+                    }
+                    longname.assign(ext.c_str());
+                    have_longname = true;
+                    break;
+                case 'K':
+                    if (have_longlink || readExtension(pos, size, ext)) {
+                        return -1;
+                    }
+                    longlink.assign(ext.c_str());
+                    have_longlink = true;
+                    break;
+                default:
+                    // global pax headers are ignored by libarchive
+                    break;
+            }
+            pos += padded;
+        }
+        e.data_offset = pos;
+
+        // the precedence of pax attributes and GNU long names differs between libarchive versions
+        if ((have_longname && (pax.set & PAX_PATH)) || (have_longlink && (pax.set & PAX_LINKPATH))) {
+            return -1;
+        }
+
+        bool ustar = !memcmp(h + TH_MAGIC, "ustar", 5);
+        bool gnu = !memcmp(h + TH_MAGIC, "ustar  \0", 8);
+        if (gnu) {
+            // sparse files and GNU size overrides
+            if (h[TH_GNU_SPARSE] || h[TH_GNU_ISEXTENDED] || h[TH_GNU_REALSIZE]) {
+                return -1;
+            }
+        }
+
+        int64 mode, uid, gid, mtime;
+        if (!parse_number(h + TH_MODE, 8, mode) || !parse_number(h + TH_UID, 8, uid)
+            || !parse_number(h + TH_GID, 8, gid) || !parse_number(h + TH_MTIME, 12, mtime)) {
+            return -1;
+        }
+
+        if (pax.set & PAX_PATH) {
+            e.name = pax.path;
+        } else if (have_longname) {
+            e.name = longname;
+        } else if (ustar && !gnu && h[TH_PREFIX]) {
+            get_field(h + TH_PREFIX, 155, e.name);
+            if (e.name.back() != '/') {
+                e.name += '/';
+            }
+            e.name.append(reinterpret_cast<const char*>(h + TH_NAME), field_len(h + TH_NAME, 100));
+        } else {
+            get_field(h + TH_NAME, 100, e.name);
+        }
+
+        std::string linkname;
+        if (pax.set & PAX_LINKPATH) {
+            linkname = pax.linkpath;
+        } else if (have_longlink) {
+            linkname = longlink;
+        } else {
+            get_field(h + TH_LINKNAME, 100, linkname);
+        }
+
+        if (pax.set & PAX_SIZE) {
+            size = pax.size;
+        }
+
+        e.size = size;
+        e.mode = (int)(mode_t)mode;
+        e.uid = (pax.set & PAX_UID) ? pax.uid : uid;
+        e.gid = (pax.set & PAX_GID) ? pax.gid : gid;
+        e.mtime = (pax.set & PAX_MTIME) ? pax.mtime : mtime;
+        e.flags = TIE_MTIME_SET;
+
+        int filetype;
+        switch (type) {
+            case '0':
+            case '\0':
+            case '7':
+                // old archives mark directories with a trailing slash, which libarchive also accepts here
+                if (!e.name.empty() && e.name.back() == '/') {
+                    return -1;
+                }
+                filetype = AE_IFREG;
+                break;
+            case '1':
+                // hardlinks with data are detected heuristically by libarchive
+                if (size) {
+                    return -1;
+                }
+                // the type of a hardlink is not stored, so any type bits in the mode are kept
+                filetype = e.mode & AE_IFMT;
+                e.link_target = linkname;
+                e.flags |= TIE_HARDLINK_SET;
+                if (!linkname.empty()) {
+                    e.flags |= TIE_HARDLINK_NONEMPTY;
+                }
+                break;
+            case '2':
+                filetype = AE_IFLNK;
+                e.link_target = linkname;
+                e.flags |= TIE_SYMLINK_SET;
+                break;
+            case '3':
+                filetype = AE_IFCHR;
+                break;
+            case '4':
+                filetype = AE_IFBLK;
+                break;
+            case '5':
+                filetype = AE_IFDIR;
+                break;
+            case '6':
+                filetype = AE_IFIFO;
+                break;
+            default:
+                // sparse files, multi-volume archives, GNU incremental dumps and vendor extensions
+                return -1;
+        }
+        // libarchive ignores the size of other entry types, so any data stored for them would be misread
+        if ((size && filetype != AE_IFREG && type != '1')
+            // link targets of other entry types are interpreted differently by libarchive versions
+            || (!linkname.empty() && type != '1' && type != '2')) {
+            return -1;
+        }
+        if (filetype == AE_IFCHR || filetype == AE_IFBLK) {
+            // device numbers are only stored in ustar and GNU headers
+            int64 devmajor, devminor;
+            if (!ustar || !parse_number(h + TH_DEVMAJOR, 8, devmajor)
+                || !parse_number(h + TH_DEVMINOR, 8, devminor)) {
+                return -1;
+            }
+            e.devmajor = (int)devmajor;
+            e.devminor = (int)devminor;
+        }
+        if (type != '1') {
+            e.mode = (e.mode & ~AE_IFMT) | filetype;
+        }
+        e.filetype = filetype;
+
+        if (ustar) {
+            if (pax.set & PAX_UNAME) {
+                e.uname = pax.uname;
+            } else {
+                get_field(h + TH_UNAME, 32, e.uname);
+            }
+            if (pax.set & PAX_GNAME) {
+                e.gname = pax.gname;
+            } else {
+                get_field(h + TH_GNAME, 32, e.gname);
+            }
+            e.flags |= TIE_UNAME_SET | TIE_GNAME_SET;
+        } else {
+            if (pax.set & PAX_UNAME) {
+                e.uname = pax.uname;
+                e.flags |= TIE_UNAME_SET;
+            }
+            if (pax.set & PAX_GNAME) {
+                e.gname = pax.gname;
+                e.flags |= TIE_GNAME_SET;
+            }
+        }
+
+        if (gnu) {
+            // GNU atime and ctime fields are only used if set
+            int64 atime, ctime;
+            if (!parse_number(h + TH_GNU_ATIME, 12, atime) || !parse_number(h + TH_GNU_CTIME, 12, ctime)) {
+                return -1;
+            }
+            if (atime > 0) {
+                e.atime = atime;
+                e.flags |= TIE_ATIME_SET;
+            }
+            if (ctime > 0) {
+                e.ctime = ctime;
+                e.flags |= TIE_CTIME_SET;
+            }
+        }
+        if (pax.set & PAX_ATIME) {
+            e.atime = pax.atime;
+            e.flags |= TIE_ATIME_SET;
+        }
+        if (pax.set & PAX_CTIME) {
+            e.ctime = pax.ctime;
+            e.flags |= TIE_CTIME_SET;
+        }
+
+        if (filetype == AE_IFREG) {
+            pos += (size + TAR_BLOCK_SIZE - 1) & ~(int64)(TAR_BLOCK_SIZE - 1);
+        }
+        entries.push_back(std::move(e));
+    }
+}
+}
+
+int tar_scan_headers(const TarRawSeekSource& src, std::vector<TarIndexEntry>& entries, int64* end) {
+    TarHeaderScanner scanner(src);
+    std::vector<TarIndexEntry> result;
+    int64 end_offset;
+    if (scanner.scan(result, end_offset)) {
+        return -1;
+    }
+    entries.swap(result);
+    if (end) {
+        *end = end_offset;
+    }
+    return 0;
+}
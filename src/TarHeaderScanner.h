@@ -0,0 +1,55 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarHeaderScanner.h native tar header scanner */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARHEADERSCANNER_H
+#define _QORE_TAR_TARHEADERSCANNER_H
+
+#include "TarEntryIndex.h"
+#include "TarSeekSource.h"
+
+#include <vector>
+
+//! Reads all entry headers of an uncompressed tar archive without libarchive
+/** Only the header blocks are read; entry data is skipped using the size in each header, so listing an
+    archive costs about one 512-byte read per entry.  The entries are filled in the same way as
+    TarIndexEntry::set() fills them from libarchive.
+
+    ustar, GNU and v7 headers are supported, with pax extended headers and GNU long names and link names.
+    Archives using anything else (sparse files, multi-volume archives, GNU incremental dumps, pax attributes
+    that change how an entry is read, non-ASCII pax strings) or having damaged headers are rejected, and the
+    caller reads them with libarchive instead.
+
+    @param src the archive
+    @param entries returns the entries in archive order
+    @param end if given, returns the offset of the end-of-archive blocks, or of the end of the data if they are
+    missing; new entries can be written at this offset
+
+    @return 0 if all headers were read up to the end of the archive, -1 if the archive cannot be handled here
+*/
+DLLLOCAL int tar_scan_headers(const TarRawSeekSource& src, std::vector<TarIndexEntry>& entries,
+                              int64* end = nullptr);
+
+#endif // _QORE_TAR_TARHEADERSCANNER_H
@@ -26,11 +26,40 @@
 
 #include "TarInputStream.h"
 
+TarReadCursor::TarReadCursor(struct archive* a, AbstractPrivateData* owner) : archive(a), owner(owner) {
+    if (owner) {
+        owner->ref();
+    }
+}
+
+TarReadCursor::~TarReadCursor() {
+    archive_read_close(archive);
+    archive_read_free(archive);
+    if (owner) {
+        ExceptionSink xsink;
+        owner->deref(&xsink);
+    }
+}
+
 TarInputStream::TarInputStream(struct archive* a, struct archive_entry* entry, ExceptionSink* xsink)
-    : archive(a), entry(entry), bytes_read(0), closed(false), peek_byte(-1), has_peek(false) {
+    : archive(a), entry(entry), bytes_read(0), closed(false), peek_byte(-1), has_peek(false), cursor_pos(0) {
+    entry_size = archive_entry_size(entry);
+}
+
+TarInputStream::TarInputStream(const std::shared_ptr<TarReadCursor>& cursor, struct archive_entry* entry,
+        ExceptionSink* xsink) : archive(cursor->archive), entry(entry), bytes_read(0), closed(false), peek_byte(-1),
+        has_peek(false), cursor(cursor), cursor_pos(cursor->position) {
     entry_size = archive_entry_size(entry);
 }
 
+int TarInputStream::checkCursor(ExceptionSink* xsink) const {
+    if (cursor && cursor->position != cursor_pos) {
+        xsink->raiseException("TAR-READ-ERROR", "the entry iterator has moved past the entry of this stream");
+        return -1;
+    }
+    return 0;
+}
+
 TarInputStream::~TarInputStream() {
     closed = true;
 }
@@ -44,6 +73,9 @@ int64 TarInputStream::read(void* ptr, int64 limit, ExceptionSink* xsink) {
     if (bytes_read >= entry_size) {
         return 0;  // EOF
     }
+    if (checkCursor(xsink)) {
+        return -1;
+    }
 
     char* buf = static_cast<char*>(ptr);
     int64 total_read = 0;
@@ -84,6 +116,9 @@ int64 TarInputStream::peek(ExceptionSink* xsink) {
     if (bytes_read >= entry_size) {
         return -1;  // EOF
     }
+    if (checkCursor(xsink)) {
+        return -1;
+    }
 
     unsigned char buf;
     la_ssize_t r = archive_read_data(archive, &buf, 1);
@@ -102,7 +137,7 @@ int64 TarInputStream::peek(ExceptionSink* xsink) {
 }
 
 QoreHashNode* TarInputStream::getEntryInfo(ExceptionSink* xsink) {
-    if (!entry) {
+    if (!entry || checkCursor(xsink)) {
         return nullptr;
     }
 
@@ -29,10 +29,35 @@
 
 #include "tar-module.h"
 
+#include <memory>
+
+//! A libarchive read handle shared by an entry iterator and the input streams opened for its entries
+/** The position is incremented whenever the handle moves to another entry, so that streams opened for an
+    earlier entry can detect that its data is no longer available.
+*/
+class TarReadCursor {
+public:
+    struct archive* archive;
+    int64 position = 0;
+
+    //! Takes ownership of the handle; \a owner, if given, holds the data read and is referenced until the
+    //! cursor is destroyed
+    DLLLOCAL TarReadCursor(struct archive* a, AbstractPrivateData* owner);
+
+    DLLLOCAL ~TarReadCursor();
+
+private:
+    AbstractPrivateData* owner;
+};
+
 //! TarInputStream - InputStream implementation for reading tar entries
 class TarInputStream : public InputStream {
 public:
     DLLLOCAL TarInputStream(struct archive* a, struct archive_entry* entry, ExceptionSink* xsink);
+
+    //! Creates a stream for the current entry of a shared read handle; the stream ends when the handle moves on
+    DLLLOCAL TarInputStream(const std::shared_ptr<TarReadCursor>& cursor, struct archive_entry* entry,
+                            ExceptionSink* xsink);
     DLLLOCAL virtual ~TarInputStream();
 
     DLLLOCAL virtual const char* getName() override { return "TarInputStream"; }
@@ -50,6 +75,12 @@ private:
     bool closed;
     int peek_byte;
     bool has_peek;
+    // Shared read handle and its position when the stream was opened, if opened from a cursor
+    std::shared_ptr<TarReadCursor> cursor;
+    int64 cursor_pos;
+
+    //! Raises an exception if the shared read handle has moved past the entry
+    DLLLOCAL int checkCursor(ExceptionSink* xsink) const;
 };
 
 #endif // _QORE_TAR_TARINPUTSTREAM_H
@@ -0,0 +1,118 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarMetadataCache.cpp process-wide cache of archive entry indexes */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarMetadataCache.h"
+
+TarMetadataCache tar_metadata_cache;
+
+bool TarMetadataCache::lookup(const std::string& path, const TarIndexFingerprint& fp, TarCachedIndex& rv) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!budget) {
+        return false;
+    }
+    entry_map_t::iterator i = by_path.find(path);
+    if (i == by_path.end()) {
+        ++misses;
+        return false;
+    }
+    if (!(i->second->fp == fp)) {
+        // the archive has been changed or replaced since its index was stored
+        remove(i);
+        ++misses;
+        return false;
+    }
+    lru.splice(lru.begin(), lru, i->second);
+    rv = i->second->idx;
+    ++hits;
+    return true;
+}
+
+void TarMetadataCache::store(const std::string& path, const TarIndexFingerprint& fp, TarCachedIndex&& idx) {
+    size_t size = sizeof(TarCacheEntry) + 2 * path.size() + idx.checkpoints.size() + idx.data->memorySize();
+
+    std::lock_guard<std::mutex> guard(lock);
+    entry_map_t::iterator i = by_path.find(path);
+    if (i != by_path.end()) {
+        remove(i);
+    }
+    if ((int64)size > budget) {
+        return;
+    }
+
+    lru.push_front(TarCacheEntry());
+    TarCacheEntry& e = lru.front();
+    e.path = path;
+    e.fp = fp;
+    e.idx = std::move(idx);
+    e.size = size;
+    by_path[path] = lru.begin();
+    used += size;
+    trim();
+}
+
+void TarMetadataCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> guard(lock);
+    entry_map_t::iterator i = by_path.find(path);
+    if (i != by_path.end()) {
+        remove(i);
+    }
+}
+
+void TarMetadataCache::setBudget(int64 bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    budget = bytes;
+    trim();
+}
+
+void TarMetadataCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    by_path.clear();
+    lru.clear();
+    used = 0;
+}
+
+void TarMetadataCache::getStats(TarMetadataCacheStats& stats) const {
+    std::lock_guard<std::mutex> guard(lock);
+    stats.budget = budget;
+    stats.size = used;
+    stats.archives = lru.size();
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+}
+
+void TarMetadataCache::remove(entry_map_t::iterator i) {
+    used -= i->second->size;
+    lru.erase(i->second);
+    by_path.erase(i);
+}
+
+void TarMetadataCache::trim() {
+    while (used > budget) {
+        remove(by_path.find(lru.back().path));
+        ++evictions;
+    }
+}
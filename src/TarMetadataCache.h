@@ -0,0 +1,129 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarMetadataCache.h process-wide cache of archive entry indexes */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARMETADATACACHE_H
+#define _QORE_TAR_TARMETADATACACHE_H
+
+#include "TarEntryIndex.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//! Default memory budget of the metadata cache
+#define TAR_METADATA_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+//! The complete index of an archive file together with what is needed to use its entry offsets
+struct TarCachedIndex {
+    std::shared_ptr<const TarIndexData> data;
+    //! TIDX_FLAG_* flags giving the type of the seek source
+    unsigned seek_flags = 0;
+    //! Serialized gzip checkpoints if seek_flags has TIDX_FLAG_GZIP_CHECKPOINTS
+    std::string checkpoints;
+};
+
+//! Metadata cache statistics
+struct TarMetadataCacheStats {
+    int64 budget = 0;
+    int64 size = 0;
+    int64 archives = 0;
+    int64 hits = 0;
+    int64 misses = 0;
+    int64 evictions = 0;
+};
+
+//! Process-wide LRU cache of complete entry indexes of archive files
+/** Indexes are stored under the archive path together with the fingerprint of the archive file when the
+    index was built; a lookup only succeeds if the file still has the same device, inode, size and
+    modification time, and stale indexes are dropped when they are found.
+
+    Indexes are shared with the TarFile objects using them and are never modified, so the cache only holds
+    its lock while looking up and storing them.
+*/
+class TarMetadataCache {
+public:
+    DLLLOCAL TarMetadataCache() : budget(TAR_METADATA_CACHE_DEFAULT_BUDGET), used(0), hits(0), misses(0),
+            evictions(0) {
+    }
+
+    //! Looks up the index of the given archive file
+    /** @return true if a matching index was found
+    */
+    DLLLOCAL bool lookup(const std::string& path, const TarIndexFingerprint& fp, TarCachedIndex& rv);
+
+    //! Stores the index of the given archive file, evicting the least recently used indexes as needed
+    /** Indexes larger than the budget are not stored.
+    */
+    DLLLOCAL void store(const std::string& path, const TarIndexFingerprint& fp, TarCachedIndex&& idx);
+
+    //! Removes the index of the given archive file, if any
+    /** Called when an archive file is written, since a rewritten archive may have the same fingerprint if the
+        file system has a coarse timestamp resolution.
+    */
+    DLLLOCAL void invalidate(const std::string& path);
+
+    //! Sets the memory budget in bytes; 0 disables the cache
+    DLLLOCAL void setBudget(int64 bytes);
+
+    //! Removes all indexes from the cache; statistics are kept
+    DLLLOCAL void clear();
+
+    //! Returns the current statistics
+    DLLLOCAL void getStats(TarMetadataCacheStats& stats) const;
+
+private:
+    struct TarCacheEntry {
+        std::string path;
+        TarIndexFingerprint fp;
+        TarCachedIndex idx;
+        size_t size;
+    };
+    typedef std::list<TarCacheEntry> entry_list_t;
+    typedef std::unordered_map<std::string, entry_list_t::iterator> entry_map_t;
+
+    mutable std::mutex lock;
+    // Entries in order of use, most recently used first
+    entry_list_t lru;
+    entry_map_t by_path;
+    int64 budget;
+    int64 used;
+    int64 hits;
+    int64 misses;
+    int64 evictions;
+
+    //! Removes the given entry; must be called with the lock held
+    DLLLOCAL void remove(entry_map_t::iterator i);
+
+    //! Evicts the least recently used entries until the cache fits the budget; must be called with the lock held
+    DLLLOCAL void trim();
+};
+
+//! The metadata cache shared by all TarFile objects
+DLLLOCAL extern TarMetadataCache tar_metadata_cache;
+
+#endif // _QORE_TAR_TARMETADATACACHE_H
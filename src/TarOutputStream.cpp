@@ -25,18 +25,43 @@
 */
 
 #include "TarOutputStream.h"
+#include "QoreTarFile.h"
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <unistd.h>
 
-TarOutputStream::TarOutputStream(struct archive* a, const char* entry_name, int mode, ExceptionSink* xsink)
-    : archive(a), entry_name(entry_name), mode(mode), closed(false), header_written(false) {
+TarOutputStream::TarOutputStream(QoreTarFile* owner, struct archive_entry* entry, int64 size, int64 spill_threshold)
+    : owner(owner), entry(entry), entry_name(archive_entry_pathname(entry)), size(size),
+      spill_threshold(spill_threshold), total(0), spill_file(nullptr), closed(false), header_written(false) {
+    owner->ref();
 }
 
 TarOutputStream::~TarOutputStream() {
+    ExceptionSink xsink;
     if (!closed) {
-        ExceptionSink xsink;
         close(&xsink);
     }
+    if (spill_file) {
+        fclose(spill_file);
+    }
+    archive_entry_free(entry);
+    owner->deref(&xsink);
+}
+
+int TarOutputStream::start(ExceptionSink* xsink) {
+    if (size < 0) {
+        return 0;
+    }
+    archive_entry_set_size(entry, size);
+    // nothing else can be written to the archive until the entry is complete
+    if (owner->startStreamEntry(entry, xsink)) {
+        closed = true;
+        return -1;
+    }
+    header_written = true;
+    return 0;
 }
 
 void TarOutputStream::write(const void* ptr, int64 count, ExceptionSink* xsink) {
@@ -49,10 +74,33 @@ void TarOutputStream::write(const void* ptr, int64 count, ExceptionSink* xsink)
         return;
     }
 
-    // Buffer the data - we need to know total size before writing header
-    size_t old_size = buffer.size();
-    buffer.resize(old_size + count);
-    memcpy(buffer.data() + old_size, ptr, count);
+    // entries of known size are written directly
+    if (size >= 0) {
+        if (count > size - total) {
+            xsink->raiseException("TAR-WRITE-ERROR", "cannot write " QLLD " bytes to entry '%s'; only " QLLD
+                " of the declared size of " QLLD " bytes remain", count, entry_name.c_str(), size - total, size);
+            return;
+        }
+        if (!owner->writeStreamData(ptr, count, xsink)) {
+            total += count;
+        }
+        return;
+    }
+
+    // otherwise the data is buffered until the size is known
+    if (!spill_file && (int64)buffer.size() + count > spill_threshold && spill(xsink)) {
+        return;
+    }
+    if (spill_file) {
+        if (fwrite(ptr, 1, count, spill_file) != (size_t)count) {
+            xsink->raiseException("TAR-WRITE-ERROR", "failed to write to temporary file: %s", strerror(errno));
+            return;
+        }
+    } else {
+        const char* p = static_cast<const char*>(ptr);
+        buffer.insert(buffer.end(), p, p + count);
+    }
+    total += count;
 }
 
 void TarOutputStream::close(ExceptionSink* xsink) {
@@ -62,35 +110,57 @@ void TarOutputStream::close(ExceptionSink* xsink) {
 
     closed = true;
 
-    // Now write the entry with full data
-    struct archive_entry* entry = archive_entry_new();
-    if (!entry) {
-        xsink->raiseException("TAR-ERROR", "failed to create archive entry");
+    if (header_written) {
+        if (owner->finishStreamEntry()) {
+            xsink->raiseException("TAR-ERROR", "the archive was closed before entry '%s' was complete",
+                entry_name.c_str());
+        } else if (total < size) {
+            // libarchive pads the entry with zeros, so the archive stays readable
+            xsink->raiseException("TAR-ERROR", "entry '%s' is incomplete; only " QLLD " of the declared size of "
+                QLLD " bytes were written", entry_name.c_str(), total, size);
+        }
         return;
     }
 
-    archive_entry_set_pathname(entry, entry_name.c_str());
-    archive_entry_set_size(entry, buffer.size());
-    archive_entry_set_filetype(entry, AE_IFREG);
-    archive_entry_set_perm(entry, mode);
-    archive_entry_set_mtime(entry, time(nullptr), 0);
+    writeBuffered(xsink);
+}
 
-    int r = archive_write_header(archive, entry);
-    if (r != ARCHIVE_OK) {
-        xsink->raiseException("TAR-ERROR", "failed to write entry header: %s",
-                              get_archive_error(archive));
-        archive_entry_free(entry);
-        return;
+int TarOutputStream::spill(ExceptionSink* xsink) {
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/qore-tar-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        xsink->raiseException("TAR-WRITE-ERROR", "failed to create temporary file: %s", strerror(errno));
+        return -1;
     }
+    // the file is removed when it is closed
+    unlink(path.c_str());
+    spill_file = fdopen(fd, "w+b");
+    if (!spill_file) {
+        xsink->raiseException("TAR-WRITE-ERROR", "failed to open temporary file: %s", strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+    if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), spill_file) != buffer.size()) {
+        xsink->raiseException("TAR-WRITE-ERROR", "failed to write to temporary file: %s", strerror(errno));
+        return -1;
+    }
+    std::vector<char>().swap(buffer);
+    return 0;
+}
 
-    if (!buffer.empty()) {
-        la_ssize_t written = archive_write_data(archive, buffer.data(), buffer.size());
-        if (written < 0 || (size_t)written != buffer.size()) {
-            xsink->raiseException("TAR-ERROR", "failed to write entry data: %s",
-                                  get_archive_error(archive));
-        }
+void TarOutputStream::writeBuffered(ExceptionSink* xsink) {
+    archive_entry_set_size(entry, total);
+    if (spill_file && (fflush(spill_file) || fseek(spill_file, 0, SEEK_SET))) {
+        xsink->raiseException("TAR-ERROR", "failed to read temporary file: %s", strerror(errno));
+    } else {
+        // the header and the data are written in one call, so other entries cannot be written in between
+        owner->writeStreamEntry(entry, buffer, spill_file, xsink);
     }
 
-    archive_entry_free(entry);
-    buffer.clear();
+    std::vector<char>().swap(buffer);
+    if (spill_file) {
+        fclose(spill_file);
+        spill_file = nullptr;
+    }
 }
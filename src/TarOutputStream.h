@@ -28,27 +28,67 @@
 #define _QORE_TAR_TAROUTPUTSTREAM_H
 
 #include "tar-module.h"
+#include <cstdio>
 #include <vector>
 #include <string>
 
+//! Default number of bytes of an entry of unknown size buffered in memory before it is spilled to a temporary file
+#define TAR_STREAM_SPILL_THRESHOLD (1024 * 1024)
+
+class QoreTarFile;
+
 //! TarOutputStream - OutputStream implementation for writing tar entries
+/** If the entry size is declared when the stream is opened, the header is written immediately and data is
+    written straight to the archive; the archive cannot be written otherwise until the stream is closed.
+
+    Otherwise data is buffered until close(), since the header needs the size; once the buffered data exceeds
+    the spill threshold, it is moved to an anonymous temporary file, so memory use stays bounded.
+
+    The archive is only written with the QoreTarFile methods for output streams, which hold the archive's lock, so
+    a stream can be written and closed in another thread than the one using the archive.
+*/
 class TarOutputStream : public OutputStream {
 public:
-    DLLLOCAL TarOutputStream(struct archive* a, const char* entry_name, int mode, ExceptionSink* xsink);
+    //! Creates the stream; takes ownership of the entry and references the archive until the stream is destroyed
+    /** @param owner the archive being written
+        @param entry the entry, with all metadata except the size set
+        @param size the declared size of the entry, or -1 if unknown
+        @param spill_threshold the maximum number of bytes buffered in memory if the size is unknown
+    */
+    DLLLOCAL TarOutputStream(QoreTarFile* owner, struct archive_entry* entry, int64 size, int64 spill_threshold);
     DLLLOCAL virtual ~TarOutputStream();
 
+    //! Writes the entry header if the size was declared; must be called once after the stream is created
+    /** @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int start(ExceptionSink* xsink);
+
     DLLLOCAL virtual const char* getName() override { return "TarOutputStream"; }
     DLLLOCAL virtual bool isClosed() override { return closed; }
     DLLLOCAL virtual void close(ExceptionSink* xsink) override;
     DLLLOCAL virtual void write(const void* ptr, int64 count, ExceptionSink* xsink) override;
 
 private:
-    struct archive* archive;
+    QoreTarFile* owner;
+    struct archive_entry* entry;
     std::string entry_name;
-    int mode;
-    std::vector<char> buffer;  // Buffer data until close
+    //! Declared size, -1 if unknown
+    int64 size;
+    int64 spill_threshold;
+    //! Bytes written to the stream so far
+    int64 total;
+    //! Data of an entry of unknown size buffered until close
+    std::vector<char> buffer;
+    //! Temporary file holding the data once it has exceeded the spill threshold
+    FILE* spill_file;
     bool closed;
     bool header_written;
+
+    //! Moves the buffered data to a new temporary file
+    DLLLOCAL int spill(ExceptionSink* xsink);
+
+    //! Writes the header and the data of an entry of unknown size
+    DLLLOCAL void writeBuffered(ExceptionSink* xsink);
 };
 
 #endif // _QORE_TAR_TAROUTPUTSTREAM_H
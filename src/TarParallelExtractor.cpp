@@ -0,0 +1,267 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarParallelExtractor.cpp multi-threaded extraction to disk */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarParallelExtractor.h"
+
+#include <functional>
+#include <system_error>
+
+TarParallelExtractor::Job::~Job() {
+    if (entry) {
+        archive_entry_free(entry);
+    }
+}
+
+TarParallelExtractor::TarParallelExtractor(int flags, unsigned threads) : flags(flags) {
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back(new Worker);
+    }
+}
+
+TarParallelExtractor::~TarParallelExtractor() {
+    join();
+    // closing the disk handles sets the metadata of the directories written so far
+    for (std::unique_ptr<Worker>& w : workers) {
+        if (w->disk) {
+            archive_write_free(w->disk);
+        }
+    }
+    if (disk) {
+        archive_write_free(disk);
+    }
+}
+
+struct archive* TarParallelExtractor::newDisk() {
+    struct archive* a = archive_write_disk_new();
+    if (!a) {
+        return nullptr;
+    }
+    archive_write_disk_set_options(a, flags);
+    archive_write_disk_set_standard_lookup(a);
+    return a;
+}
+
+int TarParallelExtractor::start() {
+    // disk handles are created here, as archive_write_disk_new() changes the process umask temporarily
+    disk = newDisk();
+    if (!disk) {
+        error = "failed to create disk writer";
+        return -1;
+    }
+    for (std::unique_ptr<Worker>& w : workers) {
+        w->disk = newDisk();
+        if (!w->disk) {
+            error = "failed to create disk writer";
+            return -1;
+        }
+    }
+    for (std::unique_ptr<Worker>& w : workers) {
+        Worker* wp = w.get();
+        try {
+            w->thread = std::thread([this, wp] () { run(*wp); });
+        } catch (std::system_error& e) {
+            error = std::string("failed to start extraction thread: ") + e.what();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int TarParallelExtractor::add(struct archive* src, struct archive_entry* entry, const char* name) {
+    const char* hardlink = archive_entry_hardlink(entry);
+    bool is_hardlink = hardlink && *hardlink;
+
+    const void* buf;
+    size_t size;
+    la_int64_t offset;
+    int rc;
+
+    // symlinks and hardlinks are written here once all earlier entries have been written, so hardlinks are
+    // created to the target as it is at this point of the archive
+    if (is_hardlink || archive_entry_filetype(entry) == AE_IFLNK) {
+        if (drain()) {
+            return -1;
+        }
+        if (archive_write_header(disk, entry) != ARCHIVE_OK) {
+            setError(std::string("failed to extract '") + name + "': " + get_archive_error(disk));
+            return -1;
+        }
+        if (archive_entry_size(entry) > 0) {
+            while ((rc = archive_read_data_block(src, &buf, &size, &offset)) == ARCHIVE_OK) {
+                if (archive_write_data_block(disk, buf, size, offset) != ARCHIVE_OK) {
+                    setError(std::string("failed to write data for '") + name + "': "
+                        + get_archive_error(disk));
+                    return -1;
+                }
+            }
+        }
+        archive_write_finish_entry(disk);
+        return 0;
+    }
+
+    Worker& w = *workers[std::hash<std::string>()(archive_entry_pathname(entry)) % workers.size()];
+    Job header(Job::HEADER);
+    header.entry = archive_entry_clone(entry);
+    header.name = name;
+    if (queue(w, std::move(header))) {
+        return -1;
+    }
+
+    if (archive_entry_size(entry) > 0) {
+        // the data is copied, as libarchive reuses its buffer for the next block
+        while ((rc = archive_read_data_block(src, &buf, &size, &offset)) == ARCHIVE_OK) {
+            Job data(Job::DATA);
+            data.data.assign(static_cast<const char*>(buf), static_cast<const char*>(buf) + size);
+            data.offset = offset;
+            if (queue(w, std::move(data))) {
+                return -1;
+            }
+        }
+        if (rc != ARCHIVE_EOF) {
+            setError(std::string("failed to read data for '") + name + "': " + get_archive_error(src));
+            return -1;
+        }
+    }
+
+    return queue(w, Job(Job::END));
+}
+
+int TarParallelExtractor::finish() {
+    int rc = drain();
+    join();
+
+    // directory metadata is set when the disk handles are closed
+    for (std::unique_ptr<Worker>& w : workers) {
+        archive_write_close(w->disk);
+    }
+    archive_write_close(disk);
+    return rc;
+}
+
+void TarParallelExtractor::run(Worker& w) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        while (w.queue.empty() && !stop) {
+            w.cond.wait(guard);
+        }
+        if (w.queue.empty()) {
+            return;
+        }
+        Job job(std::move(w.queue.front()));
+        w.queue.pop_front();
+
+        // after an error, queued jobs are discarded
+        if (!failed) {
+            guard.unlock();
+            std::string err;
+            int rc = process(w, job, err);
+            guard.lock();
+            if (rc && !failed) {
+                failed = true;
+                error = err;
+            }
+        }
+        queued -= job.data.size();
+        --pending;
+        done_cond.notify_all();
+    }
+}
+
+int TarParallelExtractor::process(Worker& w, Job& job, std::string& err) {
+    switch (job.type) {
+        case Job::HEADER:
+            w.name = job.name;
+            if (archive_write_header(w.disk, job.entry) != ARCHIVE_OK) {
+                err = "failed to extract '" + w.name + "': " + get_archive_error(w.disk);
+                return -1;
+            }
+            // the disk writer clears the size of entries whose data is not written, such as existing files
+            // that are not overwritten
+            w.skip_data = archive_entry_size(job.entry) <= 0;
+            break;
+
+        case Job::DATA:
+            if (!w.skip_data
+                && archive_write_data_block(w.disk, job.data.data(), job.data.size(), job.offset) != ARCHIVE_OK) {
+                err = "failed to write data for '" + w.name + "': " + get_archive_error(w.disk);
+                return -1;
+            }
+            break;
+
+        case Job::END:
+            archive_write_finish_entry(w.disk);
+            break;
+    }
+    return 0;
+}
+
+int TarParallelExtractor::queue(Worker& w, Job&& job) {
+    std::unique_lock<std::mutex> guard(lock);
+    size_t len = job.data.size();
+    // the amount of queued data is limited, but a single block is always accepted
+    while (!failed && queued && queued + len > TAR_EXTRACT_MAX_QUEUED) {
+        done_cond.wait(guard);
+    }
+    if (failed) {
+        return -1;
+    }
+    queued += len;
+    ++pending;
+    w.queue.push_back(std::move(job));
+    w.cond.notify_one();
+    return 0;
+}
+
+int TarParallelExtractor::drain() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (pending) {
+        done_cond.wait(guard);
+    }
+    return failed ? -1 : 0;
+}
+
+void TarParallelExtractor::setError(const std::string& err) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!failed) {
+        failed = true;
+        error = err;
+    }
+}
+
+void TarParallelExtractor::join() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        for (std::unique_ptr<Worker>& w : workers) {
+            w->cond.notify_one();
+        }
+    }
+    for (std::unique_ptr<Worker>& w : workers) {
+        if (w->thread.joinable()) {
+            w->thread.join();
+        }
+    }
+}
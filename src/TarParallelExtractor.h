@@ -0,0 +1,168 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarParallelExtractor.h multi-threaded extraction to disk */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARPARALLELEXTRACTOR_H
+#define _QORE_TAR_TARPARALLELEXTRACTOR_H
+
+#include "tar-module.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Maximum amount of entry data queued for the writer threads during a parallel extraction
+#define TAR_EXTRACT_MAX_QUEUED (64 * 1024 * 1024)
+
+//! Writes the entries of an archive to disk with a pool of writer threads
+/** The archive is read on the caller's thread, which passes each entry to add().  Entry data is copied into
+    buffers and queued for the writer threads; each thread writes with its own archive_write_disk handle, so
+    file creation, data writes and metadata updates of different files run in parallel.
+
+    Entries are assigned to the writer threads by path, so entries with the same path are written by the same
+    thread in archive order.  Symlinks and hardlinks are created by the caller's thread once all earlier entries
+    have been written, so no entry is written through a symlink that it would not have been written through by a
+    sequential extraction, and hardlinks refer to the target as extracted up to that point.  Directory
+    permissions and times are set when the disk handles are closed at the end, after all entries have been
+    written into the directories.
+*/
+class TarParallelExtractor {
+public:
+    //! Creates the extractor
+    /** @param flags ARCHIVE_EXTRACT_* flags for the disk handles
+        @param threads the number of writer threads
+    */
+    DLLLOCAL TarParallelExtractor(int flags, unsigned threads);
+
+    //! Stops and joins the writer threads if finish() has not been called
+    DLLLOCAL ~TarParallelExtractor();
+
+    //! Starts the writer threads
+    /** @return 0 for OK, -1 for error, in which case getError() returns the error message
+    */
+    DLLLOCAL int start();
+
+    //! Extracts an entry whose path has already been set to the destination path
+    /** The entry data is read from \a src.
+
+        @param src the archive being read, positioned at the data of the entry
+        @param entry the entry; it is copied, so it can be reused by the caller afterwards
+        @param name the name of the entry in the archive for error messages
+
+        @return 0 for OK, -1 for error, in which case getError() returns the error message
+    */
+    DLLLOCAL int add(struct archive* src, struct archive_entry* entry, const char* name);
+
+    //! Waits until all entries have been written and closes the disk handles
+    /** @return 0 for OK, -1 for error, in which case getError() returns the error message
+    */
+    DLLLOCAL int finish();
+
+    //! Returns the first error message
+    DLLLOCAL const std::string& getError() const {
+        return error;
+    }
+
+private:
+    //! Work item of a writer thread: an entry header, a block of entry data or the end of an entry
+    struct Job {
+        enum Type {
+            HEADER,
+            DATA,
+            END,
+        } type;
+        // for HEADER: the entry to write
+        struct archive_entry* entry = nullptr;
+        // for HEADER: the name of the entry in the archive
+        std::string name;
+        // for DATA: the data and its offset in the entry
+        std::vector<char> data;
+        int64 offset = 0;
+
+        DLLLOCAL Job(Type type) : type(type) {
+        }
+
+        DLLLOCAL Job(Job&& old) : type(old.type), entry(old.entry), name(std::move(old.name)),
+                data(std::move(old.data)), offset(old.offset) {
+            old.entry = nullptr;
+        }
+
+        DLLLOCAL ~Job();
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::deque<Job> queue;
+        std::condition_variable cond;
+        struct archive* disk = nullptr;
+        // name of the entry being written, for error messages
+        std::string name;
+        // true if the data of the entry being written is discarded
+        bool skip_data = false;
+    };
+
+    int flags;
+    std::vector<std::unique_ptr<Worker>> workers;
+    // disk handle for symlinks and hardlinks, written by the caller's thread
+    struct archive* disk = nullptr;
+
+    std::mutex lock;
+    // signaled when queued data has been written or a worker has become idle
+    std::condition_variable done_cond;
+    // amount of entry data queued
+    size_t queued = 0;
+    // number of jobs queued or being processed
+    size_t pending = 0;
+    bool stop = false;
+    bool failed = false;
+    std::string error;
+
+    //! Runs a writer thread
+    DLLLOCAL void run(Worker& w);
+
+    //! Writes a job to the worker's disk handle; returns -1 and sets \a err on failure
+    DLLLOCAL int process(Worker& w, Job& job, std::string& err);
+
+    //! Queues a job for the given worker; returns -1 if a writer has failed
+    DLLLOCAL int queue(Worker& w, Job&& job);
+
+    //! Waits until all queued jobs have been processed; returns -1 if a writer has failed
+    DLLLOCAL int drain();
+
+    //! Records the first error
+    DLLLOCAL void setError(const std::string& err);
+
+    //! Stops and joins the writer threads
+    DLLLOCAL void join();
+
+    //! Creates a disk handle with the extraction flags
+    DLLLOCAL struct archive* newDisk();
+};
+
+#endif // _QORE_TAR_TARPARALLELEXTRACTOR_H
@@ -0,0 +1,702 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarParallelReader.cpp multi-threaded decompression of archives being read */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarParallelReader.h"
+#include "TarCompressionSink.h"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+
+// bzip2 block and end-of-stream magic numbers; both are 48 bits and need not be byte-aligned
+#define TAR_BZIP2_BLOCK_MAGIC 0x314159265359ull
+#define TAR_BZIP2_EOS_MAGIC   0x177245385090ull
+// number of times a bzip2 block is retried with the data up to the following magic number
+#define TAR_BZIP2_MAX_RETRIES 3
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+bool tar_is_gzip_header(const unsigned char* p, size_t avail) {
+    // the magic number, deflate compression, no reserved flags, valid extra flags and a known operating system
+    return avail >= 10 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && !(p[3] & 0xe0)
+        && (!p[8] || p[8] == 2 || p[8] == 4) && (p[9] <= 13 || p[9] == 255);
+}
+#endif
+
+namespace {
+
+#ifdef HAVE_BZIP2
+// For each byte value: bit o is set if the byte can be the first whole byte of a block magic number starting o
+// bits before it, and bit 8 + o for an end-of-stream magic number
+struct TarBzip2MarkerTable {
+    uint16_t bits[256];
+
+    TarBzip2MarkerTable() {
+        memset(bits, 0, sizeof bits);
+        for (unsigned o = 0; o < 8; ++o) {
+            bits[(TAR_BZIP2_BLOCK_MAGIC >> (40 - o)) & 0xff] |= 1 << o;
+            bits[(TAR_BZIP2_EOS_MAGIC >> (40 - o)) & 0xff] |= 1 << (8 + o);
+        }
+    }
+};
+
+const TarBzip2MarkerTable bzip2_markers;
+
+// Appends bits to a buffer, most significant bit first
+class TarBitWriter {
+public:
+    TarBitWriter(std::string& buf) : buf(buf) {
+    }
+
+    void put(uint64_t value, unsigned count) {
+        acc = (acc << count) | value;
+        bits += count;
+        while (bits >= 8) {
+            bits -= 8;
+            buf.push_back((char)(acc >> bits));
+        }
+        acc &= (1ull << bits) - 1;
+    }
+
+    //! Pads the last byte with zero bits
+    void flush() {
+        if (bits) {
+            put(0, 8 - bits);
+        }
+    }
+
+private:
+    std::string& buf;
+    uint64_t acc = 0;
+    unsigned bits = 0;
+};
+#endif
+
+// Returns the libarchive filter code for the compression of the data, or -1 if it cannot be read in parallel
+int get_parallel_filter(const unsigned char* p, size_t len) {
+#ifdef HAVE_ZLIB
+    if (tar_is_gzip_header(p, len)) {
+        return ARCHIVE_FILTER_GZIP;
+    }
+#endif
+#ifdef HAVE_BZIP2
+    if (len >= 4 && !memcmp(p, "BZh", 3) && p[3] >= '1' && p[3] <= '9') {
+        return ARCHIVE_FILTER_BZIP2;
+    }
+#endif
+#ifdef HAVE_LZMA
+    if (len >= 6 && !memcmp(p, "\xfd" "7zXZ\0", 6)) {
+        return ARCHIVE_FILTER_XZ;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (len >= 4 && !memcmp(p, "\x28\xb5\x2f\xfd", 4)) {
+        return ARCHIVE_FILTER_ZSTD;
+    }
+#endif
+    return -1;
+}
+}
+
+TarParallelReader::~TarParallelReader() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    work_cond.notify_all();
+    space_cond.notify_all();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+TarParallelReader* TarParallelReader::create(const char* data, size_t len, unsigned threads) {
+    int filter = get_parallel_filter(reinterpret_cast<const unsigned char*>(data), len);
+    if (filter < 0) {
+        return nullptr;
+    }
+    std::unique_ptr<TarParallelReader> reader(new TarParallelReader(data, len, filter));
+#ifdef HAVE_LZMA
+    // xz data can only be split with the block index of a single stream with several blocks
+    if (filter == ARCHIVE_FILTER_XZ) {
+        reader->xz.reset(TarXzSeekSource::open(data, len));
+        if (!reader->xz) {
+            return nullptr;
+        }
+    }
+#endif
+    if (reader->start(threads)) {
+        return nullptr;
+    }
+    return reader.release();
+}
+
+int TarParallelReader::start(unsigned count) {
+    // two units per thread keep all threads busy while completed units are read
+    max_units = count * 2;
+    for (unsigned i = 0; i < count; ++i) {
+        try {
+            threads.emplace_back([this] () { run(); });
+        } catch (std::system_error&) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void TarParallelReader::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        while (work.empty() && !stop) {
+            work_cond.wait(guard);
+        }
+        if (stop) {
+            return;
+        }
+        std::shared_ptr<Unit> unit = work.front();
+        work.pop_front();
+
+        if (!unit->cancelled) {
+            guard.unlock();
+            decompress(*unit);
+            guard.lock();
+        }
+        unit->done = true;
+        data_cond.notify_one();
+    }
+}
+
+la_ssize_t TarParallelReader::read(const void** buf) {
+    while (true) {
+        if (finished) {
+            return 0;
+        }
+        schedule();
+        if (!current) {
+            if (units.empty()) {
+                finished = true;
+                return 0;
+            }
+            current = std::move(units.front());
+            units.pop_front();
+            // units starting before the end of the previous one were found at a gzip header or bzip2 magic number
+            // appearing by chance in compressed data
+            if (current->start < expected) {
+                cancel(*current);
+                current.reset();
+                continue;
+            }
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        while (current->chunks.empty() && !current->done) {
+            data_cond.wait(guard);
+        }
+        if (!current->chunks.empty()) {
+            buffer = std::move(current->chunks.front());
+            current->chunks.pop_front();
+            current->buffered -= buffer.size();
+            guard.unlock();
+            space_cond.notify_all();
+            *buf = buffer.data();
+            return (la_ssize_t)buffer.size();
+        }
+        if (!current->err.empty()) {
+            err = current->err;
+            return -1;
+        }
+        expected = current->stop;
+        finished = current->last;
+        current.reset();
+    }
+}
+
+void TarParallelReader::schedule() {
+    while (!scan_done && units.size() < max_units) {
+        // gzip headers are only searched for a limited distance ahead of the data being read, as archives with a
+        // single member have none
+        if (filter == ARCHIVE_FILTER_GZIP && (current || !units.empty())
+            && scan_pos >= (current ? current->start : expected) + (int64)max_units * TAR_PARALLEL_READ_UNIT_SIZE) {
+            return;
+        }
+        std::shared_ptr<Unit> unit = findUnit();
+        if (!unit) {
+            scan_done = true;
+            return;
+        }
+        units.push_back(unit);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            work.push_back(unit);
+        }
+        work_cond.notify_one();
+    }
+}
+
+std::shared_ptr<TarParallelReader::Unit> TarParallelReader::findUnit() {
+    switch (filter) {
+#ifdef HAVE_ZLIB
+        case ARCHIVE_FILTER_GZIP:
+            // each unit starts at the first gzip header in a range of TAR_PARALLEL_READ_UNIT_SIZE bytes
+            while (scan_pos < (int64)len) {
+                int64 end = std::min(scan_pos + TAR_PARALLEL_READ_UNIT_SIZE, (int64)len);
+                int64 start = findGzipHeader(scan_pos, end);
+                scan_pos = end;
+                if (start >= 0) {
+                    return std::make_shared<Unit>(start, end);
+                }
+            }
+            break;
+#endif
+#ifdef HAVE_BZIP2
+        case ARCHIVE_FILTER_BZIP2: {
+            // end-of-stream magic numbers are followed by the stream CRC and possibly another stream
+            bool eos;
+            int64 start = findBzip2Marker(scan_pos, &eos);
+            while (start >= 0 && eos) {
+                start = findBzip2Marker(start + 48, &eos);
+            }
+            if (start < 0) {
+                break;
+            }
+            int64 end = findBzip2Marker(start + 48, nullptr);
+            scan_pos = end < 0 ? (int64)len * 8 : end;
+            return std::make_shared<Unit>(start, scan_pos);
+        }
+#endif
+#ifdef HAVE_LZMA
+        case ARCHIVE_FILTER_XZ: {
+            if (scan_pos == (int64)xz->frameCount()) {
+                break;
+            }
+            int64 start = scan_pos;
+            do {
+                ++scan_pos;
+            } while (scan_pos < (int64)xz->frameCount() && xz->frameCompressedOffset(scan_pos)
+                - xz->frameCompressedOffset(start) < TAR_PARALLEL_READ_UNIT_SIZE);
+            return std::make_shared<Unit>(start, scan_pos);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case ARCHIVE_FILTER_ZSTD: {
+            if (scan_pos == (int64)len) {
+                break;
+            }
+            int64 start = scan_pos;
+            while (scan_pos < (int64)len && scan_pos - start < TAR_PARALLEL_READ_UNIT_SIZE) {
+                size_t n = ZSTD_findFrameCompressedSize(data + scan_pos, len - scan_pos);
+                if (ZSTD_isError(n)) {
+                    // the error is reported when the unit is decompressed
+                    scan_pos = len;
+                    break;
+                }
+                scan_pos += n;
+            }
+            return std::make_shared<Unit>(start, scan_pos);
+        }
+#endif
+        default:
+            break;
+    }
+    return std::shared_ptr<Unit>();
+}
+
+void TarParallelReader::cancel(Unit& unit) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        unit.cancelled = true;
+    }
+    space_cond.notify_all();
+}
+
+int TarParallelReader::emit(Unit& unit, std::string& chunk) {
+    if (chunk.empty()) {
+        return 0;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    while (unit.buffered >= TAR_PARALLEL_READ_MAX_BUFFERED && !unit.cancelled && !stop) {
+        space_cond.wait(guard);
+    }
+    if (unit.cancelled || stop) {
+        return -1;
+    }
+    unit.buffered += chunk.size();
+    unit.chunks.push_back(std::move(chunk));
+    chunk.clear();
+    data_cond.notify_one();
+    return 0;
+}
+
+void TarParallelReader::decompress(Unit& unit) {
+    switch (filter) {
+#ifdef HAVE_ZLIB
+        case ARCHIVE_FILTER_GZIP:
+            decompressGzip(unit);
+            break;
+#endif
+#ifdef HAVE_BZIP2
+        case ARCHIVE_FILTER_BZIP2:
+            decompressBzip2(unit);
+            break;
+#endif
+#ifdef HAVE_LZMA
+        case ARCHIVE_FILTER_XZ:
+            decompressXz(unit);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case ARCHIVE_FILTER_ZSTD:
+            decompressZstd(unit);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+#ifdef HAVE_ZLIB
+int64 TarParallelReader::findGzipHeader(int64 offset, int64 end) const {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    while (offset < end) {
+        const void* hit = memchr(p + offset, 0x1f, end - offset);
+        if (!hit) {
+            break;
+        }
+        offset = static_cast<const unsigned char*>(hit) - p;
+        if (tar_is_gzip_header(p + offset, len - offset)) {
+            return offset;
+        }
+        ++offset;
+    }
+    return -1;
+}
+
+bool TarParallelReader::isGzipUnitStart(int64 offset) const {
+    return findGzipHeader(offset - offset % TAR_PARALLEL_READ_UNIT_SIZE, offset + 1) == offset;
+}
+
+void TarParallelReader::decompressGzip(Unit& unit) {
+    z_stream strm = z_stream();
+    // a window size of 15 plus 16 reads a gzip member
+    if (inflateInit2(&strm, 31) != Z_OK) {
+        unit.err = "failed to initialize the gzip decompressor";
+        return;
+    }
+    // the offset of the next input passed to the decompressor
+    int64 pos = unit.start;
+    std::string out(TAR_PARALLEL_READ_CHUNK_SIZE, '\0');
+    size_t used = 0;
+    while (true) {
+        if (!strm.avail_in) {
+            if (pos == (int64)len) {
+                unit.err = "unexpected end of compressed data";
+                break;
+            }
+            size_t n = std::min(len - (size_t)pos, (size_t)1 << 30);
+            strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + pos));
+            strm.avail_in = (uInt)n;
+            pos += n;
+        }
+        strm.next_out = reinterpret_cast<Bytef*>(&out[used]);
+        strm.avail_out = (uInt)(out.size() - used);
+        int rc = inflate(&strm, Z_NO_FLUSH);
+        used = out.size() - strm.avail_out;
+        if (rc == Z_STREAM_END) {
+            int64 end = pos - strm.avail_in;
+            // the unit ends where the next one starts; data following the last member that is not another member
+            // is ignored as by gzip
+            if (!tar_is_gzip_header(reinterpret_cast<const unsigned char*>(data) + end, len - end)) {
+                unit.stop = end;
+                unit.last = true;
+                break;
+            }
+            if (isGzipUnitStart(end)) {
+                unit.stop = end;
+                break;
+            }
+            inflateReset(&strm);
+        } else if (rc != Z_OK) {
+            unit.err = strm.msg ? strm.msg : "invalid gzip data";
+            break;
+        }
+        if (used == out.size()) {
+            if (emit(unit, out)) {
+                break;
+            }
+            out.resize(TAR_PARALLEL_READ_CHUNK_SIZE);
+            used = 0;
+        }
+    }
+    inflateEnd(&strm);
+    if (unit.err.empty()) {
+        out.resize(used);
+        emit(unit, out);
+    }
+}
+#endif
+
+#ifdef HAVE_BZIP2
+uint64_t TarParallelReader::getBits(int64 offset, unsigned count) const {
+    size_t pos = (size_t)(offset >> 3);
+    uint64_t v = 0;
+    for (size_t i = pos; i < pos + 8; ++i) {
+        v = (v << 8) | (i < len ? (unsigned char)data[i] : 0);
+    }
+    return (v << (offset & 7)) >> (64 - count);
+}
+
+int64 TarParallelReader::findBzip2Marker(int64 offset, bool* eos) const {
+    int64 total = (int64)len * 8;
+    // a magic number starting at bit b has its first whole byte at (b + 7) / 8, so only bytes found in the table
+    // have to be checked
+    for (size_t i = (size_t)((offset + 7) >> 3); i < len; ++i) {
+        unsigned m = bzip2_markers.bits[(unsigned char)data[i]];
+        if (!m) {
+            continue;
+        }
+        for (int o = 7; o >= 0; --o) {
+            if (!(m & ((1 << o) | (1 << (8 + o))))) {
+                continue;
+            }
+            int64 b = (int64)i * 8 - o;
+            if (b < offset || b + 48 > total) {
+                continue;
+            }
+            uint64_t v = getBits(b, 48);
+            if ((m & (1 << o)) && v == TAR_BZIP2_BLOCK_MAGIC) {
+                if (eos) {
+                    *eos = false;
+                }
+                return b;
+            }
+            if ((m & (1 << (8 + o))) && v == TAR_BZIP2_EOS_MAGIC) {
+                if (eos) {
+                    *eos = true;
+                }
+                return b;
+            }
+        }
+    }
+    return -1;
+}
+
+int TarParallelReader::decompressBzip2Block(int64 start, int64 end, std::string& out) const {
+    // the block is decompressed as a stream of its own: a stream header with the largest block size, the block,
+    // and the end-of-stream magic number followed by the stream CRC, which for a single block is the block CRC
+    std::string in("BZh9");
+    in.reserve((size_t)((end - start) / 8) + 16);
+    TarBitWriter w(in);
+    for (int64 pos = start; pos < end; pos += 32) {
+        unsigned n = (unsigned)std::min((int64)32, end - pos);
+        w.put(getBits(pos, n), n);
+    }
+    w.put(TAR_BZIP2_EOS_MAGIC, 48);
+    w.put(getBits(start + 48, 32), 32);
+    w.flush();
+
+    bz_stream strm;
+    memset(&strm, 0, sizeof strm);
+    if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
+        return -1;
+    }
+    strm.next_in = &in[0];
+    strm.avail_in = (unsigned)in.size();
+    out.clear();
+    size_t used = 0;
+    int rc;
+    while (true) {
+        if (used == out.size()) {
+            out.resize(out.size() + TAR_PARALLEL_READ_CHUNK_SIZE * 4);
+        }
+        strm.next_out = &out[used];
+        strm.avail_out = (unsigned)(out.size() - used);
+        rc = BZ2_bzDecompress(&strm);
+        used = out.size() - strm.avail_out;
+        // the stream is incomplete if the input is used up while there is still room for output
+        if (rc != BZ_OK || (!strm.avail_in && strm.avail_out)) {
+            break;
+        }
+    }
+    BZ2_bzDecompressEnd(&strm);
+    out.resize(used);
+    return rc == BZ_STREAM_END ? 0 : -1;
+}
+
+void TarParallelReader::decompressBzip2(Unit& unit) {
+    int64 total = (int64)len * 8;
+    int64 end = unit.end;
+    std::string out;
+    unsigned retries = 0;
+    while (decompressBzip2Block(unit.start, end, out)) {
+        // a magic number appearing by chance in the compressed data ends the block early, so the block is retried
+        // with the data up to the following magic number; the unit starting there is then skipped
+        if (++retries > TAR_BZIP2_MAX_RETRIES || end >= total) {
+            unit.err = "invalid bzip2 data";
+            return;
+        }
+        end = findBzip2Marker(end + 1, nullptr);
+        if (end < 0) {
+            end = total;
+        }
+    }
+    unit.stop = end;
+    emit(unit, out);
+}
+#endif
+
+#ifdef HAVE_LZMA
+void TarParallelReader::decompressXz(Unit& unit) {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    std::string out(TAR_PARALLEL_READ_CHUNK_SIZE, '\0');
+    size_t used = 0;
+    for (size_t i = (size_t)unit.start; i < (size_t)unit.end && unit.err.empty(); ++i) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data) + xz->frameCompressedOffset(i);
+        size_t size = (size_t)(xz->frameCompressedOffset(i + 1) - xz->frameCompressedOffset(i));
+
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block;
+        memset(&block, 0, sizeof block);
+        block.version = 1;
+        block.check = (lzma_check)xz->getCheck();
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(p[0]);
+        if (!p[0] || block.header_size > size) {
+            unit.err = "failed to read xz block header";
+            break;
+        }
+        lzma_ret rc = lzma_block_header_decode(&block, nullptr, p);
+        if (rc == LZMA_OK) {
+            rc = lzma_block_decoder(&strm, &block);
+            // the decoder keeps its own copy of the filter options
+            for (unsigned j = 0; filters[j].id != LZMA_VLI_UNKNOWN; ++j) {
+                free(filters[j].options);
+            }
+        }
+        if (rc != LZMA_OK) {
+            unit.err = tar_lzma_error(rc);
+            break;
+        }
+
+        strm.next_in = p + block.header_size;
+        strm.avail_in = size - block.header_size;
+        while (true) {
+            strm.next_out = reinterpret_cast<uint8_t*>(&out[used]);
+            strm.avail_out = out.size() - used;
+            rc = lzma_code(&strm, LZMA_RUN);
+            used = out.size() - strm.avail_out;
+            if (rc != LZMA_OK && rc != LZMA_STREAM_END) {
+                unit.err = tar_lzma_error(rc);
+                break;
+            }
+            if (rc == LZMA_OK && !strm.avail_in && strm.avail_out) {
+                unit.err = "unexpected end of compressed data";
+                break;
+            }
+            if (used == out.size()) {
+                if (emit(unit, out)) {
+                    lzma_end(&strm);
+                    return;
+                }
+                out.resize(TAR_PARALLEL_READ_CHUNK_SIZE);
+                used = 0;
+            }
+            if (rc == LZMA_STREAM_END) {
+                break;
+            }
+        }
+    }
+    lzma_end(&strm);
+    if (unit.err.empty()) {
+        unit.stop = unit.end;
+        out.resize(used);
+        emit(unit, out);
+    }
+}
+#endif
+
+#ifdef HAVE_ZSTD
+void TarParallelReader::decompressZstd(Unit& unit) {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (!dctx) {
+        unit.err = "failed to create zstd decompression context";
+        return;
+    }
+    ZSTD_inBuffer in = { data + unit.start, (size_t)(unit.end - unit.start), 0 };
+    std::string out(TAR_PARALLEL_READ_CHUNK_SIZE, '\0');
+    size_t used = 0;
+    // the result of the last call that made progress; 0 once a frame has been decompressed completely
+    size_t pending = 0;
+    while (true) {
+        ZSTD_outBuffer ob = { &out[0], out.size(), used };
+        size_t in_pos = in.pos;
+        size_t rc = ZSTD_decompressStream(dctx, &ob, &in);
+        if (ZSTD_isError(rc)) {
+            unit.err = ZSTD_getErrorName(rc);
+            break;
+        }
+        if (in.pos != in_pos || ob.pos != used) {
+            pending = rc;
+        }
+        used = ob.pos;
+        if (used == out.size()) {
+            if (emit(unit, out)) {
+                break;
+            }
+            out.resize(TAR_PARALLEL_READ_CHUNK_SIZE);
+            used = 0;
+            continue;
+        }
+        // there is still room for output, so all input has been decompressed
+        if (in.pos == in.size) {
+            if (pending) {
+                unit.err = "unexpected end of compressed data";
+            }
+            break;
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+    if (unit.err.empty()) {
+        unit.stop = unit.end;
+        out.resize(used);
+        emit(unit, out);
+    }
+}
+#endif
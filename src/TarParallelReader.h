@@ -0,0 +1,202 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarParallelReader.h multi-threaded decompression of archives being read */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARPARALLELREADER_H
+#define _QORE_TAR_TARPARALLELREADER_H
+
+#include "TarSeekSource.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Minimum compressed size of the units decompressed by each thread for gzip, zstd and xz
+#define TAR_PARALLEL_READ_UNIT_SIZE     (1024 * 1024)
+//! Size of the blocks of decompressed data passed from the worker threads to the reader
+#define TAR_PARALLEL_READ_CHUNK_SIZE    (256 * 1024)
+//! Maximum amount of decompressed data of a unit waiting to be read; workers wait until it has been read
+#define TAR_PARALLEL_READ_MAX_BUFFERED  (32 * 1024 * 1024)
+
+//! Decompresses an archive held in memory with a pool of threads
+/** The compressed data is split into units that can be decompressed independently, which are decompressed by
+    the worker threads and returned in order:
+    - gzip: sequences of members; members are found by scanning for gzip headers, and a unit starting at a
+      header found inside the compressed data of a member is discarded when the previous unit reaches past it
+    - bzip2: single blocks, found by scanning for the bit-aligned block magic number; each block is decompressed
+      as a stream of its own.  A block that fails to decompress is retried together with the data up to the
+      next magic number, in case the magic number appeared by chance in the compressed data
+    - zstd: sequences of frames
+    - xz: sequences of blocks of a stream with a block index
+
+    Archives with a single gzip member or zstd frame are decompressed by a single worker thread.
+*/
+class TarParallelReader : public TarSeekReader {
+public:
+    //! Creates a reader for compressed archive data and starts its threads
+    /** The data must remain valid until the reader has been deleted.
+
+        @return the reader, or nullptr if the data is not compressed with a supported codec or cannot be split
+    */
+    DLLLOCAL static TarParallelReader* create(const char* data, size_t len, unsigned threads);
+
+    //! Stops and joins the worker threads
+    DLLLOCAL virtual ~TarParallelReader();
+
+    DLLLOCAL virtual la_ssize_t read(const void** buffer) override;
+
+    //! Returns the libarchive filter code of the compression of the data
+    DLLLOCAL int getFilter() const {
+        return filter;
+    }
+
+private:
+    //! A unit of compressed data and its decompressed form
+    struct Unit {
+        // compressed start and end; in bits for bzip2 and in blocks for xz; the end is not used for gzip
+        int64 start;
+        int64 end;
+        // start of the data following the unit
+        int64 stop = -1;
+        // true if no data follows the unit
+        bool last = false;
+        // decompressed data waiting to be read and its size
+        std::deque<std::string> chunks;
+        size_t buffered = 0;
+        bool done = false;
+        // set when the data of the unit is not needed
+        bool cancelled = false;
+        // error message if decompression failed
+        std::string err;
+
+        DLLLOCAL Unit(int64 start, int64 end) : start(start), end(end) {
+        }
+    };
+
+    const char* data;
+    size_t len;
+    int filter;
+    // maximum number of units being decompressed or waiting to be read
+    size_t max_units = 0;
+
+    // position of the next unit to be found, and true once all units have been found
+    int64 scan_pos = 0;
+    bool scan_done = false;
+    // units in order that have not been read yet; the worker threads take units from the work queue
+    std::deque<std::shared_ptr<Unit>> units;
+    std::deque<std::shared_ptr<Unit>> work;
+    // the unit being read, the start of the data following the last unit read, and true at the end of the data
+    std::shared_ptr<Unit> current;
+    int64 expected = 0;
+    bool finished = false;
+    // the data last returned by read()
+    std::string buffer;
+
+#ifdef HAVE_LZMA
+    // the block index of xz data
+    std::unique_ptr<TarXzSeekSource> xz;
+#endif
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    // signaled when a unit is queued or the threads are stopped
+    std::condition_variable work_cond;
+    // signaled when data of a unit is available or a unit is done
+    std::condition_variable data_cond;
+    // signaled when data has been read or units have been cancelled
+    std::condition_variable space_cond;
+    bool stop = false;
+
+    DLLLOCAL TarParallelReader(const char* data, size_t len, int filter) : data(data), len(len), filter(filter) {
+    }
+
+    //! Starts the worker threads; returns -1 on failure
+    DLLLOCAL int start(unsigned count);
+
+    //! Runs a worker thread
+    DLLLOCAL void run();
+
+    //! Finds and queues units until enough units are being decompressed
+    DLLLOCAL void schedule();
+
+    //! Returns the next unit, or nullptr if there are no more units
+    DLLLOCAL std::shared_ptr<Unit> findUnit();
+
+    //! Marks a unit as not needed, so its worker thread stops decompressing it
+    DLLLOCAL void cancel(Unit& unit);
+
+    //! Passes decompressed data of a unit to the reader; returns -1 if the unit has been cancelled
+    DLLLOCAL int emit(Unit& unit, std::string& chunk);
+
+    //! Decompresses a unit; sets the unit error on failure
+    DLLLOCAL void decompress(Unit& unit);
+
+#ifdef HAVE_ZLIB
+    //! Returns true if a unit starts at the given offset
+    DLLLOCAL bool isGzipUnitStart(int64 offset) const;
+
+    //! Returns the offset of the first gzip header in the given range, or -1 if there is none
+    DLLLOCAL int64 findGzipHeader(int64 offset, int64 end) const;
+
+    DLLLOCAL void decompressGzip(Unit& unit);
+#endif
+
+#ifdef HAVE_BZIP2
+    //! Returns the bit offset of the next block or end-of-stream magic number at or after the given bit offset
+    /** @param offset the bit offset to start searching at
+        @param eos if given, returns true if an end-of-stream magic number was found
+
+        @return the bit offset of the magic number, or -1 if there is none
+    */
+    DLLLOCAL int64 findBzip2Marker(int64 offset, bool* eos) const;
+
+    //! Returns up to 56 bits at the given bit offset
+    DLLLOCAL uint64_t getBits(int64 offset, unsigned count) const;
+
+    //! Decompresses the bzip2 block between the given bit offsets; returns -1 if it cannot be decompressed
+    DLLLOCAL int decompressBzip2Block(int64 start, int64 end, std::string& out) const;
+
+    DLLLOCAL void decompressBzip2(Unit& unit);
+#endif
+
+#ifdef HAVE_LZMA
+    DLLLOCAL void decompressXz(Unit& unit);
+#endif
+
+#ifdef HAVE_ZSTD
+    DLLLOCAL void decompressZstd(Unit& unit);
+#endif
+};
+
+#ifdef HAVE_ZLIB
+//! Returns true if the data starts with a plausible gzip member header
+DLLLOCAL bool tar_is_gzip_header(const unsigned char* p, size_t avail);
+#endif
+
+#endif // _QORE_TAR_TARPARALLELREADER_H
@@ -0,0 +1,406 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarParallelSink.cpp multi-threaded compression of archives being written */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarParallelSink.h"
+
+#include <algorithm>
+#include <system_error>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+bool TarParallelSink::supported(int compression_method) {
+    switch (compression_method) {
+#ifdef HAVE_ZLIB
+        case TAR_CM_GZIP:
+            return true;
+#endif
+#ifdef HAVE_BZIP2
+        case TAR_CM_BZIP2:
+            return true;
+#endif
+#ifdef HAVE_LZMA
+        case TAR_CM_XZ:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case TAR_CM_ZSTD:
+            return true;
+#endif
+#ifdef HAVE_LZ4
+        case TAR_CM_LZ4:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+TarParallelSink::TarParallelSink(TarSinkOutput output, int compression_method, int level)
+        : TarCompressionSink(output), compression_method(compression_method), level(level),
+        chunk_size(TAR_PARALLEL_CHUNK_SIZE), max_chunks(0) {
+    if (compression_method == TAR_CM_BZIP2) {
+        // chunks are sized to the bzip2 block size given by the level in units of 100000 bytes; as the block limit
+        // applies after bzip2's initial run-length encoding, a chunk can still take more than one block
+        if (this->level < 1 || this->level > 9) {
+            this->level = 9;
+        }
+        chunk_size = this->level * 100000;
+    } else if (compression_method == TAR_CM_XZ) {
+        chunk_size = TAR_PARALLEL_XZ_CHUNK_SIZE;
+    }
+}
+
+TarParallelSink::~TarParallelSink() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    work_cond.notify_all();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+#ifdef HAVE_LZMA
+    if (xz_index) {
+        lzma_index_end(static_cast<lzma_index*>(xz_index), nullptr);
+    }
+#endif
+}
+
+TarParallelSink* TarParallelSink::create(TarSinkOutput output, int compression_method, int level,
+                                         unsigned threads, std::string& err) {
+    if (!supported(compression_method)) {
+        err = "the compression method is not supported";
+        return nullptr;
+    }
+    std::unique_ptr<TarParallelSink> sink(new TarParallelSink(output, compression_method, level));
+#ifdef HAVE_LZMA
+    if (compression_method == TAR_CM_XZ) {
+        sink->xz_index = lzma_index_init(nullptr);
+        if (!sink->xz_index) {
+            err = "failed to create xz index";
+            return nullptr;
+        }
+    }
+#endif
+    if (sink->start(threads)) {
+        err = sink->err;
+        return nullptr;
+    }
+    return sink.release();
+}
+
+int TarParallelSink::start(unsigned count) {
+    // two chunks per thread keep all threads busy while completed chunks are written
+    max_chunks = count * 2;
+    for (unsigned i = 0; i < count; ++i) {
+        try {
+            threads.emplace_back([this] () { run(); });
+        } catch (std::system_error& e) {
+            err = std::string("failed to start compression thread: ") + e.what();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void TarParallelSink::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        while (work.empty() && !stop) {
+            work_cond.wait(guard);
+        }
+        if (stop) {
+            return;
+        }
+        Chunk* chunk = work.front();
+        work.pop_front();
+
+        guard.unlock();
+        compress(*chunk);
+        guard.lock();
+        chunk->done = true;
+        done_cond.notify_one();
+    }
+}
+
+void TarParallelSink::compress(Chunk& chunk) const {
+    switch (compression_method) {
+#ifdef HAVE_ZLIB
+        case TAR_CM_GZIP: {
+            const std::vector<char>& in = chunk.in;
+            std::vector<char>& out = chunk.out;
+            // a window size of 15 plus 16 writes a complete gzip member
+            z_stream strm = z_stream();
+            if (deflateInit2(&strm, level >= 1 && level <= 9 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK) {
+                chunk.err = "failed to initialize the gzip compressor";
+                return;
+            }
+            out.resize(deflateBound(&strm, in.size()));
+            strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+            strm.avail_in = (uInt)in.size();
+            strm.next_out = reinterpret_cast<Bytef*>(out.data());
+            strm.avail_out = (uInt)out.size();
+            int rc = deflate(&strm, Z_FINISH);
+            out.resize(out.size() - strm.avail_out);
+            deflateEnd(&strm);
+            if (rc != Z_STREAM_END) {
+                chunk.err = "gzip compression failed";
+            }
+            return;
+        }
+#endif
+#ifdef HAVE_BZIP2
+        case TAR_CM_BZIP2: {
+            const std::vector<char>& in = chunk.in;
+            std::vector<char>& out = chunk.out;
+            // the maximum size of bzip2 output is given as 1% larger than the input plus 600 bytes
+            unsigned len = (unsigned)(in.size() + in.size() / 100 + 600);
+            out.resize(len);
+            int rc = BZ2_bzBuffToBuffCompress(out.data(), &len, const_cast<char*>(in.data()), (unsigned)in.size(),
+                level, 0, 0);
+            if (rc != BZ_OK) {
+                chunk.err = "bzip2 compression failed";
+                return;
+            }
+            out.resize(len);
+            return;
+        }
+#endif
+#ifdef HAVE_LZMA
+        case TAR_CM_XZ: {
+            const std::vector<char>& in = chunk.in;
+            std::vector<char>& out = chunk.out;
+            lzma_options_lzma opts;
+            if (lzma_lzma_preset(&opts, level >= 0 && level <= 9 ? level : LZMA_PRESET_DEFAULT)) {
+                chunk.err = "unsupported xz compression level";
+                return;
+            }
+            lzma_filter filters[2] = {
+                { LZMA_FILTER_LZMA2, &opts },
+                { LZMA_VLI_UNKNOWN, nullptr },
+            };
+            lzma_block block = lzma_block();
+            block.version = 0;
+            block.check = LZMA_CHECK_CRC64;
+            block.filters = filters;
+            out.resize(lzma_block_buffer_bound(in.size()));
+            size_t pos = 0;
+            lzma_ret rc = lzma_block_buffer_encode(&block, nullptr, reinterpret_cast<const uint8_t*>(in.data()),
+                in.size(), reinterpret_cast<uint8_t*>(out.data()), &pos, out.size());
+            if (rc != LZMA_OK) {
+                chunk.err = tar_lzma_error(rc);
+                return;
+            }
+            out.resize(pos);
+            chunk.unpadded_size = lzma_block_unpadded_size(&block);
+            return;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case TAR_CM_ZSTD: {
+            const std::vector<char>& in = chunk.in;
+            std::vector<char>& out = chunk.out;
+            out.resize(ZSTD_compressBound(in.size()));
+            size_t rc = ZSTD_compress(out.data(), out.size(), in.data(), in.size(),
+                level > 0 ? level : ZSTD_CLEVEL_DEFAULT);
+            if (ZSTD_isError(rc)) {
+                chunk.err = ZSTD_getErrorName(rc);
+                return;
+            }
+            out.resize(rc);
+            return;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case TAR_CM_LZ4: {
+            const std::vector<char>& in = chunk.in;
+            std::vector<char>& out = chunk.out;
+            LZ4F_preferences_t prefs = LZ4F_preferences_t();
+            prefs.compressionLevel = level > 0 ? level : 0;
+            prefs.frameInfo.contentSize = in.size();
+            out.resize(LZ4F_compressFrameBound(in.size(), &prefs));
+            size_t rc = LZ4F_compressFrame(out.data(), out.size(), in.data(), in.size(), &prefs);
+            if (LZ4F_isError(rc)) {
+                chunk.err = LZ4F_getErrorName(rc);
+                return;
+            }
+            out.resize(rc);
+            return;
+        }
+#endif
+        default:
+            chunk.err = "the compression method is not supported";
+            return;
+    }
+}
+
+int TarParallelSink::write(const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len) {
+        if (!current) {
+            current.reset(new Chunk);
+            current->in.reserve(chunk_size);
+        }
+        size_t n = std::min(len, chunk_size - current->in.size());
+        current->in.insert(current->in.end(), p, p + n);
+        p += n;
+        len -= n;
+        if (current->in.size() == chunk_size && submit()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int TarParallelSink::trailerBoundary() {
+    return current ? submit() : 0;
+}
+
+int TarParallelSink::submit() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        work.push_back(current.get());
+        chunks.push_back(std::move(current));
+    }
+    work_cond.notify_one();
+    return writeChunks(max_chunks);
+}
+
+int TarParallelSink::writeChunks(size_t max) {
+    while (!chunks.empty()) {
+        Chunk* chunk = chunks.front().get();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            // completed chunks are written as soon as possible; otherwise only waits if too many are pending
+            if (!chunk->done && chunks.size() <= max) {
+                return 0;
+            }
+            while (!chunk->done) {
+                done_cond.wait(guard);
+            }
+        }
+        if (writeChunk(*chunk)) {
+            return -1;
+        }
+        chunks.pop_front();
+    }
+    return 0;
+}
+
+int TarParallelSink::writeChunk(Chunk& chunk) {
+    if (!chunk.err.empty()) {
+        err = chunk.err;
+        return -1;
+    }
+#ifdef HAVE_LZMA
+    if (compression_method == TAR_CM_XZ) {
+        if (writeXzHeader()) {
+            return -1;
+        }
+        lzma_ret rc = lzma_index_append(static_cast<lzma_index*>(xz_index), nullptr, chunk.unpadded_size,
+            chunk.in.size());
+        if (rc != LZMA_OK) {
+            err = tar_lzma_error(rc);
+            return -1;
+        }
+    }
+#endif
+    return writeOutput(chunk.out.data(), chunk.out.size());
+}
+
+#ifdef HAVE_LZMA
+int TarParallelSink::writeXzHeader() {
+    if (header_written) {
+        return 0;
+    }
+    lzma_stream_flags flags = lzma_stream_flags();
+    flags.version = 0;
+    flags.check = LZMA_CHECK_CRC64;
+    uint8_t header[LZMA_STREAM_HEADER_SIZE];
+    lzma_ret rc = lzma_stream_header_encode(&flags, header);
+    if (rc != LZMA_OK) {
+        err = tar_lzma_error(rc);
+        return -1;
+    }
+    header_written = true;
+    return writeOutput(header, sizeof(header));
+}
+#endif
+
+int TarParallelSink::finish() {
+    if (current && submit()) {
+        return -1;
+    }
+    if (writeChunks(0)) {
+        return -1;
+    }
+#ifdef HAVE_LZMA
+    if (compression_method == TAR_CM_XZ) {
+        if (writeXzHeader()) {
+            return -1;
+        }
+        // the xz stream ends with the index of all blocks and the stream footer
+        lzma_index* index = static_cast<lzma_index*>(xz_index);
+        std::vector<char> buf(lzma_index_size(index) + LZMA_STREAM_HEADER_SIZE);
+        size_t pos = 0;
+        lzma_ret rc = lzma_index_buffer_encode(index, reinterpret_cast<uint8_t*>(buf.data()), &pos, buf.size());
+        if (rc != LZMA_OK) {
+            err = tar_lzma_error(rc);
+            return -1;
+        }
+        lzma_stream_flags flags = lzma_stream_flags();
+        flags.version = 0;
+        flags.check = LZMA_CHECK_CRC64;
+        flags.backward_size = lzma_index_size(index);
+        rc = lzma_stream_footer_encode(&flags, reinterpret_cast<uint8_t*>(buf.data()) + pos);
+        if (rc != LZMA_OK) {
+            err = tar_lzma_error(rc);
+            return -1;
+        }
+        return writeOutput(buf.data(), pos + LZMA_STREAM_HEADER_SIZE);
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarParallelSink.h multi-threaded compression of archives being written */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARPARALLELSINK_H
+#define _QORE_TAR_TARPARALLELSINK_H
+
+#include "TarCompressionSink.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Uncompressed size of the chunks compressed by each thread for gzip, zstd and lz4
+#define TAR_PARALLEL_CHUNK_SIZE     (1024 * 1024)
+//! Uncompressed size of the chunks compressed by each thread for xz
+#define TAR_PARALLEL_XZ_CHUNK_SIZE  (8 * 1024 * 1024)
+
+//! Compresses the archive with a pool of threads
+/** The uncompressed stream is cut into chunks that are compressed independently by the worker threads and
+    written to the output in order by the thread writing the archive.  Chunks are written as gzip members,
+    bzip2 streams, zstd frames or lz4 frames, which standard decompressors read as a single stream when
+    concatenated, or as the blocks of a single xz stream.
+
+    bzip2 chunks are sized to the bzip2 block size, so bzip2 output compresses about as well as with a single
+    thread (a chunk can still be split into more than one block, as the block size limits the data after
+    bzip2's initial run-length encoding); for the other codecs each chunk starts without the history of the
+    previous one.
+
+    The end-of-archive blocks are written in their own chunk, so gzip and zstd archives written with this sink
+    can be appended to in place like archives written with a TarMemberSink.
+*/
+class TarParallelSink : public TarCompressionSink {
+public:
+    //! Returns true if the sink supports the given TAR_CM_* compression method
+    DLLLOCAL static bool supported(int compression_method);
+
+    //! Creates the sink and starts its threads; returns nullptr and sets \a err on failure
+    DLLLOCAL static TarParallelSink* create(TarSinkOutput output, int compression_method, int level,
+                                            unsigned threads, std::string& err);
+
+    //! Stops and joins the worker threads
+    DLLLOCAL virtual ~TarParallelSink();
+
+    DLLLOCAL virtual int write(const void* data, size_t len) override;
+
+    DLLLOCAL virtual int finish() override;
+
+protected:
+    DLLLOCAL virtual int trailerBoundary() override;
+
+private:
+    //! A chunk of uncompressed data and its compressed form
+    struct Chunk {
+        std::vector<char> in;
+        std::vector<char> out;
+        // for xz: the unpadded size of the block
+        uint64_t unpadded_size = 0;
+        bool done = false;
+        // error message if compression failed
+        std::string err;
+    };
+
+    int compression_method;
+    int level;
+    size_t chunk_size;
+    // maximum number of chunks being compressed or waiting to be written
+    size_t max_chunks;
+
+    // the chunk being filled
+    std::unique_ptr<Chunk> current;
+    // chunks in output order; the worker threads take chunks from the work queue
+    std::deque<std::unique_ptr<Chunk>> chunks;
+    std::deque<Chunk*> work;
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    // signaled when a chunk is queued or the threads are stopped
+    std::condition_variable work_cond;
+    // signaled when a chunk has been compressed
+    std::condition_variable done_cond;
+    bool stop = false;
+
+    // xz stream state: whether the stream header has been written, and the index of the blocks written
+    bool header_written = false;
+    void* xz_index = nullptr;
+
+    DLLLOCAL TarParallelSink(TarSinkOutput output, int compression_method, int level);
+
+    //! Starts the worker threads; returns -1 and sets the error on failure
+    DLLLOCAL int start(unsigned count);
+
+    //! Runs a worker thread
+    DLLLOCAL void run();
+
+    //! Compresses a chunk; sets the chunk error on failure
+    DLLLOCAL void compress(Chunk& chunk) const;
+
+    //! Queues the current chunk for compression and writes completed chunks
+    DLLLOCAL int submit();
+
+    //! Writes completed chunks in order; waits until at most \a max chunks are left
+    DLLLOCAL int writeChunks(size_t max);
+
+    //! Writes a compressed chunk
+    DLLLOCAL int writeChunk(Chunk& chunk);
+
+#ifdef HAVE_LZMA
+    //! Writes the xz stream header before the first block
+    DLLLOCAL int writeXzHeader();
+#endif
+};
+
+#endif // _QORE_TAR_TARPARALLELSINK_H
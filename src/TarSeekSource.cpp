@@ -0,0 +1,1002 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarSeekSource.cpp random-access archive data source implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarSeekSource.h"
+#include "TarCompressionSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#include <cstdlib>
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+namespace {
+// Reader for in-memory data; returns the remaining data in a single block
+class TarMemorySeekReader : public TarSeekReader {
+public:
+    DLLLOCAL TarMemorySeekReader(const char* data, size_t len) : data(data), len(len) {
+    }
+
+    DLLLOCAL virtual la_ssize_t read(const void** buffer) override {
+        *buffer = data;
+        la_ssize_t rv = (la_ssize_t)len;
+        data += len;
+        len = 0;
+        return rv;
+    }
+
+private:
+    const char* data;
+    size_t len;
+};
+
+// Reader for a file descriptor shared with other readers
+class TarFileSeekReader : public TarSeekReader {
+public:
+    DLLLOCAL TarFileSeekReader(int fd, int64 offset) : fd(fd), pos(offset), buffer(new char[TAR_BUFFER_SIZE]) {
+    }
+
+    DLLLOCAL virtual la_ssize_t read(const void** buf) override {
+        ssize_t rc;
+        while ((rc = pread(fd, buffer.get(), TAR_BUFFER_SIZE, pos)) < 0 && errno == EINTR) {
+        }
+        if (rc < 0) {
+            err = strerror(errno);
+            return -1;
+        }
+        pos += rc;
+        *buf = buffer.get();
+        return rc;
+    }
+
+    DLLLOCAL virtual int64 skip(int64 request) override {
+        pos += request;
+        return request;
+    }
+
+private:
+    int fd;
+    int64 pos;
+    std::unique_ptr<char[]> buffer;
+};
+
+#ifdef HAVE_ZSTD
+// Reader decompressing a seekable zstd archive from a given frame
+class TarZstdSeekReader : public TarSeekReader {
+public:
+    DLLLOCAL TarZstdSeekReader(const TarZstdSeekSource* src, ZSTD_DCtx* dctx, int64 offset)
+            : src(src), dctx(dctx), in_buffer(ZSTD_DStreamInSize()), out_buffer(ZSTD_DStreamOutSize()),
+            in({in_buffer.data(), 0, 0}), comp_end(src->frameCompressedOffset(src->frameCount())) {
+        seekFrame(offset);
+    }
+
+    DLLLOCAL virtual ~TarZstdSeekReader() {
+        ZSTD_freeDCtx(dctx);
+    }
+
+    DLLLOCAL virtual la_ssize_t read(const void** buf) override {
+        while (true) {
+            if (in.pos == in.size) {
+                if (comp_pos >= comp_end) {
+                    return 0;
+                }
+                size_t n = (size_t)std::min((int64)in_buffer.size(), comp_end - comp_pos);
+                la_ssize_t rc = src->readCompressed(comp_pos, in_buffer.data(), n);
+                if (rc <= 0) {
+                    err = rc ? strerror(errno) : "unexpected end of compressed data";
+                    return -1;
+                }
+                comp_pos += rc;
+                in.size = rc;
+                in.pos = 0;
+            }
+
+            ZSTD_outBuffer out = { out_buffer.data(), out_buffer.size(), 0 };
+            size_t rc = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(rc)) {
+                err = ZSTD_getErrorName(rc);
+                return -1;
+            }
+
+            const char* p = out_buffer.data();
+            size_t n = out.pos;
+            // drop the data of the frame before the requested offset
+            if (discard) {
+                size_t d = (size_t)std::min(discard, (int64)n);
+                p += d;
+                n -= d;
+                discard -= d;
+            }
+            if (n) {
+                pos += n;
+                *buf = p;
+                return n;
+            }
+        }
+    }
+
+    DLLLOCAL virtual int64 skip(int64 request) override {
+        int64 target = pos + request;
+        // only skip by repositioning if the target is in a frame that has not been started yet
+        if (target >= src->frameDataOffset(src->frameCount())
+            || src->frameDataOffset(src->findFrame(target)) <= pos) {
+            return 0;
+        }
+        seekFrame(target);
+        return request;
+    }
+
+private:
+    const TarZstdSeekSource* src;
+    ZSTD_DCtx* dctx;
+    std::vector<char> in_buffer;
+    std::vector<char> out_buffer;
+    ZSTD_inBuffer in;
+    // compressed read position and the end of the compressed frames
+    int64 comp_pos = 0;
+    int64 comp_end;
+    // uncompressed position of the next byte returned and the number of bytes to drop before it
+    int64 pos = 0;
+    int64 discard = 0;
+
+    DLLLOCAL void seekFrame(int64 offset) {
+        size_t f = src->findFrame(offset);
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        in.size = in.pos = 0;
+        comp_pos = src->frameCompressedOffset(f);
+        discard = offset - src->frameDataOffset(f);
+        pos = offset;
+    }
+};
+#endif
+
+#ifdef HAVE_LZMA
+// Reader decompressing the blocks of an xz archive from a given block
+class TarXzSeekReader : public TarSeekReader {
+public:
+    DLLLOCAL TarXzSeekReader(const TarXzSeekSource* src, int64 offset) : src(src), in_buffer(TAR_BUFFER_SIZE),
+            out_buffer(TAR_BUFFER_SIZE) {
+        seekFrame(offset);
+    }
+
+    DLLLOCAL virtual ~TarXzSeekReader() {
+        lzma_end(&strm);
+    }
+
+    DLLLOCAL virtual la_ssize_t read(const void** buf) override {
+        while (true) {
+            if (block_start) {
+                if (frame == src->frameCount()) {
+                    return 0;
+                }
+                if (startBlock()) {
+                    return -1;
+                }
+            }
+
+            if (!strm.avail_in) {
+                int64 end = src->frameCompressedOffset(frame + 1);
+                size_t n = (size_t)std::min((int64)in_buffer.size(), end - comp_pos);
+                la_ssize_t rc = n ? src->readCompressed(comp_pos, in_buffer.data(), n) : 0;
+                if (rc <= 0) {
+                    err = rc ? strerror(errno) : "unexpected end of compressed data";
+                    return -1;
+                }
+                comp_pos += rc;
+                strm.next_in = in_buffer.data();
+                strm.avail_in = rc;
+            }
+
+            strm.next_out = out_buffer.data();
+            strm.avail_out = out_buffer.size();
+            lzma_ret rc = lzma_code(&strm, LZMA_RUN);
+            if (rc == LZMA_STREAM_END) {
+                // the block is complete, including its padding and check
+                ++frame;
+                block_start = true;
+                comp_pos = src->frameCompressedOffset(frame);
+                strm.avail_in = 0;
+            } else if (rc != LZMA_OK) {
+                err = tar_lzma_error(rc);
+                return -1;
+            }
+
+            const uint8_t* p = out_buffer.data();
+            size_t n = out_buffer.size() - strm.avail_out;
+            // drop the data of the block before the requested offset
+            if (discard) {
+                size_t d = (size_t)std::min(discard, (int64)n);
+                p += d;
+                n -= d;
+                discard -= d;
+            }
+            if (n) {
+                pos += n;
+                *buf = p;
+                return n;
+            }
+        }
+    }
+
+    DLLLOCAL virtual int64 skip(int64 request) override {
+        int64 target = pos + request;
+        // only skip by repositioning if the target is in a block that has not been started yet
+        if (target >= src->frameDataOffset(src->frameCount())
+            || src->frameDataOffset(src->findFrame(target)) <= pos) {
+            return 0;
+        }
+        seekFrame(target);
+        return request;
+    }
+
+private:
+    const TarXzSeekSource* src;
+    lzma_stream strm = LZMA_STREAM_INIT;
+    std::vector<uint8_t> in_buffer;
+    std::vector<uint8_t> out_buffer;
+    // current block, and true if its header has not been read yet
+    size_t frame = 0;
+    bool block_start = true;
+    // compressed read position
+    int64 comp_pos = 0;
+    // uncompressed position of the next byte returned and the number of bytes to drop before it
+    int64 pos = 0;
+    int64 discard = 0;
+
+    DLLLOCAL void seekFrame(int64 offset) {
+        frame = src->findFrame(offset);
+        block_start = true;
+        strm.avail_in = 0;
+        comp_pos = src->frameCompressedOffset(frame);
+        discard = offset - src->frameDataOffset(frame);
+        pos = offset;
+    }
+
+    //! Reads the block header at the current position and sets up the block decoder
+    DLLLOCAL int startBlock() {
+        uint8_t header[LZMA_BLOCK_HEADER_SIZE_MAX];
+        if (src->readCompressed(comp_pos, header, 1) != 1) {
+            err = "failed to read xz block header";
+            return -1;
+        }
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block;
+        memset(&block, 0, sizeof block);
+        block.version = 1;
+        block.check = (lzma_check)src->getCheck();
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(header[0]);
+        if (!header[0] || src->readCompressed(comp_pos, header, block.header_size) != block.header_size) {
+            err = "failed to read xz block header";
+            return -1;
+        }
+        lzma_ret rc = lzma_block_header_decode(&block, nullptr, header);
+        if (rc == LZMA_OK) {
+            rc = lzma_block_decoder(&strm, &block);
+            // the decoder keeps its own copy of the filter options
+            for (unsigned i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i) {
+                free(filters[i].options);
+            }
+        }
+        if (rc != LZMA_OK) {
+            err = tar_lzma_error(rc);
+            return -1;
+        }
+        comp_pos += block.header_size;
+        block_start = false;
+        return 0;
+    }
+};
+#endif
+
+#ifdef HAVE_ZLIB
+// Reader inflating a gzip stream from the start or from a checkpoint; data is inflated directly into a
+// circular buffer of the window size, so the window for a new checkpoint is always available
+class TarGzipSeekReader : public TarSeekReader {
+public:
+    DLLLOCAL TarGzipSeekReader(const TarGzipSeekSource* src) : src(src), in_buffer(TAR_BUFFER_SIZE),
+            window(TAR_GZIP_WINDOW_SIZE) {
+        memset(&strm, 0, sizeof strm);
+    }
+
+    DLLLOCAL virtual ~TarGzipSeekReader() {
+        if (init) {
+            inflateEnd(&strm);
+        }
+    }
+
+    //! Positions the reader at the given uncompressed offset; returns -1 and sets the error on failure
+    DLLLOCAL int seek(int64 offset) {
+        if (init) {
+            inflateEnd(&strm);
+            init = false;
+        }
+        memset(&strm, 0, sizeof strm);
+
+        TarGzipCheckpoint cp;
+        if (src->findCheckpoint(offset, cp)) {
+            // checkpoints are inside the deflate data of a member, so decompression resumes in raw mode
+            if (inflateInit2(&strm, -15) != Z_OK) {
+                err = "failed to initialize gzip decompression";
+                return -1;
+            }
+            init = true;
+            if (cp.bits) {
+                unsigned char c;
+                if (src->readCompressed(cp.comp_offset - 1, &c, 1) != 1) {
+                    err = "failed to read compressed data";
+                    return -1;
+                }
+                inflatePrime(&strm, cp.bits, c >> (8 - cp.bits));
+            }
+            inflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(cp.window.data()), cp.window.size());
+            comp_pos = cp.comp_offset;
+            pos = cp.data_offset;
+            raw = true;
+        } else {
+            if (inflateInit2(&strm, 31) != Z_OK) {
+                err = "failed to initialize gzip decompression";
+                return -1;
+            }
+            init = true;
+            comp_pos = pos = 0;
+            raw = false;
+        }
+        discard = offset - pos;
+        win_pos = 0;
+        win_full = false;
+        trailer = 0;
+        member_start = eof = false;
+        return 0;
+    }
+
+    DLLLOCAL virtual la_ssize_t read(const void** buf) override {
+        while (!eof) {
+            if (!strm.avail_in) {
+                la_ssize_t rc = src->readCompressed(comp_pos, in_buffer.data(), in_buffer.size());
+                if (rc < 0) {
+                    err = strerror(errno);
+                    return -1;
+                }
+                if (!rc) {
+                    if (member_start) {
+                        eof = true;
+                        break;
+                    }
+                    err = "unexpected end of compressed data";
+                    return -1;
+                }
+                comp_pos += rc;
+                strm.next_in = in_buffer.data();
+                strm.avail_in = rc;
+            }
+
+            // skip the trailer of a member that was decompressed in raw mode
+            if (trailer) {
+                size_t n = std::min(trailer, (size_t)strm.avail_in);
+                strm.next_in += n;
+                strm.avail_in -= n;
+                trailer -= n;
+                continue;
+            }
+
+            if (win_pos == window.size()) {
+                win_pos = 0;
+                win_full = true;
+            }
+            strm.next_out = window.data() + win_pos;
+            strm.avail_out = window.size() - win_pos;
+            int rc = inflate(&strm, Z_BLOCK);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                // like gzip, ignore trailing garbage after the last member
+                if (member_start && rc == Z_DATA_ERROR) {
+                    eof = true;
+                    break;
+                }
+                err = strm.msg ? strm.msg : "invalid compressed data";
+                return -1;
+            }
+
+            const unsigned char* p = window.data() + win_pos;
+            size_t n = window.size() - win_pos - strm.avail_out;
+            win_pos += n;
+            pos += n;
+
+            if (rc == Z_STREAM_END) {
+                // a further member may follow
+                if (raw) {
+                    trailer = 8;
+                    raw = false;
+                    inflateReset2(&strm, 31);
+                } else {
+                    inflateReset(&strm);
+                }
+                member_start = true;
+            } else if (strm.data_type & 128) {
+                // at a block boundary, or after the header of a member
+                member_start = false;
+                if (!(strm.data_type & 64) && pos >= src->getCheckpointEnd() + src->getInterval()) {
+                    addCheckpoint();
+                }
+            }
+
+            // drop the data before the requested offset
+            if (discard) {
+                size_t d = (size_t)std::min(discard, (int64)n);
+                p += d;
+                n -= d;
+                discard -= d;
+            }
+            if (n) {
+                *buf = p;
+                return n;
+            }
+        }
+        return 0;
+    }
+
+    DLLLOCAL virtual int64 skip(int64 request) override {
+        int64 target = pos + discard + request;
+        // only skip by repositioning if there is a checkpoint after the current position
+        if (src->getCheckpointOffset(target) <= pos) {
+            return 0;
+        }
+        return seek(target) ? -1 : request;
+    }
+
+private:
+    const TarGzipSeekSource* src;
+    z_stream strm;
+    bool init = false;
+    std::vector<unsigned char> in_buffer;
+    std::vector<unsigned char> window;
+    // position of the next byte in the circular window buffer and whether it has wrapped around
+    size_t win_pos = 0;
+    bool win_full = false;
+    // compressed read position
+    int64 comp_pos = 0;
+    // uncompressed offset of the next byte inflated and the number of bytes to drop before returning data
+    int64 pos = 0;
+    int64 discard = 0;
+    // true while decompressing raw deflate data after resuming at a checkpoint
+    bool raw = false;
+    // number of bytes of a member trailer still to be skipped
+    size_t trailer = 0;
+    // true after the end of a member, until the header of the next member has been read
+    bool member_start = false;
+    bool eof = false;
+
+    DLLLOCAL void addCheckpoint() {
+        TarGzipCheckpoint cp;
+        cp.comp_offset = comp_pos - strm.avail_in;
+        cp.data_offset = pos;
+        cp.bits = strm.data_type & 7;
+        const char* w = reinterpret_cast<const char*>(window.data());
+        if (win_full) {
+            cp.window.assign(w + win_pos, window.size() - win_pos);
+            cp.window.append(w, win_pos);
+        } else {
+            cp.window.assign(w, win_pos);
+        }
+        src->addCheckpoint(std::move(cp));
+    }
+};
+#endif
+
+la_ssize_t seek_reader_read_callback(struct archive* a, void* client_data, const void** buffer) {
+    TarSeekReader* reader = static_cast<TarSeekReader*>(client_data);
+    la_ssize_t rc = reader->read(buffer);
+    if (rc < 0) {
+        archive_set_error(a, EIO, "%s", reader->getError());
+        return ARCHIVE_FATAL;
+    }
+    return rc;
+}
+
+la_int64_t seek_reader_skip_callback(struct archive*, void* client_data, la_int64_t request) {
+    return static_cast<TarSeekReader*>(client_data)->skip(request);
+}
+
+int seek_reader_close_callback(struct archive*, void* client_data) {
+    delete static_cast<TarSeekReader*>(client_data);
+    return ARCHIVE_OK;
+}
+}
+
+TarSeekReader* TarMemorySeekSource::openAt(int64 offset, ExceptionSink* xsink) const {
+    if (offset < 0 || (size_t)offset > len) {
+        xsink->raiseException("TAR-ERROR", "invalid archive offset " QLLD, offset);
+        return nullptr;
+    }
+    return new TarMemorySeekReader(data + offset, len - offset);
+}
+
+la_ssize_t TarMemorySeekSource::readAt(int64 offset, void* buf, size_t size) const {
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((size_t)offset >= len) {
+        return 0;
+    }
+    size = std::min(size, len - (size_t)offset);
+    memcpy(buf, data + offset, size);
+    return size;
+}
+
+TarFileMapping::~TarFileMapping() {
+    if (addr) {
+        munmap(addr, len);
+    }
+}
+
+TarFileMapping* TarFileMapping::map(const char* path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return nullptr;
+    }
+    // empty files cannot be mapped
+    void* addr = nullptr;
+    if (st.st_size > 0) {
+        addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return nullptr;
+        }
+    }
+    // the mapping remains valid after the file is closed
+    ::close(fd);
+    return new TarFileMapping(addr, (size_t)st.st_size);
+}
+
+void TarFileMapping::adviseSequential(bool sequential) {
+    int new_advice = sequential ? MADV_SEQUENTIAL : MADV_RANDOM;
+    if (!addr || advice == new_advice) {
+        return;
+    }
+    // the advice is only a hint, so errors are ignored
+    madvise(addr, len, new_advice);
+    advice = new_advice;
+}
+
+TarFileSeekSource::~TarFileSeekSource() {
+    ::close(fd);
+}
+
+TarFileSeekSource* TarFileSeekSource::open(const char* path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return new TarFileSeekSource(fd);
+}
+
+TarSeekReader* TarFileSeekSource::openAt(int64 offset, ExceptionSink* xsink) const {
+    if (offset < 0) {
+        xsink->raiseException("TAR-ERROR", "invalid archive offset " QLLD, offset);
+        return nullptr;
+    }
+    return new TarFileSeekReader(fd, offset);
+}
+
+la_ssize_t TarFileSeekSource::readAt(int64 offset, void* buf, size_t size) const {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rc = pread(fd, static_cast<char*>(buf) + done, size - done, offset + done);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!rc) {
+            break;
+        }
+        done += rc;
+    }
+    return done;
+}
+
+struct archive* tar_open_seek_reader(TarSeekReader* reader, ExceptionSink* xsink, bool all_formats) {
+    std::unique_ptr<TarSeekReader> holder(reader);
+
+    struct archive* a = archive_read_new();
+    if (!a) {
+        xsink->raiseException("TAR-ERROR", "failed to create archive reader");
+        return nullptr;
+    }
+
+    if (all_formats) {
+        archive_read_support_format_all(a);
+        archive_read_support_filter_all(a);
+    } else {
+        // the data is raw tar, so no filters are registered
+        archive_read_support_format_tar(a);
+    }
+
+    archive_read_set_read_callback(a, seek_reader_read_callback);
+    archive_read_set_skip_callback(a, seek_reader_skip_callback);
+    archive_read_set_close_callback(a, seek_reader_close_callback);
+    // from here on the reader is freed by the close callback, also if opening fails
+    archive_read_set_callback_data(a, holder.release());
+    if (archive_read_open1(a) != ARCHIVE_OK) {
+        xsink->raiseException("TAR-ERROR", "failed to open archive for reading: %s", get_archive_error(a));
+        archive_read_free(a);
+        return nullptr;
+    }
+    return a;
+}
+
+#if defined(HAVE_ZSTD) || defined(HAVE_ZLIB)
+namespace {
+uint32_t get_le32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+}
+#endif
+
+TarCompressedSeekSource::~TarCompressedSeekSource() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+int TarCompressedSeekSource::openFile(const char* path, size_t& len) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        ::close(fd);
+        return -1;
+    }
+    len = st.st_size;
+    return fd;
+}
+
+la_ssize_t TarCompressedSeekSource::readCompressed(int64 offset, void* buf, size_t size) const {
+    if (fd < 0) {
+        if ((size_t)offset >= len) {
+            return 0;
+        }
+        size = std::min(size, len - (size_t)offset);
+        memcpy(buf, data + offset, size);
+        return size;
+    }
+    ssize_t rc;
+    while ((rc = pread(fd, buf, size, offset)) < 0 && errno == EINTR) {
+    }
+    return rc;
+}
+
+size_t TarFramedSeekSource::findFrame(int64 offset) const {
+    size_t count = frameCount();
+    std::vector<int64>::const_iterator i = std::upper_bound(data_offsets.begin(), data_offsets.begin() + count,
+        offset);
+    return i == data_offsets.begin() ? 0 : (i - data_offsets.begin()) - 1;
+}
+
+int TarFramedSeekSource::checkOffset(int64 offset, ExceptionSink* xsink) const {
+    if (offset < 0 || offset > frameDataOffset(frameCount())) {
+        xsink->raiseException("TAR-ERROR", "invalid archive offset " QLLD, offset);
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+TarZstdSeekSource* TarZstdSeekSource::open(const char* path) {
+    size_t len;
+    int fd = openFile(path, len);
+    if (fd < 0) {
+        return nullptr;
+    }
+    std::unique_ptr<TarZstdSeekSource> rv(new TarZstdSeekSource(fd, nullptr, len));
+    return rv->readSeekTable() ? nullptr : rv.release();
+}
+
+TarZstdSeekSource* TarZstdSeekSource::open(const void* data, size_t len) {
+    std::unique_ptr<TarZstdSeekSource> rv(new TarZstdSeekSource(-1, static_cast<const char*>(data), len));
+    return rv->readSeekTable() ? nullptr : rv.release();
+}
+
+int TarZstdSeekSource::readSeekTable() {
+    unsigned char footer[TAR_ZSTD_SEEK_FOOTER_SIZE];
+    if (len < 8 + TAR_ZSTD_SEEK_FOOTER_SIZE
+        || readCompressed(len - sizeof footer, footer, sizeof footer) != (la_ssize_t)sizeof footer
+        || get_le32(footer + 5) != TAR_ZSTD_SEEKABLE_MAGIC) {
+        return -1;
+    }
+    size_t count = get_le32(footer);
+    // frame checksums are stored if bit 7 of the descriptor is set
+    size_t entry_size = (footer[4] & 0x80) ? 12 : 8;
+    if (count > (len - 8 - TAR_ZSTD_SEEK_FOOTER_SIZE) / entry_size) {
+        return -1;
+    }
+    size_t table_size = count * entry_size + TAR_ZSTD_SEEK_FOOTER_SIZE;
+    int64 table_start = len - table_size - 8;
+
+    std::vector<unsigned char> table(table_size + 8);
+    if (readCompressed(table_start, table.data(), table.size()) != (la_ssize_t)table.size()
+        || get_le32(table.data()) != TAR_ZSTD_SKIPPABLE_MAGIC || get_le32(table.data() + 4) != table_size) {
+        return -1;
+    }
+
+    comp_offsets.resize(count + 1);
+    data_offsets.resize(count + 1);
+    int64 comp = 0, uncomp = 0;
+    const unsigned char* p = table.data() + 8;
+    for (size_t i = 0; i < count; ++i, p += entry_size) {
+        comp_offsets[i] = comp;
+        data_offsets[i] = uncomp;
+        comp += get_le32(p);
+        uncomp += get_le32(p + 4);
+    }
+    comp_offsets[count] = comp;
+    data_offsets[count] = uncomp;
+
+    // the frames must cover all data before the seek table
+    return comp == table_start ? 0 : -1;
+}
+
+TarSeekReader* TarZstdSeekSource::openAt(int64 offset, ExceptionSink* xsink) const {
+    if (checkOffset(offset, xsink)) {
+        return nullptr;
+    }
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (!dctx) {
+        xsink->raiseException("TAR-ERROR", "failed to create zstd decompression context");
+        return nullptr;
+    }
+    return new TarZstdSeekReader(this, dctx, offset);
+}
+#endif
+
+#ifdef HAVE_LZMA
+TarXzSeekSource* TarXzSeekSource::open(const char* path) {
+    size_t len;
+    int fd = openFile(path, len);
+    if (fd < 0) {
+        return nullptr;
+    }
+    std::unique_ptr<TarXzSeekSource> rv(new TarXzSeekSource(fd, nullptr, len));
+    return rv->readIndex() ? nullptr : rv.release();
+}
+
+TarXzSeekSource* TarXzSeekSource::open(const void* data, size_t len) {
+    std::unique_ptr<TarXzSeekSource> rv(new TarXzSeekSource(-1, static_cast<const char*>(data), len));
+    return rv->readIndex() ? nullptr : rv.release();
+}
+
+int TarXzSeekSource::readIndex() {
+    uint8_t header[LZMA_STREAM_HEADER_SIZE];
+    uint8_t footer[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags header_flags, footer_flags;
+    if (len < 2 * LZMA_STREAM_HEADER_SIZE
+        || readCompressed(0, header, sizeof header) != (la_ssize_t)sizeof header
+        || readCompressed(len - sizeof footer, footer, sizeof footer) != (la_ssize_t)sizeof footer
+        || lzma_stream_header_decode(&header_flags, header) != LZMA_OK
+        || lzma_stream_footer_decode(&footer_flags, footer) != LZMA_OK
+        || lzma_stream_flags_compare(&header_flags, &footer_flags) != LZMA_OK
+        || footer_flags.backward_size > len - 2 * LZMA_STREAM_HEADER_SIZE) {
+        return -1;
+    }
+
+    std::vector<uint8_t> buf(footer_flags.backward_size);
+    int64 index_start = len - sizeof footer - buf.size();
+    if (readCompressed(index_start, buf.data(), buf.size()) != (la_ssize_t)buf.size()) {
+        return -1;
+    }
+    lzma_index* index = nullptr;
+    uint64_t memlimit = UINT64_MAX;
+    size_t in_pos = 0;
+    if (lzma_index_buffer_decode(&index, &memlimit, nullptr, buf.data(), &in_pos, buf.size()) != LZMA_OK) {
+        return -1;
+    }
+    std::unique_ptr<lzma_index, void (*)(lzma_index*)> holder(index, [] (lzma_index* i) {
+        lzma_index_end(i, nullptr);
+    });
+
+    // only single-stream archives are supported, so the stream must make up the whole archive
+    if (lzma_index_file_size(index) != len) {
+        return -1;
+    }
+
+    lzma_index_iter iter;
+    lzma_index_iter_init(&iter, index);
+    while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+        comp_offsets.push_back(iter.block.compressed_file_offset);
+        data_offsets.push_back(iter.block.uncompressed_file_offset);
+    }
+    comp_offsets.push_back(index_start);
+    data_offsets.push_back(lzma_index_uncompressed_size(index));
+    check = footer_flags.check;
+
+    // archives with a single block can only be read sequentially
+    return frameCount() > 1 ? 0 : -1;
+}
+
+TarSeekReader* TarXzSeekSource::openAt(int64 offset, ExceptionSink* xsink) const {
+    if (checkOffset(offset, xsink)) {
+        return nullptr;
+    }
+    return new TarXzSeekReader(this, offset);
+}
+#endif
+
+#ifdef HAVE_ZLIB
+namespace {
+void put_le64(std::string& buf, uint64_t v) {
+    for (unsigned i = 0; i < 8; ++i) {
+        buf.push_back((char)(v >> (i * 8)));
+    }
+}
+
+uint64_t get_le64(const unsigned char* p) {
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+// checkpoint section layout: u64 count, u64 interval, then for each checkpoint: u64 compressed offset,
+// u64 uncompressed offset, u32 bits, u32 window length and the window padded to 8 bytes
+#define TAR_GZIP_CP_HEADER_SIZE 24
+}
+
+TarGzipSeekSource* TarGzipSeekSource::open(const char* path, int64 interval) {
+    size_t len;
+    int fd = openFile(path, len);
+    return fd < 0 ? nullptr : new TarGzipSeekSource(fd, nullptr, len, interval);
+}
+
+TarSeekReader* TarGzipSeekSource::openAt(int64 offset, ExceptionSink* xsink) const {
+    if (offset < 0) {
+        xsink->raiseException("TAR-ERROR", "invalid archive offset " QLLD, offset);
+        return nullptr;
+    }
+    std::unique_ptr<TarGzipSeekReader> reader(new TarGzipSeekReader(this));
+    if (reader->seek(offset)) {
+        xsink->raiseException("TAR-ERROR", "failed to open gzip archive at offset " QLLD ": %s", offset,
+            reader->getError());
+        return nullptr;
+    }
+    return reader.release();
+}
+
+int64 TarGzipSeekSource::getCheckpointEnd() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return checkpoints.empty() ? 0 : checkpoints.back().data_offset;
+}
+
+int64 TarGzipSeekSource::getCheckpointOffset(int64 offset) const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<TarGzipCheckpoint>::const_iterator i = std::upper_bound(checkpoints.begin(), checkpoints.end(),
+        offset, [](int64 offset, const TarGzipCheckpoint& cp) { return offset < cp.data_offset; });
+    return i == checkpoints.begin() ? 0 : (i - 1)->data_offset;
+}
+
+void TarGzipSeekSource::addCheckpoint(TarGzipCheckpoint&& cp) const {
+    std::lock_guard<std::mutex> guard(lock);
+    if (checkpoints.empty() || cp.data_offset > checkpoints.back().data_offset) {
+        checkpoints.push_back(std::move(cp));
+    }
+}
+
+bool TarGzipSeekSource::findCheckpoint(int64 offset, TarGzipCheckpoint& cp) const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<TarGzipCheckpoint>::const_iterator i = std::upper_bound(checkpoints.begin(), checkpoints.end(),
+        offset, [](int64 offset, const TarGzipCheckpoint& cp) { return offset < cp.data_offset; });
+    if (i == checkpoints.begin()) {
+        return false;
+    }
+    cp = *(i - 1);
+    return true;
+}
+
+size_t TarGzipSeekSource::checkpointCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return checkpoints.size();
+}
+
+void TarGzipSeekSource::serialize(std::string& buf) const {
+    std::lock_guard<std::mutex> guard(lock);
+    put_le64(buf, checkpoints.size());
+    put_le64(buf, interval);
+    for (const TarGzipCheckpoint& cp : checkpoints) {
+        put_le64(buf, cp.comp_offset);
+        put_le64(buf, cp.data_offset);
+        put_le64(buf, (uint64_t)cp.bits | ((uint64_t)cp.window.size() << 32));
+        buf.append(cp.window);
+        buf.append((8 - (cp.window.size() & 7)) & 7, '\0');
+    }
+}
+
+int TarGzipSeekSource::deserialize(const char* buf, size_t size) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(buf);
+    const unsigned char* end = p + size;
+    if (size < 16) {
+        return -1;
+    }
+    uint64_t count = get_le64(p);
+    int64 stored_interval = (int64)get_le64(p + 8);
+    p += 16;
+    if (count > size / TAR_GZIP_CP_HEADER_SIZE || stored_interval <= 0) {
+        return -1;
+    }
+
+    std::vector<TarGzipCheckpoint> cps(count);
+    for (TarGzipCheckpoint& cp : cps) {
+        if ((size_t)(end - p) < TAR_GZIP_CP_HEADER_SIZE) {
+            return -1;
+        }
+        cp.comp_offset = (int64)get_le64(p);
+        cp.data_offset = (int64)get_le64(p + 8);
+        cp.bits = (int)get_le32(p + 16);
+        size_t window_len = get_le32(p + 20);
+        p += TAR_GZIP_CP_HEADER_SIZE;
+        size_t padded = (window_len + 7) & ~(size_t)7;
+        if (cp.bits < 0 || cp.bits > 7 || window_len > TAR_GZIP_WINDOW_SIZE || (size_t)(end - p) < padded
+            || cp.comp_offset < (cp.bits ? 1 : 0) || (uint64_t)cp.comp_offset > len
+            || (&cp != &cps[0] && cp.data_offset <= (&cp - 1)->data_offset)) {
+            return -1;
+        }
+        cp.window.assign(reinterpret_cast<const char*>(p), window_len);
+        p += padded;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    interval = stored_interval;
+    checkpoints = std::move(cps);
+    return 0;
+}
+#endif
@@ -0,0 +1,372 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarSeekSource.h random-access archive data source classes */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARSEEKSOURCE_H
+#define _QORE_TAR_TARSEEKSOURCE_H
+
+#include "tar-module.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Sequential reader returning uncompressed tar data from a given offset
+class TarSeekReader {
+public:
+    DLLLOCAL virtual ~TarSeekReader() {
+    }
+
+    //! Returns the next block of data
+    /** @return the number of bytes available in \a buffer, 0 at the end of the data, or -1 on error, in which
+        case getError() returns the error message
+    */
+    DLLLOCAL virtual la_ssize_t read(const void** buffer) = 0;
+
+    //! Skips data without returning it
+    /** @return the number of bytes skipped, which may be less than requested; 0 if skipping is not supported
+    */
+    DLLLOCAL virtual int64 skip(int64 request) {
+        return 0;
+    }
+
+    //! Returns the last error message
+    DLLLOCAL const char* getError() const {
+        return err.c_str();
+    }
+
+protected:
+    std::string err;
+};
+
+//! Random-access source of uncompressed tar data
+/** Each reader returned by openAt() has its own position; sources can be used by several readers at once.
+*/
+class TarSeekSource {
+public:
+    DLLLOCAL virtual ~TarSeekSource() {
+    }
+
+    //! Returns a new reader positioned at the given uncompressed offset
+    /** @return the new reader (owned by the caller), or nullptr if an exception was raised
+    */
+    DLLLOCAL virtual TarSeekReader* openAt(int64 offset, ExceptionSink* xsink) const = 0;
+};
+
+//! Base class for seek sources for uncompressed archives, where uncompressed offsets are also source offsets
+class TarRawSeekSource : public TarSeekSource {
+public:
+    //! Reads data at the given offset
+    /** @return the number of bytes read, which is less than requested only at the end of the data, or -1 on
+        error with errno set
+    */
+    DLLLOCAL virtual la_ssize_t readAt(int64 offset, void* buf, size_t len) const = 0;
+};
+
+//! Seek source for an uncompressed archive held in memory
+class TarMemorySeekSource : public TarRawSeekSource {
+public:
+    //! The data must remain valid for the lifetime of the source and all of its readers
+    DLLLOCAL TarMemorySeekSource(const void* data, size_t len) : data(static_cast<const char*>(data)), len(len) {
+    }
+
+    DLLLOCAL virtual TarSeekReader* openAt(int64 offset, ExceptionSink* xsink) const override;
+
+    DLLLOCAL virtual la_ssize_t readAt(int64 offset, void* buf, size_t len) const override;
+
+private:
+    const char* data;
+    size_t len;
+};
+
+//! Seek source for an uncompressed archive file; reads use pread() so readers do not share a file position
+class TarFileSeekSource : public TarRawSeekSource {
+public:
+    DLLLOCAL virtual ~TarFileSeekSource();
+
+    //! Opens the given file; returns nullptr if the file cannot be opened
+    DLLLOCAL static TarFileSeekSource* open(const char* path);
+
+    DLLLOCAL virtual TarSeekReader* openAt(int64 offset, ExceptionSink* xsink) const override;
+
+    DLLLOCAL virtual la_ssize_t readAt(int64 offset, void* buf, size_t len) const override;
+
+private:
+    int fd;
+
+    DLLLOCAL TarFileSeekSource(int fd) : fd(fd) {
+    }
+};
+
+//! Read-only memory mapping of an archive file
+/** The mapping is shared with the page cache, so several archives mapping the same file do not use additional
+    memory.  The file must not be truncated while it is mapped.
+*/
+class TarFileMapping {
+public:
+    DLLLOCAL ~TarFileMapping();
+
+    //! Maps the given file; returns nullptr with errno set if the file cannot be mapped
+    DLLLOCAL static TarFileMapping* map(const char* path);
+
+    //! Returns the mapped data; nullptr for an empty file
+    DLLLOCAL const char* data() const {
+        return static_cast<const char*>(addr);
+    }
+
+    //! Returns the size of the mapped data
+    DLLLOCAL size_t size() const {
+        return len;
+    }
+
+    //! Tells the kernel whether the data will be read sequentially or at random offsets
+    /** Sequential access enables aggressive read-ahead; random access disables read-ahead, so that lookups of
+        single entries only read the pages they need.
+    */
+    DLLLOCAL void adviseSequential(bool sequential);
+
+private:
+    void* addr;
+    size_t len;
+    //! The current advice; -1 = none given
+    int advice = -1;
+
+    DLLLOCAL TarFileMapping(void* addr, size_t len) : addr(addr), len(len) {
+    }
+};
+
+//! Base class for seek sources reading compressed data from a file or from memory
+class TarCompressedSeekSource : public TarSeekSource {
+public:
+    DLLLOCAL virtual ~TarCompressedSeekSource();
+
+    //! Reads compressed data at the given offset
+    /** @return the number of bytes read, or -1 on error with errno set
+    */
+    DLLLOCAL la_ssize_t readCompressed(int64 offset, void* buf, size_t len) const;
+
+    //! Returns the size of the compressed data
+    DLLLOCAL int64 compressedSize() const {
+        return len;
+    }
+
+protected:
+    // the file descriptor, or -1 if the data is held in memory
+    int fd;
+    const char* data;
+    size_t len;
+
+    DLLLOCAL TarCompressedSeekSource(int fd, const char* data, size_t len) : fd(fd), data(data), len(len) {
+    }
+
+    //! Opens the given file for reading and returns its size in \a len; returns -1 on error
+    DLLLOCAL static int openFile(const char* path, size_t& len);
+};
+
+//! Base class for seek sources for archives compressed as independently decompressible frames
+/** Readers decompress only the frames from the one holding the requested offset onwards, and skip requests
+    that reach a later frame reposition the reader at that frame instead of decompressing the data in between.
+*/
+class TarFramedSeekSource : public TarCompressedSeekSource {
+public:
+    //! Returns the number of frames
+    DLLLOCAL size_t frameCount() const {
+        return data_offsets.size() - 1;
+    }
+
+    //! Returns the compressed offset of the given frame; frameCount() returns the end of the last frame
+    DLLLOCAL int64 frameCompressedOffset(size_t i) const {
+        return comp_offsets[i];
+    }
+
+    //! Returns the uncompressed offset of the given frame; frameCount() returns the uncompressed size
+    DLLLOCAL int64 frameDataOffset(size_t i) const {
+        return data_offsets[i];
+    }
+
+    //! Returns the frame holding the given uncompressed offset
+    DLLLOCAL size_t findFrame(int64 offset) const;
+
+protected:
+    // compressed and uncompressed start offsets of each frame, followed by the end offsets
+    std::vector<int64> comp_offsets;
+    std::vector<int64> data_offsets;
+
+    DLLLOCAL TarFramedSeekSource(int fd, const char* data, size_t len) : TarCompressedSeekSource(fd, data, len) {
+    }
+
+    //! Checks that the offset is within the uncompressed data; raises an exception if not
+    DLLLOCAL int checkOffset(int64 offset, ExceptionSink* xsink) const;
+};
+
+#ifdef HAVE_ZSTD
+//! Seek source for a seekable zstd archive
+class TarZstdSeekSource : public TarFramedSeekSource {
+public:
+    //! Opens the given archive file; returns nullptr if it cannot be opened or has no valid seek table
+    DLLLOCAL static TarZstdSeekSource* open(const char* path);
+
+    //! Uses the given in-memory archive; returns nullptr if it has no valid seek table
+    /** The data must remain valid for the lifetime of the source and all of its readers
+    */
+    DLLLOCAL static TarZstdSeekSource* open(const void* data, size_t len);
+
+    DLLLOCAL virtual TarSeekReader* openAt(int64 offset, ExceptionSink* xsink) const override;
+
+private:
+    DLLLOCAL TarZstdSeekSource(int fd, const char* data, size_t len) : TarFramedSeekSource(fd, data, len) {
+    }
+
+    //! Reads and checks the seek table; returns -1 if the archive has no valid seek table
+    DLLLOCAL int readSeekTable();
+};
+#endif
+
+#ifdef HAVE_LZMA
+//! Seek source for an xz archive with multiple blocks
+/** The blocks are found with the index at the end of the xz stream; each frame of the source is an xz block.
+*/
+class TarXzSeekSource : public TarFramedSeekSource {
+public:
+    //! Opens the given archive file; returns nullptr if it cannot be opened or has no valid index
+    DLLLOCAL static TarXzSeekSource* open(const char* path);
+
+    //! Uses the given in-memory archive; returns nullptr if it has no valid index
+    /** The data must remain valid for the lifetime of the source and all of its readers
+    */
+    DLLLOCAL static TarXzSeekSource* open(const void* data, size_t len);
+
+    DLLLOCAL virtual TarSeekReader* openAt(int64 offset, ExceptionSink* xsink) const override;
+
+    //! Returns the integrity check type of the blocks
+    DLLLOCAL int getCheck() const {
+        return check;
+    }
+
+private:
+    // lzma_check type of the stream
+    int check = 0;
+
+    DLLLOCAL TarXzSeekSource(int fd, const char* data, size_t len) : TarFramedSeekSource(fd, data, len) {
+    }
+
+    //! Reads the stream footer and the index; returns -1 if the archive is not a single xz stream with a
+    //! valid index and more than one block
+    DLLLOCAL int readIndex();
+};
+#endif
+
+//! Size of the inflate window stored with each gzip checkpoint
+#define TAR_GZIP_WINDOW_SIZE                    32768
+//! Default uncompressed distance between gzip checkpoints
+#define TAR_GZIP_DEFAULT_CHECKPOINT_INTERVAL    (16 * 1024 * 1024)
+//! Minimum uncompressed distance between gzip checkpoints
+#define TAR_GZIP_MIN_CHECKPOINT_INTERVAL        (1024 * 1024)
+
+#ifdef HAVE_ZLIB
+
+//! Point in a gzip stream where decompression can be resumed
+struct TarGzipCheckpoint {
+    //! Offset of the first compressed byte that has not been fully consumed
+    int64 comp_offset;
+    //! Uncompressed offset
+    int64 data_offset;
+    //! Number of bits of the byte before comp_offset that are still to be consumed
+    int bits;
+    //! Up to TAR_GZIP_WINDOW_SIZE bytes of uncompressed data before data_offset
+    std::string window;
+};
+
+//! Seek source for an ordinary gzip-compressed archive
+/** Gzip streams cannot be decompressed from an arbitrary offset, so readers record checkpoints at deflate
+    block boundaries about every checkpoint interval bytes of uncompressed data the first time they pass
+    through the stream.  Readers opened later resume decompression at the last checkpoint before the requested
+    offset, and skip requests that reach past a later checkpoint reposition the reader at that checkpoint.
+
+    Checkpoints are shared by all readers of the source and can be stored in an index file with serialize().
+*/
+class TarGzipSeekSource : public TarCompressedSeekSource {
+public:
+    //! Opens the given archive file; returns nullptr if it cannot be opened
+    DLLLOCAL static TarGzipSeekSource* open(const char* path, int64 interval);
+
+    DLLLOCAL virtual TarSeekReader* openAt(int64 offset, ExceptionSink* xsink) const override;
+
+    //! Returns the minimum uncompressed distance between checkpoints
+    DLLLOCAL int64 getInterval() const {
+        return interval;
+    }
+
+    //! Returns the uncompressed offset after which no checkpoints have been recorded yet
+    DLLLOCAL int64 getCheckpointEnd() const;
+
+    //! Returns the uncompressed offset of the last checkpoint at or before the given offset, or 0 if none
+    DLLLOCAL int64 getCheckpointOffset(int64 offset) const;
+
+    //! Adds a checkpoint after the last one; ignored if it does not follow the last checkpoint
+    DLLLOCAL void addCheckpoint(TarGzipCheckpoint&& cp) const;
+
+    //! Returns the last checkpoint at or before the given uncompressed offset
+    /** @return false if there is no such checkpoint, in which case decompression starts at the beginning
+    */
+    DLLLOCAL bool findCheckpoint(int64 offset, TarGzipCheckpoint& cp) const;
+
+    //! Returns the number of checkpoints
+    DLLLOCAL size_t checkpointCount() const;
+
+    //! Appends the checkpoints to the given buffer in index file format
+    DLLLOCAL void serialize(std::string& buf) const;
+
+    //! Replaces the checkpoints with those in the given buffer; returns -1 if the data is invalid
+    DLLLOCAL int deserialize(const char* buf, size_t len);
+
+private:
+    int64 interval;
+    // checkpoints are added by readers, so they are protected by the lock
+    mutable std::mutex lock;
+    // checkpoints in uncompressed offset order
+    mutable std::vector<TarGzipCheckpoint> checkpoints;
+
+    DLLLOCAL TarGzipSeekSource(int fd, const char* data, size_t len, int64 interval)
+            : TarCompressedSeekSource(fd, data, len), interval(interval) {
+    }
+};
+#endif
+
+//! Creates a libarchive reader for the raw tar data returned by the given reader
+/** The archive takes ownership of the reader and deletes it when the archive is closed.
+
+    @param reader the reader
+    @param xsink for exceptions
+    @param all_formats if true, all archive formats and filters are supported as for archive files; otherwise the
+    data must be raw tar data
+
+    @return the open archive, or nullptr if an exception was raised
+*/
+DLLLOCAL struct archive* tar_open_seek_reader(TarSeekReader* reader, ExceptionSink* xsink,
+                                              bool all_formats = false);
+
+#endif // _QORE_TAR_TARSEEKSOURCE_H
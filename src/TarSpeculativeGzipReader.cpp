@@ -0,0 +1,832 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarSpeculativeGzipReader.cpp multi-threaded decompression of gzip archives with few members */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarSpeculativeGzipReader.h"
+
+#ifdef HAVE_ZLIB
+#include "TarParallelReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+#include <zlib.h>
+
+// number of code bits decoded with a single table lookup; longer codes are decoded bit by bit
+#define TAR_HUFFMAN_LUT_BITS 10
+
+namespace {
+// base lengths and extra bits of the length symbols 257 - 285
+const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227,
+    258,
+};
+const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+// base distances and extra bits of the distance symbols 0 - 29
+const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577,
+};
+const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+// order of the code lengths of the code length code in a dynamic block header
+const uint8_t code_length_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+uint32_t get_le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+}
+
+//! A canonical Huffman code of a deflate block
+struct TarHuffman {
+    // symbol << 4 | code length for each value of the next TAR_HUFFMAN_LUT_BITS bits; 0 for longer codes
+    uint16_t lut[1 << TAR_HUFFMAN_LUT_BITS];
+    // number of codes of each length, and the symbols in code order
+    uint16_t count[16];
+    uint16_t symbol[288];
+
+    //! Builds the code from the code lengths of the symbols; returns -1 if the code is not valid
+    /** @param lengths the code length of each symbol, 0 if the symbol is not used
+        @param n the number of symbols
+        @param codes true for the code length code, which must be complete; other codes can only be incomplete if
+        they have a single code
+    */
+    int build(const uint8_t* lengths, unsigned n, bool codes);
+};
+
+int TarHuffman::build(const uint8_t* lengths, unsigned n, bool codes) {
+    memset(count, 0, sizeof count);
+    memset(lut, 0, sizeof lut);
+    for (unsigned i = 0; i < n; ++i) {
+        ++count[lengths[i]];
+    }
+    if (count[0] == n) {
+        // a block without distance codes can only contain literals; using such a code fails when decoding
+        return codes ? -1 : 0;
+    }
+    int left = 1;
+    unsigned max = 0;
+    for (unsigned l = 1; l < 16; ++l) {
+        left = (left << 1) - count[l];
+        if (left < 0) {
+            return -1;
+        }
+        if (count[l]) {
+            max = l;
+        }
+    }
+    if (left > 0 && (codes || max != 1)) {
+        return -1;
+    }
+
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (unsigned l = 1; l < 15; ++l) {
+        offsets[l + 1] = offsets[l] + count[l];
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        if (lengths[i]) {
+            symbol[offsets[lengths[i]]++] = (uint16_t)i;
+        }
+    }
+
+    // codes are stored starting with their most significant bit, so the table is indexed by reversed codes
+    unsigned code = 0;
+    unsigned k = 0;
+    for (unsigned l = 1; l <= TAR_HUFFMAN_LUT_BITS; ++l, code <<= 1) {
+        for (unsigned j = 0; j < count[l]; ++j, ++k, ++code) {
+            unsigned r = 0;
+            for (unsigned b = 0; b < l; ++b) {
+                r |= ((code >> b) & 1) << (l - 1 - b);
+            }
+            uint16_t e = (uint16_t)(symbol[k] << 4 | l);
+            for (; r < (1u << TAR_HUFFMAN_LUT_BITS); r += 1u << l) {
+                lut[r] = e;
+            }
+        }
+    }
+    return 0;
+}
+
+namespace {
+// The codes of fixed Huffman blocks
+struct TarFixedCodes {
+    TarHuffman lit;
+    TarHuffman dist;
+
+    TarFixedCodes() {
+        uint8_t lengths[288];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        lit.build(lengths, 288, false);
+        // distance symbols 30 and 31 are part of the code but invalid
+        memset(lengths, 5, 32);
+        dist.build(lengths, 32, false);
+    }
+};
+
+const TarFixedCodes fixed_codes;
+}
+
+//! Decompresses deflate data block by block into 16-bit symbols
+/** Back-references to data before the start of decompression are stored as markers: 0x8000 plus the position in
+    the TAR_DEFLATE_WINDOW_SIZE bytes preceding the start.
+*/
+class TarInflater {
+public:
+    // bit offset of the next block, or of the next gzip member header if at_header is set
+    int64 pos = 0;
+    bool at_header = false;
+    // decompressed symbols; only the first n are used
+    std::vector<uint16_t> out;
+    size_t n = 0;
+    // trailers of the members ended
+    std::vector<TarGzipMemberEnd> members;
+    // error message after a failure
+    const char* err = nullptr;
+
+    DLLLOCAL TarInflater(const char* data, size_t len, size_t max_output)
+        : data(reinterpret_cast<const unsigned char*>(data)), len(len), total((int64)len * 8),
+          max_output(max_output) {
+    }
+
+    //! Starts decompressing at a block or gzip member header
+    /** @param offset the bit offset to start at
+        @param header true if a gzip member header starts at the offset
+        @param window the data preceding the offset, or nullptr if it is not known
+    */
+    DLLLOCAL void reset(int64 offset, bool header, const std::string* window);
+
+    //! Decompresses the next block, reading the gzip member header first if at_header is set
+    /** After the last block of a member the trailer is read and at_header is set.
+
+        @return 1 if a block was decompressed, 0 if there is no gzip member at the header offset, -1 on error
+    */
+    DLLLOCAL int next();
+
+    //! Returns false if no valid block header can start at the given bit offset
+    DLLLOCAL bool maybeBlock(int64 offset) const {
+        uint64_t v = peek(offset);
+        switch ((v >> 1) & 3) {
+            case 2:
+                // the number of length and distance codes
+                return ((v >> 3) & 31) < 30 && ((v >> 8) & 31) < 30;
+            case 3:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    //! Returns true if a dynamic Huffman block header can start at the given bit offset
+    DLLLOCAL bool maybeDynamicBlock(int64 offset) const {
+        return ((peek(offset) >> 1) & 3) == 2 && maybeBlock(offset);
+    }
+
+    //! Discards the member trailers and the symbols decompressed, except for the last TAR_DEFLATE_WINDOW_SIZE
+    DLLLOCAL void compact();
+
+private:
+    const unsigned char* data;
+    size_t len;
+    int64 total;
+    size_t max_output;
+    // symbol offset of the start of the member being decompressed; negative if the data before the start of
+    // decompression is not known
+    int64 member_start = 0;
+    // the codes of the current dynamic block
+    TarHuffman lit;
+    TarHuffman dist;
+
+    //! Returns at least 56 bits at the given bit offset, with zero bits after the end of the data
+    DLLLOCAL uint64_t peek(int64 offset) const {
+        size_t i = (size_t)(offset >> 3);
+        uint64_t v = 0;
+        if (i + 8 <= len) {
+            memcpy(&v, data + i, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            v = __builtin_bswap64(v);
+#endif
+        } else {
+            for (size_t j = i; j < len; ++j) {
+                v |= (uint64_t)data[j] << ((j - i) * 8);
+            }
+        }
+        return v >> (offset & 7);
+    }
+
+    //! Returns the next bits
+    DLLLOCAL unsigned bits(unsigned count) {
+        unsigned v = (unsigned)(peek(pos) & ((1u << count) - 1));
+        pos += count;
+        return v;
+    }
+
+    //! Returns the next symbol, or -1 if the bits are not a valid code
+    DLLLOCAL int decode(const TarHuffman& h) {
+        uint64_t v = peek(pos);
+        unsigned e = h.lut[v & ((1u << TAR_HUFFMAN_LUT_BITS) - 1)];
+        if (e) {
+            pos += e & 15;
+            return (int)(e >> 4);
+        }
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (unsigned l = 1; l < 16; ++l) {
+            code |= (int)((v >> (l - 1)) & 1);
+            int count = h.count[l];
+            if (code - count < first) {
+                pos += l;
+                return h.symbol[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    //! Makes room for the given number of symbols; returns -1 if more than max_output symbols would be stored
+    DLLLOCAL int reserve(size_t count);
+
+    //! Reads a gzip member header; returns 1 if read, 0 if there is none, -1 on error
+    DLLLOCAL int readGzipHeader();
+
+    //! Reads the codes of a dynamic Huffman block
+    DLLLOCAL int readDynamicHeader();
+
+    DLLLOCAL int inflateStored();
+
+    DLLLOCAL int inflateHuffman(const TarHuffman& lc, const TarHuffman& dc);
+};
+
+void TarInflater::reset(int64 offset, bool header, const std::string* window) {
+    pos = offset;
+    at_header = header;
+    members.clear();
+    err = nullptr;
+    n = 0;
+    if (window) {
+        out.resize(std::max(out.size(), window->size() + 65536));
+        for (unsigned char c : *window) {
+            out[n++] = c;
+        }
+        member_start = 0;
+    } else {
+        member_start = -TAR_DEFLATE_WINDOW_SIZE;
+    }
+}
+
+void TarInflater::compact() {
+    members.clear();
+    if (n <= TAR_DEFLATE_WINDOW_SIZE) {
+        return;
+    }
+    size_t drop = n - TAR_DEFLATE_WINDOW_SIZE;
+    memmove(&out[0], &out[drop], TAR_DEFLATE_WINDOW_SIZE * sizeof(uint16_t));
+    n = TAR_DEFLATE_WINDOW_SIZE;
+    member_start = std::max(member_start - (int64)drop, (int64)0);
+}
+
+int TarInflater::reserve(size_t count) {
+    if (n + count > max_output) {
+        err = "too much data in chunk";
+        return -1;
+    }
+    out.resize(std::max(n + count, std::min(out.size() * 2 + 65536, max_output)));
+    return 0;
+}
+
+int TarInflater::next() {
+    if (at_header) {
+        int rc = readGzipHeader();
+        if (rc <= 0) {
+            return rc;
+        }
+    }
+    if (pos + 3 > total) {
+        err = "unexpected end of compressed data";
+        return -1;
+    }
+    unsigned final = bits(1);
+    int rc;
+    switch (bits(2)) {
+        case 0:
+            rc = inflateStored();
+            break;
+        case 1:
+            rc = inflateHuffman(fixed_codes.lit, fixed_codes.dist);
+            break;
+        case 2:
+            rc = readDynamicHeader() ? -1 : inflateHuffman(lit, dist);
+            break;
+        default:
+            err = "invalid block type";
+            rc = -1;
+            break;
+    }
+    if (rc) {
+        return -1;
+    }
+    if (final) {
+        // the trailer follows the last block at the next byte boundary
+        size_t i = (size_t)((pos + 7) >> 3);
+        if (i + 8 > len) {
+            err = "unexpected end of compressed data";
+            return -1;
+        }
+        members.push_back({n, get_le32(data + i), get_le32(data + i + 4)});
+        pos = (int64)(i + 8) * 8;
+        at_header = true;
+    }
+    return 1;
+}
+
+int TarInflater::readGzipHeader() {
+    size_t i = (size_t)(pos >> 3);
+    if (i >= len || !tar_is_gzip_header(data + i, len - i)) {
+        return 0;
+    }
+    unsigned flags = data[i + 3];
+    i += 10;
+    // extra field, file name, comment and header CRC
+    if (flags & 4) {
+        if (i + 2 > len) {
+            err = "unexpected end of compressed data";
+            return -1;
+        }
+        i += 2 + (data[i] | data[i + 1] << 8);
+    }
+    for (unsigned f = 8; f <= 16; f <<= 1) {
+        if (flags & f) {
+            while (i < len && data[i]) {
+                ++i;
+            }
+            ++i;
+        }
+    }
+    if (flags & 2) {
+        i += 2;
+    }
+    if (i > len) {
+        err = "unexpected end of compressed data";
+        return -1;
+    }
+    pos = (int64)i * 8;
+    at_header = false;
+    member_start = (int64)n;
+    return 1;
+}
+
+int TarInflater::readDynamicHeader() {
+    unsigned nlen = bits(5) + 257;
+    unsigned ndist = bits(5) + 1;
+    unsigned ncode = bits(4) + 4;
+    if (nlen > 286 || ndist > 30) {
+        err = "too many length or distance symbols";
+        return -1;
+    }
+    uint8_t lengths[286 + 30];
+    memset(lengths, 0, 19);
+    for (unsigned i = 0; i < ncode; ++i) {
+        lengths[code_length_order[i]] = (uint8_t)bits(3);
+    }
+    // the code length code is only needed until the other codes are built
+    TarHuffman& cl = lit;
+    if (cl.build(lengths, 19, true)) {
+        err = "invalid code lengths set";
+        return -1;
+    }
+    unsigned i = 0;
+    while (i < nlen + ndist) {
+        int sym = decode(cl);
+        if (sym < 0) {
+            err = "invalid code lengths set";
+            return -1;
+        }
+        if (sym < 16) {
+            lengths[i++] = (uint8_t)sym;
+            continue;
+        }
+        unsigned repeat;
+        uint8_t value = 0;
+        if (sym == 16) {
+            if (!i) {
+                err = "invalid bit length repeat";
+                return -1;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + bits(2);
+        } else if (sym == 17) {
+            repeat = 3 + bits(3);
+        } else {
+            repeat = 11 + bits(7);
+        }
+        if (i + repeat > nlen + ndist) {
+            err = "invalid bit length repeat";
+            return -1;
+        }
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+    if (!lengths[256]) {
+        err = "invalid code -- missing end-of-block";
+        return -1;
+    }
+    if (lit.build(lengths, nlen, false)) {
+        err = "invalid literal/lengths set";
+        return -1;
+    }
+    if (dist.build(lengths + nlen, ndist, false)) {
+        err = "invalid distances set";
+        return -1;
+    }
+    return 0;
+}
+
+int TarInflater::inflateStored() {
+    size_t i = (size_t)((pos + 7) >> 3);
+    if (i + 4 > len) {
+        err = "unexpected end of compressed data";
+        return -1;
+    }
+    unsigned size = data[i] | data[i + 1] << 8;
+    if (size != (~(data[i + 2] | data[i + 3] << 8) & 0xffff)) {
+        err = "invalid stored block lengths";
+        return -1;
+    }
+    i += 4;
+    if (i + size > len) {
+        err = "unexpected end of compressed data";
+        return -1;
+    }
+    if (n + size > out.size() && reserve(size)) {
+        return -1;
+    }
+    for (unsigned j = 0; j < size; ++j) {
+        out[n++] = data[i + j];
+    }
+    pos = (int64)(i + size) * 8;
+    return 0;
+}
+
+int TarInflater::inflateHuffman(const TarHuffman& lc, const TarHuffman& dc) {
+    while (true) {
+        if (pos > total) {
+            err = "unexpected end of compressed data";
+            return -1;
+        }
+        if (n + 258 > out.size() && reserve(258)) {
+            return -1;
+        }
+        int sym = decode(lc);
+        if (sym < 256) {
+            if (sym < 0) {
+                err = "invalid literal/length code";
+                return -1;
+            }
+            out[n++] = (uint16_t)sym;
+            continue;
+        }
+        if (sym == 256) {
+            if (pos > total) {
+                err = "unexpected end of compressed data";
+                return -1;
+            }
+            return 0;
+        }
+        sym -= 257;
+        if (sym >= 29) {
+            err = "invalid literal/length code";
+            return -1;
+        }
+        unsigned length = length_base[sym] + bits(length_extra[sym]);
+        sym = decode(dc);
+        if (sym < 0 || sym >= 30) {
+            err = "invalid distance code";
+            return -1;
+        }
+        int64 distance = distance_base[sym] + bits(distance_extra[sym]);
+        if (distance > (int64)n - member_start) {
+            err = "invalid distance too far back";
+            return -1;
+        }
+        uint16_t* o = &out[n];
+        if (distance <= (int64)n) {
+            const uint16_t* s = o - distance;
+            for (unsigned i = 0; i < length; ++i) {
+                o[i] = s[i];
+            }
+        } else {
+            // the start of the match is in the unknown window
+            for (unsigned i = 0; i < length; ++i) {
+                int64 s = (int64)(n + i) - distance;
+                o[i] = s >= 0 ? out[s] : (uint16_t)(0x8000 | (s + TAR_DEFLATE_WINDOW_SIZE));
+            }
+        }
+        n += length;
+    }
+}
+
+TarSpeculativeGzipReader::TarSpeculativeGzipReader(const char* data, size_t len) : data(data), len(len) {
+}
+
+TarSpeculativeGzipReader::~TarSpeculativeGzipReader() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    work_cond.notify_all();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+TarSpeculativeGzipReader* TarSpeculativeGzipReader::create(const char* data, size_t len, unsigned threads,
+                                                           std::shared_ptr<TarSpeculativeGzipStats> stats) {
+    if (!tar_is_gzip_header(reinterpret_cast<const unsigned char*>(data), len)) {
+        return nullptr;
+    }
+    std::unique_ptr<TarSpeculativeGzipReader> reader(new TarSpeculativeGzipReader(data, len));
+    reader->stats = std::move(stats);
+    if (reader->start(threads)) {
+        return nullptr;
+    }
+    return reader.release();
+}
+
+int TarSpeculativeGzipReader::start(unsigned count) {
+    // two chunks per thread keep all threads busy while completed chunks are read
+    max_chunks = count * 2;
+    for (unsigned i = 0; i < count; ++i) {
+        try {
+            threads.emplace_back([this] () { run(); });
+        } catch (std::system_error&) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void TarSpeculativeGzipReader::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        while (work.empty() && !stop) {
+            work_cond.wait(guard);
+        }
+        if (stop) {
+            return;
+        }
+        std::shared_ptr<Chunk> chunk = work.front();
+        work.pop_front();
+
+        if (!chunk->cancelled) {
+            guard.unlock();
+            decompress(*chunk);
+            guard.lock();
+        }
+        chunk->done = true;
+        data_cond.notify_one();
+    }
+}
+
+void TarSpeculativeGzipReader::schedule() {
+    size_t count = (len + TAR_SPECULATIVE_GZIP_CHUNK_SIZE - 1) / TAR_SPECULATIVE_GZIP_CHUNK_SIZE;
+    while (next_chunk < count && chunks.size() < max_chunks) {
+        size_t start = next_chunk * TAR_SPECULATIVE_GZIP_CHUNK_SIZE;
+        size_t end = std::min(start + TAR_SPECULATIVE_GZIP_CHUNK_SIZE, len);
+        std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>((int64)start * 8, (int64)end * 8);
+        ++next_chunk;
+        chunks.push_back(chunk);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            work.push_back(chunk);
+        }
+        work_cond.notify_one();
+    }
+}
+
+void TarSpeculativeGzipReader::decompress(Chunk& chunk) const {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    TarInflater inflater(data, len, TAR_SPECULATIVE_GZIP_MAX_OUTPUT);
+
+    // the first chunk starts with the first member; the others at the first member header or dynamic Huffman
+    // block header from which a block can be decompressed that is followed by a plausible block header
+    int64 offset = chunk.start;
+    bool header = !offset;
+    while (offset) {
+        for (; offset < chunk.end; ++offset) {
+            if (!(offset & 7) && tar_is_gzip_header(p + (offset >> 3), len - (size_t)(offset >> 3))) {
+                header = true;
+                break;
+            }
+            if (inflater.maybeDynamicBlock(offset)) {
+                header = false;
+                break;
+            }
+        }
+        if (offset == chunk.end || chunk.cancelled) {
+            return;
+        }
+        inflater.reset(offset, header, nullptr);
+        if (inflater.next() > 0 && (inflater.at_header || inflater.maybeBlock(inflater.pos))) {
+            break;
+        }
+        ++offset;
+    }
+    if (!offset) {
+        inflater.reset(0, true, nullptr);
+        if (inflater.next() <= 0) {
+            return;
+        }
+    }
+    chunk.first = offset;
+    chunk.first_header = header;
+
+    // decompression stops at the same point as that of the previous chunk: the first block or member boundary at
+    // or after the end of the chunk
+    while (inflater.pos < chunk.end) {
+        if (chunk.cancelled) {
+            return;
+        }
+        int rc = inflater.next();
+        if (rc < 0) {
+            return;
+        }
+        if (!rc) {
+            chunk.finished = true;
+            break;
+        }
+    }
+    chunk.last = inflater.pos;
+    chunk.last_header = inflater.at_header;
+    inflater.out.resize(inflater.n);
+    chunk.symbols.swap(inflater.out);
+    chunk.members.swap(inflater.members);
+    chunk.ok = true;
+}
+
+la_ssize_t TarSpeculativeGzipReader::read(const void** buf) {
+    while (true) {
+        buffer.clear();
+        if (fallback_end >= 0) {
+            if (readFallback()) {
+                return -1;
+            }
+        } else {
+            if (finished) {
+                return 0;
+            }
+            schedule();
+            if (chunks.empty()) {
+                // the rest of the data is read up to the end of the last member
+                startFallback(std::numeric_limits<int64>::max());
+                continue;
+            }
+            std::shared_ptr<Chunk> chunk = std::move(chunks.front());
+            chunks.pop_front();
+            // chunks ending before the end of the data read so far are not needed
+            if (pos >= chunk->end) {
+                chunk->cancelled = true;
+                continue;
+            }
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!chunk->done) {
+                    data_cond.wait(guard);
+                }
+            }
+            // chunks that started at a false block header or could not be decompressed are decompressed again
+            if (!chunk->ok || chunk->first != pos || chunk->first_header != pos_header) {
+                if (stats) {
+                    ++stats->fallback_chunks;
+                }
+                startFallback(chunk->end);
+                continue;
+            }
+            if (output(chunk->symbols.data(), chunk->symbols.size(), chunk->members, 0)) {
+                return -1;
+            }
+            if (stats) {
+                ++stats->chunks;
+            }
+            pos = chunk->last;
+            pos_header = chunk->last_header;
+            finished = chunk->finished;
+        }
+        if (!buffer.empty()) {
+            *buf = buffer.data();
+            return (la_ssize_t)buffer.size();
+        }
+    }
+}
+
+void TarSpeculativeGzipReader::startFallback(int64 end) {
+    if (!fallback) {
+        fallback.reset(new TarInflater(data, len, std::numeric_limits<size_t>::max()));
+    }
+    fallback->reset(pos, pos_header, &window);
+    fallback_end = end;
+}
+
+int TarSpeculativeGzipReader::readFallback() {
+    // the symbols before the current block are already read
+    size_t base = fallback->n;
+    int rc = fallback->next();
+    if (rc < 0) {
+        err = fallback->err;
+        return -1;
+    }
+    if (output(&fallback->out[base], fallback->n - base, fallback->members, base)) {
+        return -1;
+    }
+    fallback->compact();
+    pos = fallback->pos;
+    pos_header = fallback->at_header;
+    if (!rc) {
+        finished = true;
+    }
+    if (!rc || pos >= fallback_end) {
+        fallback_end = -1;
+    }
+    return 0;
+}
+
+int TarSpeculativeGzipReader::output(const uint16_t* symbols, size_t count,
+                                     const std::vector<TarGzipMemberEnd>& members, size_t base) {
+    size_t start = buffer.size();
+    buffer.resize(start + count);
+    unsigned char* o = reinterpret_cast<unsigned char*>(&buffer[start]);
+    // markers give the position in the window preceding the symbols, which is shorter at the start of the data
+    size_t missing = TAR_DEFLATE_WINDOW_SIZE - window.size();
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t s = symbols[i];
+        if (s < 256) {
+            o[i] = (unsigned char)s;
+            continue;
+        }
+        size_t w = s & 0x7fff;
+        if (w < missing) {
+            err = "invalid distance too far back";
+            return -1;
+        }
+        o[i] = (unsigned char)window[w - missing];
+    }
+
+    size_t done = 0;
+    for (const TarGzipMemberEnd& m : members) {
+        size_t end = m.offset - base;
+        crc = crc32(crc, o + done, (uInt)(end - done));
+        size += (uint32_t)(end - done);
+        if (crc != m.crc || size != m.size) {
+            err = crc != m.crc ? "incorrect data check" : "incorrect length check";
+            return -1;
+        }
+        crc = 0;
+        size = 0;
+        done = end;
+    }
+    crc = crc32(crc, o + done, (uInt)(count - done));
+    size += (uint32_t)(count - done);
+
+    if (count >= TAR_DEFLATE_WINDOW_SIZE) {
+        window.assign(reinterpret_cast<char*>(o) + count - TAR_DEFLATE_WINDOW_SIZE, TAR_DEFLATE_WINDOW_SIZE);
+    } else {
+        window.append(reinterpret_cast<char*>(o), count);
+        if (window.size() > TAR_DEFLATE_WINDOW_SIZE) {
+            window.erase(0, window.size() - TAR_DEFLATE_WINDOW_SIZE);
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,195 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarSpeculativeGzipReader.h multi-threaded decompression of gzip archives with few members */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARSPECULATIVEGZIPREADER_H
+#define _QORE_TAR_TARSPECULATIVEGZIPREADER_H
+
+#include "TarSeekSource.h"
+
+#include <atomic>
+#include <memory>
+
+//! Counts of the chunks read by speculative gzip readers, reported by TarFile::getDecompressionInfo()
+struct TarSpeculativeGzipStats {
+    //! Number of chunks whose speculatively decompressed data was used
+    std::atomic<int64> chunks;
+    //! Number of chunks that were decompressed again by the reading thread
+    std::atomic<int64> fallback_chunks;
+
+    DLLLOCAL TarSpeculativeGzipStats() : chunks(0), fallback_chunks(0) {
+    }
+};
+
+#ifdef HAVE_ZLIB
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Compressed size of the chunks decompressed by each thread
+#define TAR_SPECULATIVE_GZIP_CHUNK_SIZE (1024 * 1024)
+//! Maximum number of bytes decompressed from a chunk; larger chunks are decompressed again by the reader
+#define TAR_SPECULATIVE_GZIP_MAX_OUTPUT (32 * 1024 * 1024)
+//! Size of the deflate window
+#define TAR_DEFLATE_WINDOW_SIZE         32768
+
+class TarInflater;
+
+//! The trailer of a gzip member found while decompressing
+struct TarGzipMemberEnd {
+    //! Number of decompressed symbols before the end of the member
+    size_t offset;
+    uint32_t crc;
+    uint32_t size;
+};
+
+//! Decompresses gzip data held in memory with a pool of threads, including gzip data with a single member
+/** The compressed data is cut into chunks of TAR_SPECULATIVE_GZIP_CHUNK_SIZE bytes.  Each worker thread searches
+    its chunk for the first deflate block with a valid dynamic Huffman header (or a gzip member header) and
+    decompresses from there until the first block boundary after the end of the chunk.  As the data preceding
+    the chunk is not known yet, back-references into the previous 32 KiB are kept as markers giving the window
+    position; the decompressed data is stored as 16-bit symbols, literal bytes below 256 and markers above.
+
+    The reader takes the chunks in order: a chunk starting exactly where the data read so far ends is valid, and
+    its markers are replaced with the bytes of the window known at this point.  The data of a chunk that started
+    at a false block header, or that could not be decompressed, is decompressed again by the reader from the
+    end of the previous data.  The CRC and size in the trailer of each member are checked.
+*/
+class TarSpeculativeGzipReader : public TarSeekReader {
+public:
+    //! Creates a reader for gzip data and starts its threads
+    /** The data must remain valid until the reader has been deleted.
+
+        @param stats if given, the chunks read are counted here
+
+        @return the reader, or nullptr if the data is not gzip-compressed
+    */
+    DLLLOCAL static TarSpeculativeGzipReader* create(const char* data, size_t len, unsigned threads,
+                                                     std::shared_ptr<TarSpeculativeGzipStats> stats = nullptr);
+
+    //! Stops and joins the worker threads
+    DLLLOCAL virtual ~TarSpeculativeGzipReader();
+
+    DLLLOCAL virtual la_ssize_t read(const void** buffer) override;
+
+private:
+    //! A chunk of compressed data and its speculatively decompressed form
+    struct Chunk {
+        // bit offsets of the start and end of the chunk
+        int64 start;
+        int64 end;
+        // where decompression started and stopped, as bit offsets; the flags are set if the offset is that of a
+        // gzip member header (or of the end of the data)
+        int64 first = -1;
+        bool first_header = false;
+        int64 last = -1;
+        bool last_header = false;
+        // true if no gzip member follows the data
+        bool finished = false;
+        // true if the chunk was decompressed
+        bool ok = false;
+        std::vector<uint16_t> symbols;
+        std::vector<TarGzipMemberEnd> members;
+        bool done = false;
+        // set when the data of the chunk is not needed
+        std::atomic<bool> cancelled;
+
+        DLLLOCAL Chunk(int64 start, int64 end) : start(start), end(end), cancelled(false) {
+        }
+    };
+
+    const char* data;
+    size_t len;
+    // maximum number of chunks being decompressed or waiting to be read
+    size_t max_chunks = 0;
+    // number of chunks queued so far
+    size_t next_chunk = 0;
+    // chunks in order that have not been read yet; the worker threads take chunks from the work queue
+    std::deque<std::shared_ptr<Chunk>> chunks;
+    std::deque<std::shared_ptr<Chunk>> work;
+
+    // bit offset of the end of the data read so far, and true if it is that of a gzip member header
+    int64 pos = 0;
+    bool pos_header = true;
+    bool finished = false;
+    // the last TAR_DEFLATE_WINDOW_SIZE bytes read
+    std::string window;
+    // CRC and size of the member being read
+    uint32_t crc = 0;
+    uint32_t size = 0;
+    // decompresses the data of chunks that could not be used up to the bit offset fallback_end; -1 if not in use
+    std::unique_ptr<TarInflater> fallback;
+    int64 fallback_end = -1;
+    // the data last returned by read()
+    std::string buffer;
+    // chunk counts, may be nullptr
+    std::shared_ptr<TarSpeculativeGzipStats> stats;
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    // signaled when a chunk is queued or the threads are stopped
+    std::condition_variable work_cond;
+    // signaled when a chunk is done
+    std::condition_variable data_cond;
+    bool stop = false;
+
+    DLLLOCAL TarSpeculativeGzipReader(const char* data, size_t len);
+
+    //! Starts the worker threads; returns -1 on failure
+    DLLLOCAL int start(unsigned count);
+
+    //! Runs a worker thread
+    DLLLOCAL void run();
+
+    //! Queues chunks until enough chunks are being decompressed
+    DLLLOCAL void schedule();
+
+    //! Decompresses a chunk from the first block or member header found in it
+    DLLLOCAL void decompress(Chunk& chunk) const;
+
+    //! Starts decompressing the data of a chunk in the reader
+    DLLLOCAL void startFallback(int64 end);
+
+    //! Decompresses the next block with the fallback decompressor; returns -1 on error
+    DLLLOCAL int readFallback();
+
+    //! Appends decompressed symbols to the buffer, replacing markers and checking member trailers
+    /** @param symbols the symbols
+        @param count the number of symbols
+        @param members the member trailers found, with offsets relative to \a base
+        @param base the offset of the first symbol
+
+        @return 0 for OK, -1 if a marker cannot be resolved or a trailer does not match
+    */
+    DLLLOCAL int output(const uint16_t* symbols, size_t count, const std::vector<TarGzipMemberEnd>& members,
+                        size_t base);
+};
+#endif
+
+#endif // _QORE_TAR_TARSPECULATIVEGZIPREADER_H
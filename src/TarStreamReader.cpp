@@ -0,0 +1,147 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarStreamReader.cpp reading archives from input streams */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarStreamReader.h"
+
+#include <system_error>
+
+TarStreamReader::TarStreamReader(InputStream* input, unsigned depth, size_t size) : input(input), size(size) {
+    // one buffer more than the depth holds the data last returned while the others are filled
+    buffers.resize(depth + 1);
+    sizes.resize(depth + 1);
+}
+
+TarStreamReader::~TarStreamReader() {
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        space_cond.notify_all();
+        thread.join();
+    }
+}
+
+int TarStreamReader::start() {
+    if (buffers.size() == 1) {
+        return 0;
+    }
+    try {
+        thread = std::thread([this] () { run(); });
+    } catch (std::system_error&) {
+        return -1;
+    }
+    return 0;
+}
+
+int64 TarStreamReader::readStream(char* buf, std::string& error) {
+    ExceptionSink xsink;
+    int64 n = input->read(buf, (int64)size, &xsink);
+    if (xsink) {
+        // the error is raised by the thread reading the archive, so the stream's exception is kept in the message
+        error = "failed to read from the input stream: " + get_exception_text(xsink);
+        xsink.clear();
+        return -1;
+    }
+    return n;
+}
+
+void TarStreamReader::run() {
+    // the stream may be implemented in Qore, so the thread is registered while reading it
+    int reg = q_register_foreign_thread();
+    std::string error;
+    if (reg == QFT_ERROR) {
+        error = "failed to register the read-ahead thread";
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (error.empty()) {
+        while (ready + held == buffers.size() && !stop) {
+            space_cond.wait(guard);
+        }
+        if (stop) {
+            break;
+        }
+        // the buffer is neither ready nor held, so it is not used by the reading thread
+        size_t i = (head + ready) % buffers.size();
+        guard.unlock();
+        if (!buffers[i]) {
+            buffers[i].reset(new char[size]);
+        }
+        int64 n = readStream(buffers[i].get(), error);
+        guard.lock();
+        if (n <= 0) {
+            break;
+        }
+        sizes[i] = (size_t)n;
+        ++ready;
+        data_cond.notify_one();
+    }
+    eof = true;
+    thread_err = error;
+    data_cond.notify_one();
+    guard.unlock();
+
+    if (reg == QFT_OK) {
+        q_deregister_foreign_thread();
+    }
+}
+
+la_ssize_t TarStreamReader::read(const void** buf) {
+    if (buffers.size() == 1) {
+        if (!buffers[0]) {
+            buffers[0].reset(new char[size]);
+        }
+        int64 n = readStream(buffers[0].get(), err);
+        if (n > 0) {
+            *buf = buffers[0].get();
+        }
+        return (la_ssize_t)n;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    // the buffer returned last is no longer used by libarchive
+    if (held) {
+        held = false;
+        space_cond.notify_one();
+    }
+    while (!ready && !eof) {
+        data_cond.wait(guard);
+    }
+    if (!ready) {
+        if (!thread_err.empty()) {
+            err = thread_err;
+            return -1;
+        }
+        return 0;
+    }
+    *buf = buffers[head].get();
+    la_ssize_t n = (la_ssize_t)sizes[head];
+    head = (head + 1) % buffers.size();
+    --ready;
+    held = true;
+    return n;
+}
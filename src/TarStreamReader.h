@@ -0,0 +1,101 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarStreamReader.h reading archives from input streams */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARSTREAMREADER_H
+#define _QORE_TAR_TARSTREAMREADER_H
+
+#include "TarSeekSource.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Default number of blocks read ahead from an input stream
+#define TAR_READ_AHEAD_DEPTH    4
+//! Default size of the blocks read from an input stream
+#define TAR_READ_AHEAD_SIZE     TAR_BUFFER_SIZE
+//! Maximum number of blocks read ahead from an input stream
+#define TAR_MAX_READ_AHEAD_DEPTH 1024
+//! Maximum size of the blocks read from an input stream
+#define TAR_MAX_READ_AHEAD_SIZE (64 * 1024 * 1024)
+
+//! Reads archive data from an InputStream, with a thread reading ahead into a ring of buffers
+/** With a depth of 0 the stream is read in the thread reading the archive.  Otherwise a thread fills up to depth
+    buffers while the data returned before is parsed and decompressed, so reading the stream overlaps with them.
+    The thread is registered with Qore while it runs, as the stream may be implemented in Qore.  The stream must
+    not be used by other threads until the reader has been deleted; deleting the reader waits for a read of the
+    stream in progress to return.
+*/
+class TarStreamReader : public TarSeekReader {
+public:
+    //! Creates the reader; the stream must remain valid until the reader has been deleted
+    /** @param input the stream to read
+        @param depth the number of blocks read ahead; 0 to read synchronously
+        @param size the maximum size of each block
+    */
+    DLLLOCAL TarStreamReader(InputStream* input, unsigned depth, size_t size);
+
+    //! Stops and joins the read-ahead thread
+    DLLLOCAL virtual ~TarStreamReader();
+
+    //! Starts the read-ahead thread; returns -1 on failure
+    DLLLOCAL int start();
+
+    DLLLOCAL virtual la_ssize_t read(const void** buffer) override;
+
+private:
+    InputStream* input;
+    size_t size;
+    // ring of buffers and the size of their data: ready buffers start at head; the buffer before head is the one
+    // last returned by read() if held is set
+    std::vector<std::unique_ptr<char[]>> buffers;
+    std::vector<size_t> sizes;
+    size_t head = 0;
+    size_t ready = 0;
+    bool held = false;
+    // set by the thread at the end of the stream or after an error, which is given in thread_err
+    bool eof = false;
+    std::string thread_err;
+
+    std::thread thread;
+    std::mutex lock;
+    // signaled when a buffer has been filled or the thread has ended
+    std::condition_variable data_cond;
+    // signaled when a buffer has been returned or the thread is stopped
+    std::condition_variable space_cond;
+    bool stop = false;
+
+    //! Runs the read-ahead thread
+    DLLLOCAL void run();
+
+    //! Reads a block from the stream; returns the number of bytes read, 0 at the end of the stream and -1 on error
+    DLLLOCAL int64 readStream(char* buf, std::string& error);
+};
+
+#endif // _QORE_TAR_TARSTREAMREADER_H
@@ -0,0 +1,414 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarTreeWalker.cpp directory tree walker implementation */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarTreeWalker.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifndef DT_UNKNOWN
+// the directory does not give entry types on this platform
+#define DT_UNKNOWN 0
+#define DT_DIR     4
+#define DT_REG     8
+#define DT_LNK     10
+#define TAR_NO_D_TYPE 1
+#endif
+
+#ifdef __linux__
+// the record returned by getdents64(2)
+struct tar_linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+// RAII wrapper for file descriptors
+class TarFdGuard {
+public:
+    DLLLOCAL explicit TarFdGuard(int fd = -1) : fd(fd) {
+    }
+
+    DLLLOCAL ~TarFdGuard() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    TarFdGuard(const TarFdGuard&) = delete;
+    TarFdGuard& operator=(const TarFdGuard&) = delete;
+
+    DLLLOCAL int get() const {
+        return fd;
+    }
+
+    DLLLOCAL void reset(int new_fd = -1) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = new_fd;
+    }
+
+private:
+    int fd;
+};
+
+static bool is_dot_entry(const char* name) {
+    return name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]));
+}
+
+int TarTreeWalker::parse(const QoreHashNode* opts, ExceptionSink* xsink) {
+    if (!opts) {
+        return 0;
+    }
+
+    QoreValue v = opts->getKeyValue("case_insensitive");
+    if (!v.isNothing() && v.getAsBool()) {
+#ifdef FNM_CASEFOLD
+        fnmatch_flags |= FNM_CASEFOLD;
+#else
+        xsink->raiseException("TAR-ERROR", "case-insensitive glob patterns are not supported on this platform");
+        return -1;
+#endif
+    }
+
+    if (parsePatterns(opts, "include", include, xsink) || parsePatterns(opts, "exclude", exclude, xsink)) {
+        return -1;
+    }
+
+    v = opts->getKeyValue("symlinks");
+    if (v.getType() == NT_STRING) {
+        const char* policy = v.get<const QoreStringNode>()->c_str();
+        if (!strcmp(policy, "store")) {
+            symlinks = TAR_SYMLINKS_STORE;
+        } else if (!strcmp(policy, "follow")) {
+            symlinks = TAR_SYMLINKS_FOLLOW;
+        } else if (!strcmp(policy, "skip")) {
+            symlinks = TAR_SYMLINKS_SKIP;
+        } else {
+            xsink->raiseException("TAR-ERROR", "invalid symlinks option '%s'; expecting \"store\", \"follow\" or "
+                                  "\"skip\"", policy);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int TarTreeWalker::parsePatterns(const QoreHashNode* opts, const char* key, std::vector<Pattern>& patterns,
+                                 ExceptionSink* xsink) {
+    QoreValue v = opts->getKeyValue(key);
+    if (v.getType() != NT_LIST) {
+        return 0;
+    }
+    const QoreListNode* l = v.get<const QoreListNode>();
+    for (size_t i = 0, n = l->size(); i < n; ++i) {
+        std::string glob = l->retrieveEntry(i).get<const QoreStringNode>()->c_str();
+        bool dir_only = false;
+        while (!glob.empty() && glob.back() == '/') {
+            glob.pop_back();
+            dir_only = true;
+        }
+        if (glob.empty()) {
+            xsink->raiseException("TAR-ERROR", "empty %s pattern", key);
+            return -1;
+        }
+        bool base_name = glob.find('/') == std::string::npos;
+        patterns.push_back({std::move(glob), dir_only, base_name});
+    }
+    return 0;
+}
+
+bool TarTreeWalker::match(const std::vector<Pattern>& patterns, const std::string& path, const char* name,
+                          bool dir) const {
+    for (const Pattern& p : patterns) {
+        if (p.dir_only && !dir) {
+            continue;
+        }
+        if (!fnmatch(p.glob.c_str(), p.base_name ? name : path.c_str(), fnmatch_flags)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TarTreeWalker::skip(const std::string& path, const char* name, bool dir) const {
+    if (match(exclude, path, name, dir)) {
+        return true;
+    }
+    // include patterns only select files; directories are always searched
+    return !dir && !include.empty() && !match(include, path, name, dir);
+}
+
+int TarTreeWalker::walk(const char* dir, const visitor_t& visit, ExceptionSink* xsink) {
+    root = dir;
+    visitor = &visit;
+    this->xsink = xsink;
+    pending.clear();
+    ancestors.clear();
+
+    TarFdGuard fd(::open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd.get() < 0) {
+        return raiseError("open directory", std::string(), errno);
+    }
+    struct stat st;
+    if (fstat(fd.get(), &st)) {
+        return raiseError("stat directory", std::string(), errno);
+    }
+    return walkDir(fd.get(), std::string(), st);
+}
+
+int TarTreeWalker::readDir(int fd, const std::string& path, std::vector<DirEntry>& entries) {
+#ifdef __linux__
+    // getdents64(2) is called directly to read many entries per call into a buffer that is reused for all
+    // directories
+    buffer.resize(TAR_DIRENT_BUFFER_SIZE);
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return raiseError("read directory", path, errno);
+        }
+        if (!n) {
+            break;
+        }
+        for (long pos = 0; pos < n;) {
+            const tar_linux_dirent64* d = reinterpret_cast<const tar_linux_dirent64*>(buffer.data() + pos);
+            pos += d->d_reclen;
+            if (!is_dot_entry(d->d_name)) {
+                entries.push_back({d->d_name, d->d_type});
+            }
+        }
+    }
+#else
+    // closedir() closes the descriptor, which is still needed for the entries
+    int dir_fd = dup(fd);
+    if (dir_fd < 0) {
+        return raiseError("read directory", path, errno);
+    }
+    DIR* dir = fdopendir(dir_fd);
+    if (!dir) {
+        int err = errno;
+        ::close(dir_fd);
+        return raiseError("read directory", path, err);
+    }
+    while (true) {
+        errno = 0;
+        struct dirent* d = readdir(dir);
+        if (!d) {
+            int err = errno;
+            closedir(dir);
+            if (err) {
+                return raiseError("read directory", path, err);
+            }
+            break;
+        }
+        if (!is_dot_entry(d->d_name)) {
+#ifdef TAR_NO_D_TYPE
+            entries.push_back({d->d_name, DT_UNKNOWN});
+#else
+            entries.push_back({d->d_name, d->d_type});
+#endif
+        }
+    }
+#endif
+    // entries are added in name order, so archives of the same tree are the same
+    std::sort(entries.begin(), entries.end(), [] (const DirEntry& a, const DirEntry& b) {
+        return a.name < b.name;
+    });
+    return 0;
+}
+
+int TarTreeWalker::walkDir(int fd, const std::string& path, const struct stat& st) {
+    ancestors.emplace_back(st.st_dev, st.st_ino);
+    pending.push_back({path, st});
+
+    // without include patterns, all directories are added
+    int rc = include.empty() ? flushPending() : 0;
+    if (!rc) {
+        std::vector<DirEntry> entries;
+        rc = readDir(fd, path, entries);
+        for (size_t i = 0; !rc && i < entries.size(); ++i) {
+            rc = walkEntry(fd, path, entries[i]);
+        }
+    }
+
+    // the directory is left out if no entry below it was added
+    if (!pending.empty() && pending.back().path == path) {
+        pending.pop_back();
+    }
+    ancestors.pop_back();
+    return rc;
+}
+
+int TarTreeWalker::walkEntry(int dir_fd, const std::string& dir_path, const DirEntry& e) {
+    const char* name = e.name.c_str();
+    std::string path = dir_path + e.name;
+    bool follow = symlinks == TAR_SYMLINKS_FOLLOW;
+
+    if (e.type == DT_LNK && symlinks == TAR_SYMLINKS_SKIP) {
+        return 0;
+    }
+    // entries of a known type are filtered without a stat call
+    bool filtered = e.type != DT_UNKNOWN && !(e.type == DT_LNK && follow);
+    if (filtered && skip(path, name, e.type == DT_DIR)) {
+        return 0;
+    }
+
+    struct stat st;
+    // regular files are opened directly; the header is written with the size of the file opened
+    if (e.type == DT_REG) {
+        TarFdGuard fd(openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC));
+        if (fd.get() < 0) {
+            // entries removed while the tree is read are left out
+            if (errno == ENOENT) {
+                return 0;
+            }
+            // the file was replaced with a symbolic link
+            if (errno != ELOOP) {
+                return raiseError("open", path, errno);
+            }
+        } else {
+            if (fstat(fd.get(), &st)) {
+                return raiseError("stat", path, errno);
+            }
+            if (S_ISREG(st.st_mode)) {
+                if (skip_file && st.st_dev == skip_dev && st.st_ino == skip_ino) {
+                    return 0;
+                }
+                return report(path, st, fd.get(), nullptr);
+            }
+        }
+        // the type has changed since the directory was read
+        filtered = false;
+    }
+
+    if (fstatat(dir_fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW)) {
+        int err = errno;
+        // dangling links are stored as links when following links
+        if (err != ENOENT || !follow || fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+            return err == ENOENT ? 0 : raiseError("stat", path, err);
+        }
+    }
+
+    if (S_ISLNK(st.st_mode) && symlinks == TAR_SYMLINKS_SKIP) {
+        return 0;
+    }
+    bool dir = S_ISDIR(st.st_mode);
+    if (!filtered && skip(path, name, dir)) {
+        return 0;
+    }
+    if (skip_file && st.st_dev == skip_dev && st.st_ino == skip_ino) {
+        return 0;
+    }
+
+    if (dir) {
+        for (const auto& a : ancestors) {
+            if (a.first == st.st_dev && a.second == st.st_ino) {
+                xsink->raiseException("TAR-ERROR", "directory loop at '%s/%s'", root, path.c_str());
+                return -1;
+            }
+        }
+        TarFdGuard fd(openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW)));
+        if (fd.get() < 0) {
+            return errno == ENOENT ? 0 : raiseError("open directory", path, errno);
+        }
+        return walkDir(fd.get(), path + "/", st);
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        TarFdGuard fd(openat(dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW)));
+        if (fd.get() < 0) {
+            return errno == ENOENT ? 0 : raiseError("open", path, errno);
+        }
+        if (fstat(fd.get(), &st)) {
+            return raiseError("stat", path, errno);
+        }
+        if (!S_ISREG(st.st_mode)) {
+            xsink->raiseException("TAR-ERROR", "'%s/%s' was replaced while the tree was read", root, path.c_str());
+            return -1;
+        }
+        return report(path, st, fd.get(), nullptr);
+    }
+
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX + 1];
+        ssize_t len = readlinkat(dir_fd, name, target, PATH_MAX);
+        if (len < 0) {
+            return errno == ENOENT ? 0 : raiseError("read link", path, errno);
+        }
+        target[len] = '\0';
+        return report(path, st, -1, target);
+    }
+
+    // sockets cannot be archived
+    if (S_ISSOCK(st.st_mode)) {
+        return 0;
+    }
+    return report(path, st, -1, nullptr);
+}
+
+int TarTreeWalker::flushPending() {
+    for (const PendingDir& d : pending) {
+        if ((*visitor)(d.path, d.st, -1, nullptr)) {
+            pending.clear();
+            return -1;
+        }
+    }
+    pending.clear();
+    return 0;
+}
+
+int TarTreeWalker::report(const std::string& path, const struct stat& st, int fd, const char* target) {
+    if (flushPending()) {
+        return -1;
+    }
+    return (*visitor)(path, st, fd, target);
+}
+
+int TarTreeWalker::raiseError(const char* what, const std::string& path, int err) {
+    if (path.empty()) {
+        xsink->raiseException("TAR-ERROR", "failed to %s '%s': %s", what, root, strerror(err));
+    } else {
+        xsink->raiseException("TAR-ERROR", "failed to %s '%s/%s': %s", what, root, path.c_str(), strerror(err));
+    }
+    return -1;
+}
@@ -0,0 +1,167 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarTreeWalker.h directory tree walker for TarFile::addTree() */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARTREEWALKER_H
+#define _QORE_TAR_TARTREEWALKER_H
+
+#include "tar-module.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! Size of the buffer for reading directory entries
+#define TAR_DIRENT_BUFFER_SIZE 65536
+
+//! Walks a directory tree for TarFile::addTree(), applying the filters given by a TarTreeOptions hash
+/** Directories are read with descriptors relative to their parent (\c openat(2) and \c fstatat(2), and
+    \c getdents64(2) on Linux), so paths are never resolved again from the root.  Entries of each directory are
+    visited in name order, directories before their contents.  The type reported by the directory is used to
+    skip excluded entries without a \c stat call, and regular files are opened first and then checked with
+    \c fstat(2), so the size in the entry header is that of the file being read.
+
+    When include patterns are given, directory entries are only reported once an entry below them is
+    reported, so directories without matching entries are left out.
+*/
+class TarTreeWalker {
+public:
+    //! Called for each entry to add
+    /** @param path the path relative to the source directory; directory paths end with \c "/", and the source
+        directory itself is reported with an empty path
+        @param st the metadata of the entry
+        @param fd a descriptor open for reading for regular files, -1 for all other entries
+        @param target the link target for symbolic links, nullptr for all other entries
+
+        @return 0 to continue, -1 to stop the walk (an exception was raised)
+    */
+    typedef std::function<int (const std::string& path, const struct stat& st, int fd, const char* target)>
+        visitor_t;
+
+    DLLLOCAL TarTreeWalker() {
+    }
+
+    //! Parses a TarTreeOptions hash
+    /** @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int parse(const QoreHashNode* opts, ExceptionSink* xsink);
+
+    //! Sets a file that is never reported, normally the archive being written
+    DLLLOCAL void skipFile(dev_t dev, ino_t ino) {
+        skip_file = true;
+        skip_dev = dev;
+        skip_ino = ino;
+    }
+
+    //! Walks the tree
+    /** @return 0 for OK, -1 if an exception was raised
+    */
+    DLLLOCAL int walk(const char* dir, const visitor_t& visit, ExceptionSink* xsink);
+
+private:
+    //! How symbolic links are handled
+    enum SymlinkPolicy {
+        TAR_SYMLINKS_STORE,
+        TAR_SYMLINKS_FOLLOW,
+        TAR_SYMLINKS_SKIP,
+    };
+
+    //! A parsed include or exclude pattern
+    struct Pattern {
+        std::string glob;
+        // patterns ending with "/" only match directories
+        bool dir_only;
+        // patterns without "/" are matched against the last path component
+        bool base_name;
+    };
+
+    //! An entry read from a directory
+    struct DirEntry {
+        std::string name;
+        // the DT_* type given by the directory, DT_UNKNOWN if not known
+        unsigned char type;
+    };
+
+    //! A directory whose entry has not been reported yet
+    struct PendingDir {
+        std::string path;
+        struct stat st;
+    };
+
+    std::vector<Pattern> include;
+    std::vector<Pattern> exclude;
+    int fnmatch_flags = 0;
+    SymlinkPolicy symlinks = TAR_SYMLINKS_STORE;
+
+    bool skip_file = false;
+    dev_t skip_dev = 0;
+    ino_t skip_ino = 0;
+
+    // state of the current walk
+    const char* root = nullptr;
+    const visitor_t* visitor = nullptr;
+    ExceptionSink* xsink = nullptr;
+    std::vector<char> buffer;
+    std::vector<PendingDir> pending;
+    // device and inode numbers of the directories being walked, to detect loops when following links
+    std::vector<std::pair<dev_t, ino_t>> ancestors;
+
+    DLLLOCAL int parsePatterns(const QoreHashNode* opts, const char* key, std::vector<Pattern>& patterns,
+                               ExceptionSink* xsink);
+
+    //! Returns true if the path matches one of the patterns
+    DLLLOCAL bool match(const std::vector<Pattern>& patterns, const std::string& path, const char* name,
+                        bool dir) const;
+
+    //! Returns true if the entry is excluded or not included
+    DLLLOCAL bool skip(const std::string& path, const char* name, bool dir) const;
+
+    //! Reads the entries of a directory, sorted by name
+    DLLLOCAL int readDir(int fd, const std::string& path, std::vector<DirEntry>& entries);
+
+    //! Walks a directory; \a path is its relative path, empty or ending with "/"
+    DLLLOCAL int walkDir(int fd, const std::string& path, const struct stat& st);
+
+    //! Handles an entry of a directory
+    DLLLOCAL int walkEntry(int dir_fd, const std::string& dir_path, const DirEntry& e);
+
+    //! Reports the directories waiting for their first entry
+    DLLLOCAL int flushPending();
+
+    //! Reports an entry
+    DLLLOCAL int report(const std::string& path, const struct stat& st, int fd, const char* target);
+
+    //! Raises an exception for a failed system call on a path
+    DLLLOCAL int raiseError(const char* what, const std::string& path, int err);
+
+    DLLLOCAL TarTreeWalker(const TarTreeWalker&) = delete;
+    DLLLOCAL TarTreeWalker& operator=(const TarTreeWalker&) = delete;
+};
+
+#endif // _QORE_TAR_TARTREEWALKER_H
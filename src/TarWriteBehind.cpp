@@ -0,0 +1,171 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarWriteBehind.cpp writing archive data with a background thread */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TarWriteBehind.h"
+
+#include <system_error>
+
+TarWriteBehind::TarWriteBehind(TarSinkOutput output, unsigned depth, bool qore_thread) : output(output),
+        depth(depth), qore_thread(qore_thread) {
+}
+
+TarWriteBehind::~TarWriteBehind() {
+    stopThread();
+}
+
+int TarWriteBehind::start() {
+    if (!depth) {
+        return 0;
+    }
+    try {
+        thread = std::thread([this] () { run(); });
+    } catch (std::system_error&) {
+        return -1;
+    }
+    return 0;
+}
+
+void TarWriteBehind::stopThread() {
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        data_cond.notify_one();
+        thread.join();
+    }
+}
+
+void TarWriteBehind::run() {
+    // the output may be a stream implemented in Qore, in which case the thread is registered while writing it
+    int reg = qore_thread ? q_register_foreign_thread() : QFT_REGISTERED;
+
+    std::unique_lock<std::mutex> guard(lock);
+    if (reg == QFT_ERROR) {
+        failed = true;
+        output_err = "failed to register the write-behind thread";
+        space_cond.notify_all();
+    }
+    while (!failed) {
+        while (queue.empty() && !stop) {
+            data_cond.wait(guard);
+        }
+        if (stop) {
+            break;
+        }
+        std::string block = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        guard.unlock();
+        std::string err;
+        int rc = output(block.data(), block.size(), err);
+        guard.lock();
+        busy = false;
+        if (rc) {
+            failed = true;
+            output_err = err;
+            queue.clear();
+        } else if (spare.size() < depth) {
+            block.clear();
+            spare.push_back(std::move(block));
+        }
+        space_cond.notify_all();
+    }
+    guard.unlock();
+
+    if (reg == QFT_OK) {
+        q_deregister_foreign_thread();
+    }
+}
+
+int TarWriteBehind::writeBlock(std::string& err) {
+    if (!depth) {
+        if (!failed && output(pending.data(), pending.size(), output_err)) {
+            failed = true;
+        }
+        pending.clear();
+        if (failed) {
+            err = output_err;
+            return -1;
+        }
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (queue.size() >= depth && !failed) {
+        space_cond.wait(guard);
+    }
+    if (failed) {
+        err = output_err;
+        return -1;
+    }
+    queue.push_back(std::move(pending));
+    if (spare.empty()) {
+        pending = std::string();
+    } else {
+        pending = std::move(spare.back());
+        spare.pop_back();
+    }
+    data_cond.notify_one();
+    return 0;
+}
+
+int TarWriteBehind::write(const void* data, size_t len, std::string& err) {
+    pending.append(static_cast<const char*>(data), len);
+    if (pending.size() < TAR_WRITE_BEHIND_SIZE) {
+        return 0;
+    }
+    return writeBlock(err);
+}
+
+int TarWriteBehind::flush(std::string& err) {
+    if (!pending.empty() && writeBlock(err)) {
+        return -1;
+    }
+    if (!depth) {
+        if (failed) {
+            err = output_err;
+            return -1;
+        }
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    while ((!queue.empty() || busy) && !failed) {
+        space_cond.wait(guard);
+    }
+    if (failed) {
+        err = output_err;
+        return -1;
+    }
+    return 0;
+}
+
+int TarWriteBehind::finish(std::string& err) {
+    int rc = flush(err);
+    stopThread();
+    return rc;
+}
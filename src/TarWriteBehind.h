@@ -0,0 +1,116 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/** @file TarWriteBehind.h writing archive data with a background thread */
+/*
+    Qore tar module
+
+    Copyright (C) 2026 Qore Technologies, s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _QORE_TAR_TARWRITEBEHIND_H
+#define _QORE_TAR_TARWRITEBEHIND_H
+
+#include "TarCompressionSink.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Default number of blocks queued for the write-behind thread
+#define TAR_WRITE_BEHIND_DEPTH  4
+//! Maximum number of blocks queued for the write-behind thread
+#define TAR_MAX_WRITE_BEHIND_DEPTH 1024
+//! Size of the blocks written to the output
+#define TAR_WRITE_BEHIND_SIZE   (128 * 1024)
+
+//! Writes archive data to its output in blocks, with a thread writing the blocks in the background
+/** Data is collected into blocks of TAR_WRITE_BEHIND_SIZE bytes.  With a depth of 0 each block is written in the
+    calling thread when it is full.  Otherwise full blocks are queued for a thread writing them to the output, and
+    writes only wait when depth blocks are queued already, so compressing the archive overlaps with writing it.
+
+    The first error of the output is returned when the next block is written and by flush() and finish(); no more
+    data is written after it.  If the thread is registered with Qore, the output may call Qore code, as a Qore output
+    stream does.  Deleting the writer without calling finish() discards the data not written yet.
+*/
+class TarWriteBehind {
+public:
+    //! Creates the writer; the output must remain valid until the writer has been deleted
+    /** @param output the function writing the data
+        @param depth the number of blocks queued; 0 to write in the calling thread
+        @param qore_thread if true the thread is registered with Qore while it runs
+    */
+    DLLLOCAL TarWriteBehind(TarSinkOutput output, unsigned depth, bool qore_thread);
+
+    //! Stops and joins the thread
+    DLLLOCAL ~TarWriteBehind();
+
+    //! Starts the thread; returns -1 on failure
+    DLLLOCAL int start();
+
+    //! Writes data; returns 0 for OK or -1 and sets the error message if writing has failed
+    DLLLOCAL int write(const void* data, size_t len, std::string& err);
+
+    //! Writes all data written so far to the output and waits until it has been written
+    /** @return 0 for OK or -1 and sets the error message if writing has failed
+    */
+    DLLLOCAL int flush(std::string& err);
+
+    //! Writes all data and stops the thread
+    /** @return 0 for OK or -1 and sets the error message if writing has failed
+    */
+    DLLLOCAL int finish(std::string& err);
+
+private:
+    TarSinkOutput output;
+    unsigned depth;
+    bool qore_thread;
+    // the block being filled by the calling thread
+    std::string pending;
+    // full blocks waiting to be written, and emptied blocks kept for reuse
+    std::deque<std::string> queue;
+    std::vector<std::string> spare;
+    // set while the thread writes a block
+    bool busy = false;
+    // set after the output has failed with the error given in output_err
+    bool failed = false;
+    std::string output_err;
+
+    std::thread thread;
+    std::mutex lock;
+    // signaled when a block has been queued or the thread is stopped
+    std::condition_variable data_cond;
+    // signaled when a block has been written or writing has failed
+    std::condition_variable space_cond;
+    bool stop = false;
+
+    //! Runs the write-behind thread
+    DLLLOCAL void run();
+
+    //! Writes or queues the pending block; returns -1 if writing has failed
+    DLLLOCAL int writeBlock(std::string& err);
+
+    //! Stops and joins the thread
+    DLLLOCAL void stopThread();
+};
+
+#endif // _QORE_TAR_TARWRITEBEHIND_H
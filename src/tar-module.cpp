@@ -29,6 +29,7 @@
 #include "QC_TarEntry.h"
 #include "QC_TarInputStream.h"
 #include "QC_TarOutputStream.h"
+#include "QC_TarEntryIterator.h"
 
 #include <cstring>
 #include <locale.h>
@@ -38,7 +39,7 @@ static void tar_module_ns_init(QoreNamespace* rns, QoreNamespace* qns);
 static void tar_module_delete();
 
 DLLEXPORT char qore_module_name[] = "tar";
-DLLEXPORT char qore_module_version[] = "1.0.0";
+DLLEXPORT char qore_module_version[] = "1.1.0";
 DLLEXPORT char qore_module_description[] = "Qore TAR archive module";
 DLLEXPORT char qore_module_author[] = "Qore Technologies, s.r.o.";
 DLLEXPORT char qore_module_url[] = "https://github.com/qorelanguage/module-tar";
@@ -55,6 +56,10 @@ const TypedHashDecl* hashdeclTarEntryInfo = nullptr;
 const TypedHashDecl* hashdeclTarAddOptions = nullptr;
 const TypedHashDecl* hashdeclTarExtractOptions = nullptr;
 const TypedHashDecl* hashdeclTarCreateOptions = nullptr;
+const TypedHashDecl* hashdeclTarMetadataCacheInfo = nullptr;
+const TypedHashDecl* hashdeclTarQuery = nullptr;
+const TypedHashDecl* hashdeclTarTreeOptions = nullptr;
+const TypedHashDecl* hashdeclTarDecompressionInfo = nullptr;
 
 QoreNamespace TarNS("Qore::Tar");
 
@@ -67,11 +72,16 @@ static QoreStringNode* tar_module_init() {
     hashdeclTarAddOptions = init_hashdecl_TarAddOptions(TarNS);
     hashdeclTarExtractOptions = init_hashdecl_TarExtractOptions(TarNS);
     hashdeclTarCreateOptions = init_hashdecl_TarCreateOptions(TarNS);
+    hashdeclTarMetadataCacheInfo = init_hashdecl_TarMetadataCacheInfo(TarNS);
+    hashdeclTarQuery = init_hashdecl_TarQuery(TarNS);
+    hashdeclTarTreeOptions = init_hashdecl_TarTreeOptions(TarNS);
+    hashdeclTarDecompressionInfo = init_hashdecl_TarDecompressionInfo(TarNS);
 
     // Initialize classes - stream classes must be initialized before TarFile
     // because TarFile references them as return types
     TarNS.addSystemClass(initTarInputStreamClass(TarNS));
     TarNS.addSystemClass(initTarOutputStreamClass(TarNS));
+    TarNS.addSystemClass(initTarEntryIteratorClass(TarNS));
     TarNS.addSystemClass(initTarFileClass(TarNS));
     TarNS.addSystemClass(initTarEntryClass(TarNS));
 
@@ -92,6 +102,23 @@ const char* get_archive_error(struct archive* a) {
     return err ? err : "unknown error";
 }
 
+// Helper function to get the error code and description of the exception raised in an ExceptionSink
+std::string get_exception_text(ExceptionSink& xsink) {
+    std::string text;
+    QoreValue v = xsink.getExceptionErr();
+    if (v.getType() == NT_STRING) {
+        text = v.get<const QoreStringNode>()->c_str();
+    }
+    v = xsink.getExceptionDesc();
+    if (v.getType() == NT_STRING) {
+        if (!text.empty()) {
+            text += ": ";
+        }
+        text += v.get<const QoreStringNode>()->c_str();
+    }
+    return text.empty() ? std::string("unknown error") : text;
+}
+
 // Helper function to convert compression method constant to libarchive filter
 int compression_method_to_filter(int method) {
     switch (method) {
@@ -31,6 +31,8 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include <string>
+
 // Forward declarations
 class QoreTarFile;
 
@@ -39,6 +41,10 @@ DLLLOCAL TypedHashDecl* init_hashdecl_TarEntryInfo(QoreNamespace& ns);
 DLLLOCAL TypedHashDecl* init_hashdecl_TarAddOptions(QoreNamespace& ns);
 DLLLOCAL TypedHashDecl* init_hashdecl_TarExtractOptions(QoreNamespace& ns);
 DLLLOCAL TypedHashDecl* init_hashdecl_TarCreateOptions(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_TarMetadataCacheInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_TarQuery(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_TarTreeOptions(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_TarDecompressionInfo(QoreNamespace& ns);
 
 // Compression methods
 #define TAR_CM_NONE     0   // No compression (.tar)
@@ -59,6 +65,12 @@ DLLLOCAL TypedHashDecl* init_hashdecl_TarCreateOptions(QoreNamespace& ns);
 #define TAR_FORMAT_GNU      2   // GNU tar format
 #define TAR_FORMAT_V7       3   // Old V7 tar
 
+// Buffer size for reading/writing
+#define TAR_BUFFER_SIZE 65536
+
+// Maximum number of threads for parallel extraction and compression
+#define TAR_MAX_THREADS 256
+
 // Mode constants
 enum TarMode {
     TAR_MODE_READ,
@@ -71,6 +83,10 @@ extern const TypedHashDecl* hashdeclTarEntryInfo;
 extern const TypedHashDecl* hashdeclTarAddOptions;
 extern const TypedHashDecl* hashdeclTarExtractOptions;
 extern const TypedHashDecl* hashdeclTarCreateOptions;
+extern const TypedHashDecl* hashdeclTarMetadataCacheInfo;
+extern const TypedHashDecl* hashdeclTarQuery;
+extern const TypedHashDecl* hashdeclTarTreeOptions;
+extern const TypedHashDecl* hashdeclTarDecompressionInfo;
 
 // Namespace
 extern QoreNamespace TarNS;
@@ -78,6 +94,9 @@ extern QoreNamespace TarNS;
 // Helper function to get libarchive error message
 DLLLOCAL const char* get_archive_error(struct archive* a);
 
+// Helper function to get the error code and description of the exception raised in an ExceptionSink
+DLLLOCAL std::string get_exception_text(ExceptionSink& xsink);
+
 // Helper function to convert compression method constant to libarchive filter
 DLLLOCAL int compression_method_to_filter(int method);
 